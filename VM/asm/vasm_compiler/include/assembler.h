@@ -4,25 +4,38 @@
 #include <stdint.h>
 #include "types.h"
 #include "opcodes.h"
+#include "lexer.h"
 
 /* utility */
-void trim_line(char *line);
-int get_register(const char *str);
-int parse_number(const char *str);
-int check_immediate(Assembler *asm_ctx, ErrorContext *err_ctx, int val, const char *operand);
+int get_register(const Token *t);
+int parse_number(const Token *t);
+int check_immediate(Assembler *asm_ctx, ErrorContext *err_ctx, int val, const Token *operand);
 
 /* label operations */
-int find_label(Assembler *asm_ctx, const char *name);
-void add_label(Assembler *asm_ctx, ErrorContext *err_ctx, const char *name, uint16_t address, int is_data);
+void add_label(Assembler *asm_ctx, ErrorContext *err_ctx, const Token *name, uint16_t address, int is_data);
+void link_labels(Assembler *asm_ctx, ErrorContext *err_ctx);
+void check_object(Assembler *asm_ctx, ErrorContext *err_ctx);
+void free_labels(Assembler *asm_ctx);
+
+/* linker */
+int find_label(Assembler *asm_ctx, const char *name, int len);
+int append_label(Assembler *asm_ctx, const Label *lbl);
+
+/* native operations */
+int find_native(Assembler *asm_ctx, const Token *name);
+const char *native_name(Assembler *asm_ctx, int index);
 
 /* emit */
 void emit_byte(Assembler *asm_ctx, ErrorContext *err_ctx, uint8_t byte);
-void emit_or_skip(Assembler *a, ErrorContext *e, int pass, uint8_t byte);
 void emit_data_byte(Assembler *asm_ctx, ErrorContext *err_ctx, uint8_t byte);
 
-/* parse */
-int parse_data_directive(Assembler *asm_ctx, ErrorContext *err_ctx, char *line);
-Opcode get_opcode(const char *mnemonic);
-int parse_instruction(Assembler *asm_ctx, ErrorContext *err_ctx, char *line, int pass);
+/* parse - token lines from lex_line() */
+int parse_data_directive(Assembler *asm_ctx, ErrorContext *err_ctx, const Token *tok, int count);
+int parse_native_directive(Assembler *asm_ctx, ErrorContext *err_ctx, const Token *tok, int count);
+int parse_scope_directive(Assembler *asm_ctx, ErrorContext *err_ctx, const Token *tok, int count,
+                          LabelScope scope);
+int parse_entry_directive(Assembler *asm_ctx, ErrorContext *err_ctx, const Token *tok, int count);
+Opcode get_opcode(const Token *mnemonic);
+int parse_instruction(Assembler *asm_ctx, ErrorContext *err_ctx, const Token *tok, int count);
 
 #endif /* ASSEMBLER_H */
\ No newline at end of file
@@ -0,0 +1,13 @@
+#ifndef BUILD_H
+#define BUILD_H
+
+#include "types.h"
+#include "lexer.h"
+
+void assemble(Assembler *asm_ctx, ErrorContext *err_ctx, const Source *src);
+int compile_object(const char *source_path, const char *object_path, int silent);
+int build_objects(char *const sources[], char *const objects[], int count, int jobs, int rebuild,
+                  int silent);
+int default_jobs(void);
+
+#endif /* BUILD_H */
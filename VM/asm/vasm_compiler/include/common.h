@@ -2,11 +2,13 @@
 #define COMMON_H
 
 /* -------- LIMITS -------- */
-#define MAX_LABELS        256
-#define MAX_LINE_LENGTH   256
+#define MAX_LINE_LENGTH   256   /* source line kept with an error */
+#define MAX_LINE_TOKENS   512
 #define MAX_BYTECODE      1024
 #define MAX_DATA_SECTION  256
 #define MAX_ERRORS        64
+#define MAX_NATIVES       32
+#define MAX_REGISTERS     32    /* R0-R31, one operand byte each like the VM */
 
 /* -------- COLORS -------- */
 #define COLOR_GREEN   "\x1b[32m"
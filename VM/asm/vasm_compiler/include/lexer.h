@@ -0,0 +1,57 @@
+#ifndef LEXER_H
+#define LEXER_H
+
+#include <stddef.h>
+#include "common.h"
+
+/* -------- SOURCE -------- */
+
+typedef struct {
+    const char *text;   /* whole file, followed by a NUL */
+    size_t size;
+    size_t mapped;      /* length of the mapping, 0 if text was read into memory */
+} Source;
+
+int source_open(Source *src, const char *path);
+void source_close(Source *src);
+
+/* -------- TOKENS -------- */
+
+typedef enum {
+    TOK_IDENT,          /* mnemonic, register, label or native name */
+    TOK_NUMBER,         /* starts with a digit or a minus sign, checked by parse_number */
+    TOK_STRING,         /* "...", quotes included, escapes left as written */
+    TOK_DIRECTIVE,      /* .data, .entry, ... */
+    TOK_COMMA,
+    TOK_COLON,
+    TOK_OTHER,          /* any other single character */
+} TokenKind;
+
+/* a token points into the source; nothing is copied or terminated */
+typedef struct {
+    const char *start;
+    int len;
+    int col;            /* 1-based, for error_push */
+    TokenKind kind;
+} Token;
+
+typedef struct {
+    const char *pos;
+    const char *end;
+    const char *line_start;
+    int line;           /* line of the tokens returned last */
+    int next_line;      /* line pos is on */
+} Lexer;
+
+#define SPAN(t) (t).len, (t).start /* arguments for "%.*s" */
+
+void lexer_init(Lexer *lx, const Source *src);
+int lex_line(Lexer *lx, Token *tok, int max);
+
+static FORCE_INLINE int token_is(const Token *t, const char *s) {
+    int i = 0;
+    for (; i < t->len; i++) if (t->start[i] != s[i]) return 0;
+    return s[i] == '\0';
+}
+
+#endif /* LEXER_H */
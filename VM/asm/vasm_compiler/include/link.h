@@ -0,0 +1,8 @@
+#ifndef LINK_H
+#define LINK_H
+
+#include "types.h"
+
+int link_objects(Assembler *asm_ctx, ErrorContext *err_ctx, char *const paths[], int count);
+
+#endif /* LINK_H */
@@ -43,9 +43,165 @@ typedef enum Opcode {
     OP_AND     = 0x25,
     OP_OR      = 0x26,
     OP_ORI     = 0x27,
+    OP_NCALL   = 0x28,
+    OP_SPAWN   = 0x29,
+    OP_YIELD   = 0x2A,
+    OP_JOIN    = 0x2B,
+
+    /* 32-bit immediate forms, picked by the assembler when the value needs them */
+    OP_ADDIW   = 0x2C,
+    OP_XORIW   = 0x2D,
+    OP_ORIW    = 0x2E,
+    OP_CMPIW   = 0x2F,
+    OP_LOADW   = 0x30,
+
+    /* addressing modes of LDB, LDW, STB and STORE: [Ra+Rb] (X), [Ra+disp] (D), [Ra]+ (P) */
+    OP_LDBX    = 0x31,
+    OP_LDBD    = 0x32,
+    OP_LDBP    = 0x33,
+    OP_LDWX    = 0x34,
+    OP_LDWD    = 0x35,
+    OP_LDWP    = 0x36,
+    OP_STBX    = 0x37,
+    OP_STBD    = 0x38,
+    OP_STBP    = 0x39,
+    OP_STORED  = 0x3A,
+    OP_STOREP  = 0x3B,
+
+    /* jumps that test registers instead of the flags, and leave the flags alone */
+    OP_DJNZ    = 0x3C,
+    OP_BEQ     = 0x3D,
+    OP_BNE     = 0x3E,
+    OP_BLT     = 0x3F,
+    OP_BLE     = 0x40,
+    OP_BGT     = 0x41,
+    OP_BGE     = 0x42,
+    OP_BEQI    = 0x43,
+    OP_BNEI    = 0x44,
+    OP_BLTI    = 0x45,
+    OP_BLEI    = 0x46,
+    OP_BGTI    = 0x47,
+    OP_BGEI    = 0x48,
+
+    /* indirect: the target comes from a register or from a jump table in .data */
+    OP_JMPR    = 0x49,
+    OP_CALLR   = 0x4A,
+    OP_SWITCH  = 0x4B,
+
+    /* dense forms written by -z: the target as a signed byte from the end of the instruction */
+    OP_JMP_S   = 0x4C,
+    OP_JE_S    = 0x4D,
+    OP_JNE_S   = 0x4E,
+    OP_JG_S    = 0x4F,
+    OP_JGE_S   = 0x50,
+    OP_JL_S    = 0x51,
+    OP_JLE_S   = 0x52,
+    OP_DJNZ_S  = 0x53,
+    OP_BEQ_S   = 0x54,  /* Rs:Rt in one byte */
+    OP_BNE_S   = 0x55,
+    OP_BLT_S   = 0x56,
+    OP_BLE_S   = 0x57,
+    OP_BGT_S   = 0x58,
+    OP_BGE_S   = 0x59,
+    OP_BEQI_S  = 0x5A,
+    OP_BNEI_S  = 0x5B,
+    OP_BLTI_S  = 0x5C,
+    OP_BLEI_S  = 0x5D,
+    OP_BGTI_S  = 0x5E,
+    OP_BGEI_S  = 0x5F,
 
     OP_NOP     = 0x60,
+
+    /* dense forms written by -z: two registers of R0-R15 in one byte, the first in the high nibble */
+    OP_ADD_PK  = 0x61,  /* Rd:Rs, Rt */
+    OP_SUB_PK  = 0x62,
+    OP_MUL_PK  = 0x63,
+    OP_DIV_PK  = 0x64,
+    OP_AND_PK  = 0x65,
+    OP_OR_PK   = 0x66,
+    OP_XOR_PK  = 0x67,
+    OP_SHL_PK  = 0x68,
+    OP_SHR_PK  = 0x69,
+    OP_ADDI_PK = 0x6A,  /* Rd:Rs, imm8 */
+    OP_XORI_PK = 0x6B,
+    OP_ORI_PK  = 0x6C,
+    OP_SHLI_PK = 0x6D,
+    OP_SHRI_PK = 0x6E,
+    OP_MOV_PK  = 0x6F,  /* Rd:Rs */
+    OP_LDB_PK  = 0x70,  /* Rd:Ra */
+    OP_CMP_PK  = 0x71,  /* Rs:Rt */
+    OP_LOADB   = 0x72,  /* Rd, imm8 */
+
+    /* heap in VM memory after code, data and bss; flags are left alone */
+    OP_ALLOC   = 0x73,  /* Rd, Rs: Rd = zeroed block of Rs bytes, 0 if none */
+    OP_FREE    = 0x74,  /* Rn */
+    OP_RESET   = 0x75,
+
+    /* written by -O where the flags an instruction sets are never read:
+       the base opcode | OP_FLAGLESS, same operands, flags left alone */
+    OP_FLAGLESS = 0x80,
+    OP_ADD_NF  = 0x81,
+    OP_ADDI_NF = 0x82,
+    OP_SUB_NF  = 0x83,
+    OP_MUL_NF  = 0x84,
+    OP_DIV_NF  = 0x85,
+    OP_MOV_NF  = 0x86,
+    OP_POP_NF  = 0x8D,
+    OP_LOAD_NF = 0x8E,
+    OP_XOR_NF  = 0x8F,
+    OP_XORI_NF = 0x90,
+    OP_SHL_NF  = 0x91,
+    OP_SHLI_NF = 0x92,
+    OP_SHR_NF  = 0x93,
+    OP_SHRI_NF = 0x94,
+    OP_LDB_NF  = 0xA2,
+    OP_AND_NF  = 0xA5,
+    OP_OR_NF   = 0xA6,
+    OP_ORI_NF  = 0xA7,
+    OP_ADDIW_NF = 0xAC,
+    OP_XORIW_NF = 0xAD,
+    OP_ORIW_NF = 0xAE,
+    OP_LOADW_NF = 0xB0,
+    OP_LDBX_NF = 0xB1,
+    OP_LDBD_NF = 0xB2,
+    OP_LDBP_NF = 0xB3,
+    OP_LDWX_NF = 0xB4,
+    OP_LDWD_NF = 0xB5,
+    OP_LDWP_NF = 0xB6,
+    OP_ADD_PK_NF  = 0xE1,
+    OP_SUB_PK_NF  = 0xE2,
+    OP_MUL_PK_NF  = 0xE3,
+    OP_DIV_PK_NF  = 0xE4,
+    OP_AND_PK_NF  = 0xE5,
+    OP_OR_PK_NF   = 0xE6,
+    OP_XOR_PK_NF  = 0xE7,
+    OP_SHL_PK_NF  = 0xE8,
+    OP_SHR_PK_NF  = 0xE9,
+    OP_ADDI_PK_NF = 0xEA,
+    OP_XORI_PK_NF = 0xEB,
+    OP_ORI_PK_NF  = 0xEC,
+    OP_SHLI_PK_NF = 0xED,
+    OP_SHRI_PK_NF = 0xEE,
+    OP_MOV_PK_NF  = 0xEF,
+    OP_LDB_PK_NF  = 0xF0,
+    OP_LOADB_NF   = 0xF2,
+
     OP_DBG     = 0xFF
 } Opcode;
 
+/* builtin natives for NCALL, indices must match the VM */
+typedef enum Native {
+    NATIVE_INVALID = -1,
+    NATIVE_MEMCPY  = 0x00,
+    NATIVE_MEMSET  = 0x01,
+    NATIVE_STRLEN  = 0x02,
+    NATIVE_SORT    = 0x03,
+    NATIVE_HASH    = 0x04,
+    NATIVE_CRC32   = 0x05,
+    NATIVE_ITOA    = 0x06,
+    NATIVE_ATOI    = 0x07,
+
+    NATIVE_BUILTIN_COUNT
+} Native;
+
 #endif /* OPCODES_H */
\ No newline at end of file
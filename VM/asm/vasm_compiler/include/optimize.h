@@ -0,0 +1,11 @@
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+
+#include "types.h"
+
+/* -O pass over the recorded instructions after link_labels(), returns the bytes saved;
+   with a profile (-P) the basic blocks are also laid out by execution count, with
+   dense (-z) the code is written in the dense forms */
+int optimize(Assembler *asm_ctx, ErrorContext *err_ctx, const char *profile, int dense, int silent);
+
+#endif /* OPTIMIZE_H */
@@ -16,6 +16,7 @@ typedef enum {
     ERR_IMMEDIATE_OVERFLOW,
     ERR_JUMP_OUT_OF_RANGE,
     ERR_ESCAPE_UNKNOWN,
+    ERR_NATIVE_NOT_FOUND,
 
     ERR_LABEL_TOO_MANY,
     ERR_LABEL_DUPLICATE,
@@ -27,10 +28,13 @@ typedef enum {
 
     ERR_FILE_OPEN,
     ERR_FILE_WRITE,
+    ERR_OBJECT_INVALID,
 
     WARN_LABEL_DUPLICATE,
     WARN_NOP_SEQUENCE,
     WARN_JUMP_NEXT,
+    WARN_OPTIMIZE_SKIPPED,
+    WARN_PROFILE_MISMATCH,
 } ErrorCode;
 
 typedef enum {
@@ -58,23 +62,94 @@ typedef struct {
 
 /* -------- ASSEMBLER TYPES -------- */
 
+typedef enum {
+    LABEL_CODE = 0,
+    LABEL_DATA = 1,
+    LABEL_BSS  = 2,
+} LabelKind;
+
+typedef enum {
+    SCOPE_LOCAL  = 0,
+    SCOPE_GLOBAL = 1,   /* .global: exported from an object */
+    SCOPE_EXTERN = 2,   /* .extern: defined in another object */
+} LabelScope;
+
 typedef struct {
     char name[64];
-    uint16_t address;
-    int is_data;
+    uint16_t address;   /* data and bss: offset until link_labels() */
+    int is_data;        /* LabelKind */
+    int defined;        /* 0 while the label has only been referenced */
+    int scope;          /* LabelScope */
 } Label;
 
+typedef enum {
+    FIX_JUMP,           /* jump or CALL target, hi lo */
+    FIX_SPAWN,          /* thread entry, hi lo */
+    FIX_ADDR16,         /* LOAD reg, label: hi lo */
+    FIX_BYTE,           /* CMPI/STOREI reg, label: low byte */
+    FIX_ENTRY,          /* .entry label */
+    FIX_TABLE,          /* .table entry, hi lo; at is an offset into .data */
+} FixupKind;
+
+/* a label operand, patched by link_labels() once every address is known */
+typedef struct {
+    int label;
+    uint16_t at;        /* first operand byte to patch */
+    uint8_t kind;       /* FixupKind */
+    int line;
+    int col;
+    const char *source; /* the line in the source buffer, for errors */
+} Fixup;
+
+typedef struct {
+    uint16_t address;
+    uint16_t line;
+} LineEntry;
+
+typedef struct {
+    char name[32];
+    int index;
+} NativeName;
+
+/* one emitted instruction, recorded for the optimizer (-O) */
+typedef struct {
+    uint8_t  opcode;
+    uint8_t  ops[6];    /* operand bytes as encoded */
+    uint8_t  len;       /* bytes including the opcode */
+    uint8_t  dead;      /* removed by the optimizer */
+    int32_t  label;     /* label an operand refers to, -1 for none */
+    uint16_t address;   /* address as assembled */
+    uint16_t line;
+} Instr;
+
 typedef struct {
-    Label labels[MAX_LABELS];
+    Label *labels;          /* grows as needed, freed by free_labels() */
+    int label_capacity;
+    int *label_slots;       /* open addressing over labels: index + 1, 0 = empty */
+    int label_slot_count;   /* power of two, at least twice label_count */
+    Fixup *fixups;          /* grows as needed, freed by free_labels() */
+    int fixup_count;
+    int fixup_capacity;
+    NativeName natives[MAX_NATIVES];
+    int native_count;
     uint8_t bytecode[MAX_BYTECODE];
     uint8_t data_section[MAX_DATA_SECTION];
     int label_count;
     int bytecode_pos;
     int data_pos;
-    int in_data_section;
+    int in_data_section;    /* 1 = .data, 2 = .bss */
     int data_start_addr;
+    int bss_size;
+    int bss_start_addr;
+    int entry;
+    int entry_set;          /* .entry seen */
+    int linking;            /* built from objects: only global labels are found by name */
+    LineEntry lines[MAX_BYTECODE];
+    int line_count;
+    Instr ir[MAX_BYTECODE];
+    int ir_count;
     int current_line;
-    char current_source[MAX_LINE_LENGTH];
+    const char *current_source; /* start of the line in the source buffer, not terminated */
     int last_nop_line;
 } Assembler;
 
@@ -86,6 +161,12 @@ typedef struct {
     int silent;
     int dump_data;
     int disass;
+    int raw;
+    int optimize;
+    const char *profile;    /* -P file: execution counts from vm --profile */
+    int dense;          /* -z: packed registers and short jumps, implies -O */
+    int object;         /* -c: write objects, do not link */
+    int jobs;           /* -jN: sources assembled at once */
 } InputArguments;
 
 #endif /* TYPES_H */
\ No newline at end of file
@@ -0,0 +1,23 @@
+#ifndef VBIN_H
+#define VBIN_H
+
+#include <stdio.h>
+#include "types.h"
+
+/* VBIN container, must match the VM loader (src/loader/vm_loader.c) */
+#define VBIN_MAGIC        "VBIN"
+#define VBIN_VERSION      1
+#define VBIN_HEADER_SIZE  16
+#define VBIN_SECTION_SIZE 12
+
+typedef enum {
+    VBIN_CODE = 1,
+    VBIN_DATA,
+    VBIN_BSS,
+    VBIN_SYMBOLS,
+    VBIN_LINES,
+} VbinSection;
+
+int write_vbin(Assembler *asm_ctx, FILE *output, size_t *bytes_written);
+
+#endif /* VBIN_H */
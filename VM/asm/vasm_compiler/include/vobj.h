@@ -0,0 +1,44 @@
+#ifndef VOBJ_H
+#define VOBJ_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include "types.h"
+
+/* VOBJ object file: one assembled source, labels not yet linked */
+#define VOBJ_MAGIC        "VOBJ"
+#define VOBJ_VERSION      1
+#define VOBJ_HEADER_SIZE  32
+#define VOBJ_FIXUP_SIZE   11
+#define VOBJ_INSTR_SIZE   9
+
+#define VOBJ_HAS_ENTRY    0x0001  /* flags: the source has .entry */
+#define VOBJ_NO_LABEL     0xFFFFFFFFu
+
+typedef struct {
+    const char *path;
+    uint8_t *file;          /* whole file, the pointers below are into it */
+    size_t size;
+    uint16_t flags;
+    uint16_t entry;         /* code offset, unless a FIX_ENTRY fixup names a label */
+    uint16_t code_size;
+    uint16_t data_size;
+    uint16_t bss_size;
+    uint32_t label_count;
+    uint32_t fixup_count;
+    uint32_t instr_count;
+    const uint8_t *code;
+    const uint8_t *data;
+    const uint8_t *labels;  /* u16 address, u8 kind, u8 scope, u8 defined, u8 length, name */
+    const uint8_t *fixups;  /* u32 label, u16 at, u8 kind, u16 line, u16 col */
+    const uint8_t *instrs;  /* u8 opcode, u16 address, u16 line, u32 label */
+} Object;
+
+int write_object(Assembler *asm_ctx, FILE *output, size_t *bytes_written);
+int read_object(Object *obj, const char *path);
+void free_object(Object *obj);
+
+uint16_t vobj_get16(const uint8_t *p);
+uint32_t vobj_get32(const uint8_t *p);
+
+#endif /* VOBJ_H */
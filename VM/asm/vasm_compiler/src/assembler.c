@@ -12,38 +12,48 @@
 
 /* -------- UTILITY -------- */
 
-COLD_REGION void trim_line(char *line) {
-    char *comment = strchr(line, ';');
-    if (UNLIKELY(comment)) *comment = '\0';
+/* stands in for an operand that is not there */
+static const Token no_token = { "", 0, 0, TOK_OTHER };
 
-    int len = strlen(line);
-    while (UNLIKELY(len > 0 && isspace((unsigned char)line[len - 1])))
-        line[--len] = '\0';
+/* R0-R31 in either case, no leading zeros */
+FORCE_INLINE HOT_REGION int get_register(const Token *t) {
+    const char *s = t->start;
+    if (UNLIKELY(t->len < 2 || t->len > 3 || (s[0] != 'R' && s[0] != 'r') || s[1] < '0' || s[1] > '9')) return -1;
+    if (LIKELY(t->len == 2)) return s[1] - '0';
+
+    int reg = (s[1] - '0') * 10 + (s[2] - '0');
+    return s[1] != '0' && s[2] >= '0' && s[2] <= '9' && reg < MAX_REGISTERS ? reg : -1;
 }
 
-FORCE_INLINE HOT_REGION int get_register(const char *str) {
-    if (LIKELY(str[0] == 'R' || str[0] == 'r')) {
-        int reg = atoi(str + 1);
-        if (LIKELY(reg >= 0 && reg <= 7))
-            return reg;
+/* decimal, 0x hex or 0b binary with an optional minus; stops at the first other character */
+static PURE HOT_REGION int64_t parse_wide(const Token *t) {
+    const char *s = t->start, *end = t->start + t->len;
+    int negative = 0, base = 10;
+    int64_t val = 0;
+
+    if (s < end && *s == '-') { negative = 1; s++; }
+    if (end - s > 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) { base = 16; s += 2; }
+    else if (end - s > 2 && s[0] == '0' && (s[1] == 'b' || s[1] == 'B')) { base = 2; s += 2; }
+
+    for (; s < end; s++) {
+        int digit = *s >= '0' && *s <= '9' ? *s - '0'
+                  : (*s | 0x20) >= 'a' && (*s | 0x20) <= 'f' ? (*s | 0x20) - 'a' + 10 : 99;
+        if (digit >= base) break;
+        if (LIKELY(val < 0x100000000LL)) val = val * base + digit; /* large stays out of every range */
     }
-    return -1;
+    return negative ? -val : val;
 }
 
-PURE COLD_REGION int parse_number(const char *str) {
-    if (str == NULL || str[0] == '\0') return 0;
-    if (str[0] == '0' && (str[1] == 'x' || str[1] == 'X'))
-        return (int)strtol(str, NULL, 16);
-    if (str[0] == '0' && (str[1] == 'b' || str[1] == 'B'))
-        return (int)strtol(str + 2, NULL, 2);
-    return atoi(str);
+PURE HOT_REGION int parse_number(const Token *t) {
+    int64_t val = parse_wide(t);
+    return val > 0x1000000 ? 0x1000000 : val < -0x1000000 ? -0x1000000 : (int)val;
 }
 
-COLD_REGION int check_immediate(Assembler *asm_ctx, ErrorContext *err_ctx, int val, const char *operand) {
-    if (UNLIKELY(val < -128 || val > 255)) {
+COLD_REGION int check_immediate(Assembler *asm_ctx, ErrorContext *err_ctx, int val, const Token *operand) {
+    if (UNLIKELY(val < 0 || val > 255)) { /* the VM zero-extends imm8, a negative value would come out as 256 + val */
         error_push(err_ctx, ERR_IMMEDIATE_OVERFLOW, SEVERITY_ERROR,
-                   asm_ctx->current_line, 0, asm_ctx->current_source,
-                   "immediate value %d out of 8-bit range [-128..255] (operand: '%s')", val, operand);
+                   asm_ctx->current_line, operand->col, asm_ctx->current_source,
+                   "immediate value %d out of 8-bit range [0..255] (operand: '%.*s')", val, SPAN(*operand));
         return -1;
     }
     return 0;
@@ -51,38 +61,277 @@ COLD_REGION int check_immediate(Assembler *asm_ctx, ErrorContext *err_ctx, int v
 
 /* -------- LABELS -------- */
 
-COLD_REGION int find_label(Assembler *asm_ctx, const char *name) {
-    for (int i = 0; i < asm_ctx->label_count; i++) {
-        if (UNLIKELY(strcmp(asm_ctx->labels[i].name, name) == 0))
-            return asm_ctx->labels[i].address;
+/* labels live in a growing array; label_slots maps a name hash to index + 1, linear probing */
+
+static PURE uint32_t label_hash(const char *name, int len) {
+    uint32_t h = 0x811C9DC5; /* FNV-1a */
+    for (int i = 0; i < len; i++) {
+        h ^= (uint8_t)name[i];
+        h *= 0x01000193;
     }
-    return -1;
+    return h;
 }
 
-COLD_REGION void add_label(Assembler *asm_ctx, ErrorContext *err_ctx,
-                            const char *name, uint16_t address, int is_data) {
-    if (UNLIKELY(asm_ctx->label_count >= MAX_LABELS)) {
+/* index of the label called name[0..len), -1 if there is none */
+static HOT_REGION int label_index(Assembler *asm_ctx, const char *name, int len) {
+    if (UNLIKELY(asm_ctx->label_slot_count == 0)) return -1;
+    uint32_t mask = asm_ctx->label_slot_count - 1;
+    for (uint32_t i = label_hash(name, len) & mask;; i = (i + 1) & mask) {
+        int slot = asm_ctx->label_slots[i];
+        if (slot == 0) return -1;
+        const char *stored = asm_ctx->labels[slot - 1].name;
+        if (LIKELY(strncmp(stored, name, len) == 0 && stored[len] == '\0')) return slot - 1;
+    }
+}
+
+/* doubles the array and the slots, rehashing every label; -1 when out of memory */
+static COLD_REGION int grow_labels(Assembler *asm_ctx) {
+    int capacity = asm_ctx->label_capacity ? asm_ctx->label_capacity * 2 : 64;
+    int slot_count = capacity * 2;
+    int *slots = calloc(slot_count, sizeof(int));
+    Label *labels = slots ? realloc(asm_ctx->labels, capacity * sizeof(Label)) : NULL;
+    if (UNLIKELY(!labels)) {
+        free(slots);
+        return -1;
+    }
+    asm_ctx->labels = labels;
+    asm_ctx->label_capacity = capacity;
+
+    for (int l = 0; l < asm_ctx->label_count; l++) {
+        if (asm_ctx->linking && labels[l].scope != SCOPE_GLOBAL) continue;
+        uint32_t i = label_hash(labels[l].name, strlen(labels[l].name)) & (slot_count - 1);
+        while (slots[i]) i = (i + 1) & (slot_count - 1);
+        slots[i] = l + 1;
+    }
+    free(asm_ctx->label_slots);
+    asm_ctx->label_slots = slots;
+    asm_ctx->label_slot_count = slot_count;
+    return 0;
+}
+
+void free_labels(Assembler *asm_ctx) {
+    free(asm_ctx->labels);
+    free(asm_ctx->label_slots);
+    free(asm_ctx->fixups);
+    asm_ctx->labels = NULL;
+    asm_ctx->label_slots = NULL;
+    asm_ctx->fixups = NULL;
+    asm_ctx->label_count = asm_ctx->label_capacity = asm_ctx->label_slot_count = 0;
+    asm_ctx->fixup_count = asm_ctx->fixup_capacity = 0;
+}
+
+/* index of the label called name, added undefined the first time it is seen; -1 for a bad name */
+static HOT_REGION int label_ref(Assembler *asm_ctx, ErrorContext *err_ctx, const Token *name) {
+    int l = label_index(asm_ctx, name->start, name->len);
+    if (LIKELY(l >= 0)) return l;
+
+    if (UNLIKELY(name->kind != TOK_IDENT || name->len >= (int)sizeof(asm_ctx->labels[0].name))) {
+        error_push(err_ctx, ERR_LABEL_EMPTY, SEVERITY_ERROR,
+                   asm_ctx->current_line, name->col, asm_ctx->current_source,
+                   "invalid label name '%.*s'", SPAN(*name));
+        return -1;
+    }
+    if (UNLIKELY(asm_ctx->label_count == asm_ctx->label_capacity) && grow_labels(asm_ctx) != 0) {
         error_push(err_ctx, ERR_LABEL_TOO_MANY, SEVERITY_FATAL,
                    asm_ctx->current_line, 0, asm_ctx->current_source,
-                   "too many labels (max %d)", MAX_LABELS);
+                   "out of memory for labels (%d so far)", asm_ctx->label_count);
+        return -1;
+    }
+
+    Label *lbl = &asm_ctx->labels[asm_ctx->label_count];
+    memcpy(lbl->name, name->start, name->len);
+    lbl->name[name->len] = '\0';
+    lbl->address = 0;
+    lbl->is_data = LABEL_CODE;
+    lbl->defined = 0;
+    lbl->scope = SCOPE_LOCAL;
+
+    uint32_t mask = asm_ctx->label_slot_count - 1;
+    uint32_t i = label_hash(name->start, name->len) & mask;
+    while (asm_ctx->label_slots[i]) i = (i + 1) & mask;
+    asm_ctx->label_slots[i] = asm_ctx->label_count + 1;
+    return asm_ctx->label_count++;
+}
+
+/* index of the label called name[0..len), -1 if there is none; only global ones while linking */
+int find_label(Assembler *asm_ctx, const char *name, int len) {
+    return label_index(asm_ctx, name, len);
+}
+
+/* linker: copies a label of an object in, -1 when out of memory */
+COLD_REGION int append_label(Assembler *asm_ctx, const Label *lbl) {
+    if (UNLIKELY(asm_ctx->label_count == asm_ctx->label_capacity) && grow_labels(asm_ctx) != 0) return -1;
+    asm_ctx->labels[asm_ctx->label_count] = *lbl;
+
+    if (!asm_ctx->linking || lbl->scope == SCOPE_GLOBAL) {
+        uint32_t mask = asm_ctx->label_slot_count - 1;
+        uint32_t i = label_hash(lbl->name, strlen(lbl->name)) & mask;
+        while (asm_ctx->label_slots[i]) i = (i + 1) & mask;
+        asm_ctx->label_slots[i] = asm_ctx->label_count + 1;
+    }
+    return asm_ctx->label_count++;
+}
+
+/* data and bss addresses are offsets into their section until link_labels() */
+COLD_REGION void add_label(Assembler *asm_ctx, ErrorContext *err_ctx,
+                            const Token *name, uint16_t address, int is_data) {
+    int l = label_ref(asm_ctx, err_ctx, name);
+    if (UNLIKELY(l < 0)) return;
+
+    Label *lbl = &asm_ctx->labels[l];
+    if (UNLIKELY(lbl->defined)) {
+        error_push(err_ctx, WARN_LABEL_DUPLICATE, SEVERITY_WARNING,
+                   asm_ctx->current_line, name->col, asm_ctx->current_source,
+                   "duplicate label '%.*s'", SPAN(*name));
         return;
     }
+    lbl->address = address;
+    lbl->is_data = is_data;
+    lbl->defined = 1;
+}
 
-    for (int i = 0; i < asm_ctx->label_count; i++) {
-        if (UNLIKELY(strcmp(asm_ctx->labels[i].name, name) == 0)) {
-            error_push(err_ctx, WARN_LABEL_DUPLICATE, SEVERITY_WARNING,
+/* -------- FIXUPS -------- */
+
+/*
+ * A label operand is emitted as zeros and patched at the end: code after it
+ * may still define the label, and data and bss only get their addresses
+ * once the size of the code is known. Called right before the operand bytes
+ * are emitted.
+ */
+static HOT_REGION void add_fixup(Assembler *asm_ctx, ErrorContext *err_ctx, FixupKind kind, const Token *name) {
+    int l = label_ref(asm_ctx, err_ctx, name);
+    if (UNLIKELY(l < 0)) return;
+
+    if (UNLIKELY(asm_ctx->fixup_count == asm_ctx->fixup_capacity)) {
+        int capacity = asm_ctx->fixup_capacity ? asm_ctx->fixup_capacity * 2 : 64;
+        Fixup *fixups = realloc(asm_ctx->fixups, capacity * sizeof(Fixup));
+        if (UNLIKELY(!fixups)) {
+            error_push(err_ctx, ERR_LABEL_TOO_MANY, SEVERITY_FATAL,
                        asm_ctx->current_line, 0, asm_ctx->current_source,
-                       "duplicate label '%s'", name);
+                       "out of memory for label references (%d so far)", asm_ctx->fixup_count);
             return;
         }
+        asm_ctx->fixups = fixups;
+        asm_ctx->fixup_capacity = capacity;
     }
 
-    Label *lbl = &asm_ctx->labels[asm_ctx->label_count];
-    strncpy(lbl->name, name, sizeof(lbl->name) - 1);
-    lbl->name[sizeof(lbl->name) - 1] = '\0';
-    lbl->address = address;
-    lbl->is_data = is_data;
-    asm_ctx->label_count++;
+    Fixup *f = &asm_ctx->fixups[asm_ctx->fixup_count++];
+    f->label = l;
+    f->at = kind == FIX_TABLE ? asm_ctx->data_pos : asm_ctx->bytecode_pos;
+    f->kind = kind;
+    f->line = asm_ctx->current_line;
+    f->col = name->col;
+    f->source = asm_ctx->current_source;
+
+    /* the instruction being emitted remembers its label for the optimizer */
+    if (kind != FIX_ENTRY && kind != FIX_TABLE && asm_ctx->ir_count > 0)
+        asm_ctx->ir[asm_ctx->ir_count - 1].label = l;
+}
+
+/* after the last line: data and bss go behind the code, then every label operand is patched */
+COLD_REGION void link_labels(Assembler *asm_ctx, ErrorContext *err_ctx) {
+    asm_ctx->data_start_addr = asm_ctx->bytecode_pos;
+    asm_ctx->bss_start_addr = asm_ctx->data_start_addr + asm_ctx->data_pos;
+    for (int l = 0; l < asm_ctx->label_count; l++) {
+        Label *lbl = &asm_ctx->labels[l];
+        if (lbl->is_data == LABEL_DATA) lbl->address += asm_ctx->data_start_addr;
+        else if (lbl->is_data == LABEL_BSS) lbl->address += asm_ctx->bss_start_addr;
+    }
+
+    for (int i = 0; i < asm_ctx->fixup_count; i++) {
+        const Fixup *f = &asm_ctx->fixups[i];
+        const Label *lbl = &asm_ctx->labels[f->label];
+        int addr = lbl->address;
+        uint8_t *at = f->kind == FIX_TABLE ? &asm_ctx->data_section[f->at] : &asm_ctx->bytecode[f->at];
+
+        if (UNLIKELY(!lbl->defined)) {
+            error_push(err_ctx, ERR_LABEL_NOT_FOUND, SEVERITY_ERROR, f->line, f->col, f->source,
+                       "label '%s' is not defined", lbl->name);
+            continue;
+        }
+        if (UNLIKELY(f->kind != FIX_ADDR16 && f->kind != FIX_BYTE && addr >= MAX_BYTECODE)) {
+            error_push(err_ctx, ERR_JUMP_OUT_OF_RANGE, SEVERITY_ERROR, f->line, f->col, f->source,
+                       "%s 0x%04X is out of valid range [0x0000..0x%04X]",
+                       f->kind == FIX_SPAWN ? "thread entry" : "jump target", addr, MAX_BYTECODE - 1);
+            continue;
+        }
+
+        switch (f->kind) {
+            case FIX_JUMP:
+                if (UNLIKELY(addr == f->at + 2))
+                    error_push(err_ctx, WARN_JUMP_NEXT, SEVERITY_WARNING, f->line, f->col, f->source,
+                               "jump target is the next instruction (0x%04X) — has no effect", addr);
+                /* fall through */
+            case FIX_SPAWN:
+            case FIX_ADDR16:
+            case FIX_TABLE:
+                at[0] = (addr >> 8) & 0xFF;
+                at[1] = addr & 0xFF;
+                break;
+            case FIX_BYTE:
+                at[0] = addr & 0xFF;
+                break;
+            case FIX_ENTRY:
+                asm_ctx->entry = addr;
+                break;
+        }
+    }
+}
+
+/* instead of link_labels() for an object: every label must be defined here or declared .extern */
+COLD_REGION void check_object(Assembler *asm_ctx, ErrorContext *err_ctx) {
+    for (int i = 0; i < asm_ctx->fixup_count; i++) {
+        const Fixup *f = &asm_ctx->fixups[i];
+        const Label *lbl = &asm_ctx->labels[f->label];
+        if (UNLIKELY(!lbl->defined && lbl->scope != SCOPE_EXTERN))
+            error_push(err_ctx, ERR_LABEL_NOT_FOUND, SEVERITY_ERROR, f->line, f->col, f->source,
+                       "label '%s' is not defined (declare it with .extern if another file has it)", lbl->name);
+    }
+    for (int l = 0; l < asm_ctx->label_count; l++) {
+        const Label *lbl = &asm_ctx->labels[l];
+        if (UNLIKELY(lbl->scope == SCOPE_GLOBAL && !lbl->defined))
+            error_push(err_ctx, ERR_LABEL_NOT_FOUND, SEVERITY_ERROR, 0, 0, NULL,
+                       "label '%s' is declared .global but not defined", lbl->name);
+    }
+}
+
+/* -------- NATIVES -------- */
+
+static const char *builtin_natives[NATIVE_BUILTIN_COUNT] = {
+    [NATIVE_MEMCPY] = "MEMCPY", [NATIVE_MEMSET] = "MEMSET",
+    [NATIVE_STRLEN] = "STRLEN", [NATIVE_SORT]   = "SORT",
+    [NATIVE_HASH]   = "HASH",   [NATIVE_CRC32]  = "CRC32",
+    [NATIVE_ITOA]   = "ITOA",   [NATIVE_ATOI]   = "ATOI",
+};
+
+/* names are stored upper case, name is matched in any case */
+static int native_is(const char *upper, const Token *name) {
+    int i = 0;
+    for (; i < name->len; i++)
+        if (upper[i] != toupper((unsigned char)name->start[i])) return 0;
+    return upper[i] == '\0';
+}
+
+COLD_REGION int find_native(Assembler *asm_ctx, const Token *name) {
+    for (int i = 0; i < asm_ctx->native_count; i++) {
+        if (native_is(asm_ctx->natives[i].name, name))
+            return asm_ctx->natives[i].index;
+    }
+    for (int i = 0; i < NATIVE_BUILTIN_COUNT; i++) {
+        if (native_is(builtin_natives[i], name))
+            return i;
+    }
+    return -1;
+}
+
+COLD_REGION const char *native_name(Assembler *asm_ctx, int index) {
+    for (int i = 0; i < asm_ctx->native_count; i++) {
+        if (asm_ctx->natives[i].index == index)
+            return asm_ctx->natives[i].name;
+    }
+    if (index >= 0 && index < NATIVE_BUILTIN_COUNT)
+        return builtin_natives[index];
+    return NULL;
 }
 
 /* -------- EMIT -------- */
@@ -97,11 +346,6 @@ FORCE_INLINE HOT_REGION void emit_byte(Assembler *asm_ctx, ErrorContext *err_ctx
     asm_ctx->bytecode[asm_ctx->bytecode_pos++] = byte;
 }
 
-HOT_REGION void emit_or_skip(Assembler *a, ErrorContext *e, int pass, uint8_t byte) {
-    if (pass == 2) emit_byte(a, e, byte);
-    else a->bytecode_pos++;
-}
-
 COLD_REGION void emit_data_byte(Assembler *asm_ctx, ErrorContext *err_ctx, uint8_t byte) {
     if (UNLIKELY(asm_ctx->data_pos >= MAX_DATA_SECTION)) {
         error_push(err_ctx, ERR_DATA_OVERFLOW, SEVERITY_FATAL,
@@ -114,153 +358,492 @@ COLD_REGION void emit_data_byte(Assembler *asm_ctx, ErrorContext *err_ctx, uint8
 
 /* -------- DATA DIRECTIVE -------- */
 
-COLD_REGION int parse_data_directive(Assembler *asm_ctx, ErrorContext *err_ctx, char *line) {
-    if (UNLIKELY(strncmp(line, ".data", 5) == 0)) { asm_ctx->in_data_section = 1; return 0; }
-    if (UNLIKELY(strncmp(line, ".text", 5) == 0)) { asm_ctx->in_data_section = 0; return 0; }
-    if (LIKELY(!asm_ctx->in_data_section)) return 0;
+/* string contents between the quotes, escapes resolved */
+static COLD_REGION void emit_string(Assembler *asm_ctx, ErrorContext *err_ctx, const Token *t) {
+    const char *p = t->start + 1, *end = t->start + t->len;
+    if (end > p && end[-1] == '"') end--;
 
-    char *colon = strchr(line, ':');
-    if (UNLIKELY(!colon)) return 0;
-    *colon = '\0';
+    while (LIKELY(p < end)) {
+        if (UNLIKELY(*p == '\\' && p + 1 < end)) {
+            switch (p[1]) {
+                case 'n':  emit_data_byte(asm_ctx, err_ctx, '\n'); break;
+                case 't':  emit_data_byte(asm_ctx, err_ctx, '\t'); break;
+                case 'r':  emit_data_byte(asm_ctx, err_ctx, '\r'); break;
+                case '0':  emit_data_byte(asm_ctx, err_ctx, '\0'); break;
+                case '\\': emit_data_byte(asm_ctx, err_ctx, '\\'); break;
+                case '"':  emit_data_byte(asm_ctx, err_ctx, '"');  break;
+                default:
+                    error_push(err_ctx, ERR_ESCAPE_UNKNOWN, SEVERITY_WARNING,
+                               asm_ctx->current_line, (int)(p - t->start) + t->col, asm_ctx->current_source,
+                               "unknown escape sequence '\\%c' - treating as literal", p[1]);
+                    emit_data_byte(asm_ctx, err_ctx, *p++);
+                    continue;
+            }
+            p += 2;
+        } else {
+            emit_data_byte(asm_ctx, err_ctx, *p++);
+        }
+    }
+    emit_data_byte(asm_ctx, err_ctx, '\0');
+}
 
-    char *data_label = line;
-    char *data_content = colon + 1;
+/* name: .table label, label, ... - a SWITCH jump table: the count, then every label's address, hi lo */
+static COLD_REGION int emit_table(Assembler *asm_ctx, ErrorContext *err_ctx, const Token *tok, int count) {
+    int entries = 0;
+    for (int i = 3; i < count; i += 2) {
+        if (UNLIKELY(tok[i].kind != TOK_IDENT ||
+                     (i + 1 < count && (tok[i + 1].kind != TOK_COMMA || i + 2 >= count)))) {
+            error_push(err_ctx, ERR_INVALID_OPERAND, SEVERITY_ERROR,
+                       asm_ctx->current_line, tok[i].col, asm_ctx->current_source,
+                       "expected 'label, label, ...' in a .table, got '%.*s'", SPAN(tok[i]));
+            return -1;
+        }
+        entries++;
+    }
+    if (UNLIKELY(entries == 0)) {
+        error_push(err_ctx, ERR_OPERAND_MISSING, SEVERITY_ERROR,
+                   asm_ctx->current_line, tok[2].col, asm_ctx->current_source, "'.table' needs at least one label");
+        return -1;
+    }
 
-    while (isspace((unsigned char)*data_label)) data_label++;
-    char *end = data_label + strlen(data_label) - 1;
-    while (end > data_label && isspace((unsigned char)*end)) *end-- = '\0';
-    while (isspace((unsigned char)*data_content)) data_content++;
+    emit_data_byte(asm_ctx, err_ctx, entries >> 8);
+    emit_data_byte(asm_ctx, err_ctx, entries & 0xFF);
+    for (int i = 3; i < count; i += 2) {
+        add_fixup(asm_ctx, err_ctx, FIX_TABLE, &tok[i]);
+        emit_data_byte(asm_ctx, err_ctx, 0);
+        emit_data_byte(asm_ctx, err_ctx, 0);
+    }
+    return 0;
+}
 
-    if (UNLIKELY(strlen(data_label) == 0)) {
+/* name: "string" | name: byte, byte, ... | name: .table label, ... in .data; name: size in .bss */
+COLD_REGION int parse_data_directive(Assembler *asm_ctx, ErrorContext *err_ctx, const Token *tok, int count) {
+    if (UNLIKELY(count < 2 || tok[1].kind != TOK_COLON)) {
         error_push(err_ctx, ERR_LABEL_EMPTY, SEVERITY_ERROR,
+                   asm_ctx->current_line, tok[0].col, asm_ctx->current_source,
+                   "expected 'name: value' in a data section");
+        return -1;
+    }
+
+    /* .bss - name: size, zero-filled and not stored in the binary */
+    if (asm_ctx->in_data_section == 2) {
+        const Token *value = count > 2 ? &tok[2] : &no_token;
+        int size = count == 3 && value->kind == TOK_NUMBER ? parse_number(value) : 0;
+        if (UNLIKELY(size <= 0 || asm_ctx->bss_size + size > MAX_BYTECODE)) {
+            error_push(err_ctx, ERR_DATA_OVERFLOW, SEVERITY_ERROR,
+                       asm_ctx->current_line, value->col, asm_ctx->current_source,
+                       "invalid .bss size '%.*s'", SPAN(*value));
+            return -1;
+        }
+        add_label(asm_ctx, err_ctx, &tok[0], asm_ctx->bss_size, LABEL_BSS);
+        asm_ctx->bss_size += size;
+        return 0;
+    }
+
+    add_label(asm_ctx, err_ctx, &tok[0], asm_ctx->data_pos, LABEL_DATA);
+
+    if (LIKELY(count > 2 && tok[2].kind == TOK_STRING)) {
+        emit_string(asm_ctx, err_ctx, &tok[2]);
+        return 0;
+    }
+    if (UNLIKELY(count > 2 && token_is(&tok[2], ".table"))) return emit_table(asm_ctx, err_ctx, tok, count);
+    for (int i = 2; i < count; i++) {
+        if (LIKELY(tok[i].kind == TOK_COMMA)) continue;
+        if (UNLIKELY(tok[i].kind != TOK_NUMBER)) {
+            error_push(err_ctx, ERR_INVALID_OPERAND, SEVERITY_ERROR,
+                       asm_ctx->current_line, tok[i].col, asm_ctx->current_source,
+                       "expected a byte value, got '%.*s'", SPAN(tok[i]));
+            return -1;
+        }
+        emit_data_byte(asm_ctx, err_ctx, parse_number(&tok[i]) & 0xFF);
+    }
+    return 0;
+}
+
+/* -------- NATIVE DIRECTIVE -------- */
+
+/* .native NAME, index - names a host-registered native for NCALL */
+COLD_REGION int parse_native_directive(Assembler *asm_ctx, ErrorContext *err_ctx, const Token *tok, int count) {
+    if (UNLIKELY(count != 4 || tok[1].kind != TOK_IDENT || tok[2].kind != TOK_COMMA || tok[3].kind != TOK_NUMBER)) {
+        error_push(err_ctx, ERR_OPERAND_MISSING, SEVERITY_ERROR,
                    asm_ctx->current_line, 0, asm_ctx->current_source,
-                   "data label cannot be empty");
+                   "'.native' requires a name and an index: .native NAME, index");
         return -1;
     }
 
-    add_label(asm_ctx, err_ctx, data_label, asm_ctx->data_start_addr + asm_ctx->data_pos, 1);
-
-    if (LIKELY(data_content[0] == '"')) {
-        data_content++;
-        int i = 0;
-        while (LIKELY(data_content[i] != '\0') && LIKELY(data_content[i] != '"')) {
-            if (UNLIKELY(data_content[i] == '\\')) {
-                if (data_content[i+1] == 'n')  { emit_data_byte(asm_ctx, err_ctx, '\n'); i += 2; }
-                else if (data_content[i+1] == 't')  { emit_data_byte(asm_ctx, err_ctx, '\t'); i += 2; }
-                else if (data_content[i+1] == 'r')  { emit_data_byte(asm_ctx, err_ctx, '\r'); i += 2; }
-                else if (data_content[i+1] == '0')  { emit_data_byte(asm_ctx, err_ctx, '\0'); i += 2; }
-                else if (data_content[i+1] == '\\') { emit_data_byte(asm_ctx, err_ctx, '\\'); i += 2; }
-                else if (data_content[i+1] == '"')  { emit_data_byte(asm_ctx, err_ctx, '"');  i += 2; }
-                else {
-                    error_push(err_ctx, ERR_ESCAPE_UNKNOWN, SEVERITY_WARNING,
-                               asm_ctx->current_line, 0, asm_ctx->current_source,
-                               "unknown escape sequence '\\%c' - treating as literal", data_content[i+1]);
-                    emit_data_byte(asm_ctx, err_ctx, data_content[i]); i++;
-                }
-            } else {
-                emit_data_byte(asm_ctx, err_ctx, data_content[i]);
-                i++;
-            }
+    int index = parse_number(&tok[3]);
+    if (UNLIKELY(index < 0 || index >= MAX_NATIVES)) {
+        error_push(err_ctx, ERR_INVALID_OPERAND, SEVERITY_ERROR,
+                   asm_ctx->current_line, tok[3].col, asm_ctx->current_source,
+                   "native index %d out of range [0..%d]", index, MAX_NATIVES - 1);
+        return -1;
+    }
+    if (UNLIKELY(asm_ctx->native_count >= MAX_NATIVES)) {
+        error_push(err_ctx, ERR_INVALID_OPERAND, SEVERITY_ERROR,
+                   asm_ctx->current_line, 0, asm_ctx->current_source,
+                   "too many native declarations (max %d)", MAX_NATIVES);
+        return -1;
+    }
+
+    NativeName *nat = &asm_ctx->natives[asm_ctx->native_count++];
+    int i = 0;
+    for (; i < tok[1].len && i < (int)sizeof(nat->name) - 1; i++)
+        nat->name[i] = toupper((unsigned char)tok[1].start[i]);
+    nat->name[i] = '\0';
+    nat->index = index;
+    return 0;
+}
+
+/* -------- SCOPE DIRECTIVES -------- */
+
+/* .global name {, name} | .extern name {, name} - labels shared between objects */
+COLD_REGION int parse_scope_directive(Assembler *asm_ctx, ErrorContext *err_ctx, const Token *tok, int count,
+                                      LabelScope scope) {
+    if (UNLIKELY(count < 2 || count % 2 != 0)) {
+        error_push(err_ctx, ERR_OPERAND_MISSING, SEVERITY_ERROR,
+                   asm_ctx->current_line, tok[0].col, asm_ctx->current_source,
+                   "'%.*s' requires label names separated by commas", SPAN(tok[0]));
+        return -1;
+    }
+    for (int i = 1; i < count; i += 2) {
+        if (UNLIKELY(i > 1 && tok[i - 1].kind != TOK_COMMA)) {
+            error_push(err_ctx, ERR_INVALID_OPERAND, SEVERITY_ERROR,
+                       asm_ctx->current_line, tok[i - 1].col, asm_ctx->current_source,
+                       "unexpected '%.*s' between label names", SPAN(tok[i - 1]));
+            return -1;
         }
-        emit_data_byte(asm_ctx, err_ctx, '\0');
-    } else {
-        char *token = strtok(data_content, ",");
-        while (LIKELY(token != NULL)) {
-            while (isspace((unsigned char)*token)) token++;
-            if (LIKELY(strlen(token) > 0))
-                emit_data_byte(asm_ctx, err_ctx, parse_number(token) & 0xFF);
-            token = strtok(NULL, ",");
+        int l = label_ref(asm_ctx, err_ctx, &tok[i]);
+        if (UNLIKELY(l < 0)) return -1;
+
+        Label *lbl = &asm_ctx->labels[l];
+        if (UNLIKELY(lbl->scope != SCOPE_LOCAL && lbl->scope != (int)scope)) {
+            error_push(err_ctx, ERR_LABEL_DUPLICATE, SEVERITY_ERROR,
+                       asm_ctx->current_line, tok[i].col, asm_ctx->current_source,
+                       "label '%s' cannot be both .global and .extern", lbl->name);
+            return -1;
         }
+        lbl->scope = scope;
+    }
+    return 0;
+}
+
+/* -------- ENTRY DIRECTIVE -------- */
+
+/* .entry label | address - where the VM starts, 0 by default; a label may come later */
+COLD_REGION int parse_entry_directive(Assembler *asm_ctx, ErrorContext *err_ctx, const Token *tok, int count) {
+    const Token *target = count > 1 ? &tok[1] : &no_token;
+    asm_ctx->entry_set = 1;
+    if (LIKELY(count == 2 && target->kind == TOK_IDENT)) {
+        add_fixup(asm_ctx, err_ctx, FIX_ENTRY, target);
+        return 0;
     }
 
+    int addr = count == 2 && target->kind == TOK_NUMBER ? parse_number(target) : -1;
+    if (UNLIKELY(addr < 0 || addr >= MAX_BYTECODE)) {
+        error_push(err_ctx, ERR_LABEL_NOT_FOUND, SEVERITY_ERROR,
+                   asm_ctx->current_line, target->col, asm_ctx->current_source,
+                   "'.entry' needs a label or an address in [0x0000..0x%04X]", MAX_BYTECODE - 1);
+        return -1;
+    }
+    asm_ctx->entry = addr;
     return 0;
 }
 
 /* -------- OPCODE LOOKUP -------- */
 
-HOT_REGION Opcode get_opcode(const char *mnemonic) {
-    if (LIKELY(strcmp(mnemonic,  "ADD")    == 0)) return OP_ADD;
-    if (LIKELY(strcmp(mnemonic,  "ADDI")   == 0)) return OP_ADDI;
-    if (LIKELY(strcmp(mnemonic,  "SUB")    == 0)) return OP_SUB;
-    if (LIKELY(strcmp(mnemonic,  "MUL")    == 0)) return OP_MUL;
-    if (LIKELY(strcmp(mnemonic,  "DIV")    == 0)) return OP_DIV;
-    if (LIKELY(strcmp(mnemonic,  "MOV")    == 0)) return OP_MOV;
-    if (LIKELY(strcmp(mnemonic,  "CMP")    == 0)) return OP_CMP;
-    if (LIKELY(strcmp(mnemonic,  "CMPI")   == 0)) return OP_CMPI;
-    if (LIKELY(strcmp(mnemonic,  "LOAD")   == 0)) return OP_LOAD;
-    if (UNLIKELY(strcmp(mnemonic, "JMP")   == 0)) return OP_JMP;
-    if (UNLIKELY(strcmp(mnemonic, "JE")    == 0)) return OP_JE;
-    if (UNLIKELY(strcmp(mnemonic, "JNE")   == 0)) return OP_JNE;
-    if (UNLIKELY(strcmp(mnemonic, "JG")    == 0)) return OP_JG;
-    if (UNLIKELY(strcmp(mnemonic, "JGE")   == 0)) return OP_JGE;
-    if (UNLIKELY(strcmp(mnemonic, "JL")    == 0)) return OP_JL;
-    if (UNLIKELY(strcmp(mnemonic, "JLE")   == 0)) return OP_JLE;
-    if (UNLIKELY(strcmp(mnemonic, "JNZ")   == 0)) return OP_JNZ;
-    if (UNLIKELY(strcmp(mnemonic, "PUSH")  == 0)) return OP_PUSH;
-    if (UNLIKELY(strcmp(mnemonic, "POP")   == 0)) return OP_POP;
-    if (UNLIKELY(strcmp(mnemonic, "LDB")   == 0)) return OP_LDB;
-    if (UNLIKELY(strcmp(mnemonic, "STORE") == 0)) return OP_STORE;
-    if (UNLIKELY(strcmp(mnemonic, "STOREI")== 0)) return OP_STOREI;
-    if (UNLIKELY(strcmp(mnemonic, "XOR")   == 0)) return OP_XOR;
-    if (UNLIKELY(strcmp(mnemonic, "AND")   == 0)) return OP_AND;
-    if (UNLIKELY(strcmp(mnemonic, "XORI")  == 0)) return OP_XORI;
-    if (UNLIKELY(strcmp(mnemonic, "OR")    == 0)) return OP_OR;
-    if (UNLIKELY(strcmp(mnemonic, "ORI")   == 0)) return OP_ORI;
-    if (UNLIKELY(strcmp(mnemonic, "SHL")   == 0)) return OP_SHL;
-    if (UNLIKELY(strcmp(mnemonic, "SHLI")  == 0)) return OP_SHLI;
-    if (UNLIKELY(strcmp(mnemonic, "SHR")   == 0)) return OP_SHR;
-    if (UNLIKELY(strcmp(mnemonic, "SHRI")  == 0)) return OP_SHRI;
-    if (UNLIKELY(strcmp(mnemonic, "PRINT") == 0)) return OP_PRINT;
-    if (UNLIKELY(strcmp(mnemonic, "PRINTC")== 0)) return OP_PRINTC;
-    if (UNLIKELY(strcmp(mnemonic, "PRINTS")== 0)) return OP_PRINTS;
-    if (UNLIKELY(strcmp(mnemonic, "READ")  == 0)) return OP_READ;
-    if (UNLIKELY(strcmp(mnemonic, "READC") == 0)) return OP_READC;
-    if (UNLIKELY(strcmp(mnemonic, "READS") == 0)) return OP_READS;
-    if (UNLIKELY(strcmp(mnemonic, "RET")   == 0)) return OP_RET;
-    if (UNLIKELY(strcmp(mnemonic, "HALT")  == 0)) return OP_HALT;
-    if (UNLIKELY(strcmp(mnemonic, "CALL")  == 0)) return OP_CALL;
-    if (UNLIKELY(strcmp(mnemonic, "NOP")   == 0)) return OP_NOP;
-    if (UNLIKELY(strcmp(mnemonic, "DBG")   == 0)) return OP_DBG;
-    return OP_INVALID;
+/*
+ * Perfect hash over the first three characters and the last one (a 2-letter
+ * mnemonic has 0 as its third). The compiler places every entry at its hash;
+ * two mnemonics on the same slot are a compile error, not a silent overwrite,
+ * so a new mnemonic that collides needs other multipliers here.
+ */
+#define MNEMONIC_HASH(c0, c1, c2, last) \
+    (((c0) * 6 + (c1) * 7 + (c2) * 2 + (last) * 3) & 255)
+
+typedef struct {
+    const char *name;
+    Opcode opcode;
+} Mnemonic;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic error "-Woverride-init"
+static const Mnemonic mnemonics[256] = {
+    [MNEMONIC_HASH('A', 'D', 'D', 'D')] = { "ADD",    OP_ADD },
+    [MNEMONIC_HASH('A', 'D', 'D', 'I')] = { "ADDI",   OP_ADDI },
+    [MNEMONIC_HASH('S', 'U', 'B', 'B')] = { "SUB",    OP_SUB },
+    [MNEMONIC_HASH('M', 'U', 'L', 'L')] = { "MUL",    OP_MUL },
+    [MNEMONIC_HASH('D', 'I', 'V', 'V')] = { "DIV",    OP_DIV },
+    [MNEMONIC_HASH('M', 'O', 'V', 'V')] = { "MOV",    OP_MOV },
+    [MNEMONIC_HASH('C', 'M', 'P', 'P')] = { "CMP",    OP_CMP },
+    [MNEMONIC_HASH('C', 'M', 'P', 'I')] = { "CMPI",   OP_CMPI },
+    [MNEMONIC_HASH('L', 'O', 'A', 'D')] = { "LOAD",   OP_LOAD },
+    [MNEMONIC_HASH('J', 'M', 'P', 'P')] = { "JMP",    OP_JMP },
+    [MNEMONIC_HASH('J', 'E', 0, 'E')] = { "JE",     OP_JE },
+    [MNEMONIC_HASH('J', 'N', 'E', 'E')] = { "JNE",    OP_JNE },
+    [MNEMONIC_HASH('J', 'G', 0, 'G')] = { "JG",     OP_JG },
+    [MNEMONIC_HASH('J', 'G', 'E', 'E')] = { "JGE",    OP_JGE },
+    [MNEMONIC_HASH('J', 'L', 0, 'L')] = { "JL",     OP_JL },
+    [MNEMONIC_HASH('J', 'L', 'E', 'E')] = { "JLE",    OP_JLE },
+    [MNEMONIC_HASH('J', 'N', 'Z', 'Z')] = { "JNZ",    OP_JNZ },
+    [MNEMONIC_HASH('D', 'J', 'N', 'Z')] = { "DJNZ",   OP_DJNZ },
+    [MNEMONIC_HASH('B', 'E', 'Q', 'Q')] = { "BEQ",    OP_BEQ },
+    [MNEMONIC_HASH('B', 'N', 'E', 'E')] = { "BNE",    OP_BNE },
+    [MNEMONIC_HASH('B', 'L', 'T', 'T')] = { "BLT",    OP_BLT },
+    [MNEMONIC_HASH('B', 'L', 'E', 'E')] = { "BLE",    OP_BLE },
+    [MNEMONIC_HASH('B', 'G', 'T', 'T')] = { "BGT",    OP_BGT },
+    [MNEMONIC_HASH('B', 'G', 'E', 'E')] = { "BGE",    OP_BGE },
+    [MNEMONIC_HASH('B', 'E', 'Q', 'I')] = { "BEQI",   OP_BEQI },
+    [MNEMONIC_HASH('B', 'N', 'E', 'I')] = { "BNEI",   OP_BNEI },
+    [MNEMONIC_HASH('B', 'L', 'T', 'I')] = { "BLTI",   OP_BLTI },
+    [MNEMONIC_HASH('B', 'L', 'E', 'I')] = { "BLEI",   OP_BLEI },
+    [MNEMONIC_HASH('B', 'G', 'T', 'I')] = { "BGTI",   OP_BGTI },
+    [MNEMONIC_HASH('B', 'G', 'E', 'I')] = { "BGEI",   OP_BGEI },
+    [MNEMONIC_HASH('P', 'U', 'S', 'H')] = { "PUSH",   OP_PUSH },
+    [MNEMONIC_HASH('P', 'O', 'P', 'P')] = { "POP",    OP_POP },
+    [MNEMONIC_HASH('L', 'D', 'B', 'B')] = { "LDB",    OP_LDB },
+    [MNEMONIC_HASH('L', 'D', 'W', 'W')] = { "LDW",    OP_LDWD },
+    [MNEMONIC_HASH('S', 'T', 'B', 'B')] = { "STB",    OP_STBD },
+    [MNEMONIC_HASH('S', 'T', 'O', 'E')] = { "STORE",  OP_STORE },
+    [MNEMONIC_HASH('S', 'T', 'O', 'I')] = { "STOREI", OP_STOREI },
+    [MNEMONIC_HASH('X', 'O', 'R', 'R')] = { "XOR",    OP_XOR },
+    [MNEMONIC_HASH('A', 'N', 'D', 'D')] = { "AND",    OP_AND },
+    [MNEMONIC_HASH('X', 'O', 'R', 'I')] = { "XORI",   OP_XORI },
+    [MNEMONIC_HASH('O', 'R', 0, 'R')] = { "OR",     OP_OR },
+    [MNEMONIC_HASH('O', 'R', 'I', 'I')] = { "ORI",    OP_ORI },
+    [MNEMONIC_HASH('S', 'H', 'L', 'L')] = { "SHL",    OP_SHL },
+    [MNEMONIC_HASH('S', 'H', 'L', 'I')] = { "SHLI",   OP_SHLI },
+    [MNEMONIC_HASH('S', 'H', 'R', 'R')] = { "SHR",    OP_SHR },
+    [MNEMONIC_HASH('S', 'H', 'R', 'I')] = { "SHRI",   OP_SHRI },
+    [MNEMONIC_HASH('P', 'R', 'I', 'T')] = { "PRINT",  OP_PRINT },
+    [MNEMONIC_HASH('P', 'R', 'I', 'C')] = { "PRINTC", OP_PRINTC },
+    [MNEMONIC_HASH('P', 'R', 'I', 'S')] = { "PRINTS", OP_PRINTS },
+    [MNEMONIC_HASH('R', 'E', 'A', 'D')] = { "READ",   OP_READ },
+    [MNEMONIC_HASH('R', 'E', 'A', 'C')] = { "READC",  OP_READC },
+    [MNEMONIC_HASH('R', 'E', 'A', 'S')] = { "READS",  OP_READS },
+    [MNEMONIC_HASH('R', 'E', 'T', 'T')] = { "RET",    OP_RET },
+    [MNEMONIC_HASH('H', 'A', 'L', 'T')] = { "HALT",   OP_HALT },
+    [MNEMONIC_HASH('C', 'A', 'L', 'L')] = { "CALL",   OP_CALL },
+    [MNEMONIC_HASH('N', 'C', 'A', 'L')] = { "NCALL",  OP_NCALL },
+    [MNEMONIC_HASH('S', 'P', 'A', 'N')] = { "SPAWN",  OP_SPAWN },
+    [MNEMONIC_HASH('Y', 'I', 'E', 'D')] = { "YIELD",  OP_YIELD },
+    [MNEMONIC_HASH('J', 'O', 'I', 'N')] = { "JOIN",   OP_JOIN },
+    [MNEMONIC_HASH('N', 'O', 'P', 'P')] = { "NOP",    OP_NOP },
+    [MNEMONIC_HASH('D', 'B', 'G', 'G')] = { "DBG",    OP_DBG },
+    [MNEMONIC_HASH('S', 'W', 'I', 'H')] = { "SWITCH", OP_SWITCH },
+    [MNEMONIC_HASH('A', 'L', 'L', 'C')] = { "ALLOC",  OP_ALLOC },
+    [MNEMONIC_HASH('F', 'R', 'E', 'E')] = { "FREE",   OP_FREE },
+    [MNEMONIC_HASH('R', 'E', 'S', 'T')] = { "RESET",  OP_RESET },
+};
+#pragma GCC diagnostic pop
+
+/* mnemonics are matched in any case */
+HOT_REGION Opcode get_opcode(const Token *t) {
+    if (UNLIKELY(t->kind != TOK_IDENT || t->len < 2 || t->len > 6)) return OP_INVALID;
+
+    const char *s = t->start;
+    const Mnemonic *m = &mnemonics[MNEMONIC_HASH(toupper((unsigned char)s[0]), toupper((unsigned char)s[1]),
+                                                 t->len > 2 ? toupper((unsigned char)s[2]) : 0,
+                                                 toupper((unsigned char)s[t->len - 1]))];
+    if (UNLIKELY(!m->name)) return OP_INVALID;
+    for (int i = 0; i < t->len; i++)
+        if (m->name[i] != toupper((unsigned char)s[i])) return OP_INVALID;
+    return m->name[t->len] == '\0' ? m->opcode : OP_INVALID;
 }
 
 /* -------- INSTRUCTION PARSER -------- */
 
-FORCE_INLINE HOT_REGION int parse_instruction(Assembler *asm_ctx, ErrorContext *err_ctx, char *line, int pass) {
-    char mnemonic[32];
-    char arg1[32], arg2[32], arg3[32];
+static FORCE_INLINE void emit16(Assembler *asm_ctx, ErrorContext *err_ctx, int value) {
+    emit_byte(asm_ctx, err_ctx, (value >> 8) & 0xFF);
+    emit_byte(asm_ctx, err_ctx, value & 0xFF);
+}
+
+static FORCE_INLINE void emit32(Assembler *asm_ctx, ErrorContext *err_ctx, uint32_t value) {
+    emit16(asm_ctx, err_ctx, value >> 16);
+    emit16(asm_ctx, err_ctx, value & 0xFFFF);
+}
 
-    if (UNLIKELY(strlen(line) == 0)) return 0;
+/* operand of a wide form: a number in [-2^31..2^32-1], stored as its low 32 bits */
+static HOT_REGION int parse_imm32(Assembler *asm_ctx, ErrorContext *err_ctx, const Token *t, uint32_t *out) {
+    int64_t val = parse_wide(t);
+    if (UNLIKELY(t->kind != TOK_NUMBER || val < -0x80000000LL || val > 0xFFFFFFFFLL)) {
+        error_push(err_ctx, ERR_IMMEDIATE_OVERFLOW, SEVERITY_ERROR, asm_ctx->current_line, t->col,
+                   asm_ctx->current_source, "immediate value '%.*s' out of 32-bit range", SPAN(*t));
+        return -1;
+    }
+    *out = (uint32_t)val;
+    return 0;
+}
 
-    /* label on this line? */
-    char *colon = strchr(line, ':');
-    if (UNLIKELY(colon != NULL)) {
-        *colon = '\0';
-        if (pass == 1)
-            add_label(asm_ctx, err_ctx, line, asm_ctx->bytecode_pos, 0);
-        line = colon + 1;
-        while (isspace((unsigned char)*line)) line++;
-        if (UNLIKELY(strlen(line) == 0)) return 0;
+/* the opcode emitted at 'at' becomes another form of the same instruction (wide, addressing mode) */
+static FORCE_INLINE void change_opcode(Assembler *asm_ctx, int at, Opcode form) {
+    if (UNLIKELY(at >= MAX_BYTECODE)) return;
+    asm_ctx->bytecode[at] = form;
+    if (LIKELY(asm_ctx->ir_count > 0 && asm_ctx->ir[asm_ctx->ir_count - 1].address == at))
+        asm_ctx->ir[asm_ctx->ir_count - 1].opcode = form;
+}
+
+static COLD_REGION int operand_error(Assembler *asm_ctx, ErrorContext *err_ctx, ErrorCode code,
+                                     const Token *at, const char *message, const Token *mnemonic) {
+    error_push(err_ctx, code, SEVERITY_ERROR, asm_ctx->current_line, at->col, asm_ctx->current_source,
+               message, SPAN(*mnemonic));
+    return -1;
+}
+
+static COLD_REGION int register_error(Assembler *asm_ctx, ErrorContext *err_ctx, const Token *reg) {
+    error_push(err_ctx, ERR_INVALID_REGISTER, SEVERITY_ERROR, asm_ctx->current_line, reg->col,
+               asm_ctx->current_source, "invalid register '%.*s'", SPAN(*reg));
+    return -1;
+}
+
+static COLD_REGION int unexpected_token(Assembler *asm_ctx, ErrorContext *err_ctx, const Token *t) {
+    error_push(err_ctx, ERR_INVALID_OPERAND, SEVERITY_ERROR, asm_ctx->current_line, t->col, asm_ctx->current_source,
+               "unexpected '%.*s' in operands", SPAN(*t));
+    return -1;
+}
+
+/* -------- MEMORY OPERANDS -------- */
+
+/* [Ra], [Ra+Rb], [Ra+disp] or [Ra]+ */
+typedef struct {
+    const Token *base;
+    const Token *offset;    /* register or displacement after '+', NULL for none */
+    int post;               /* [Ra]+ */
+} MemOperand;
+
+/* LDB, LDW, STB and STORE by mode: [Ra+Rb], [Ra+disp], [Ra]+, [Ra] (OP_INVALID: as [Ra+0]) */
+static const Opcode mem_forms[4][4] = {
+    { OP_LDBX,  OP_LDBD,   OP_LDBP,   OP_LDB },
+    { OP_LDWX,  OP_LDWD,   OP_LDWP,   OP_INVALID },
+    { OP_STBX,  OP_STBD,   OP_STBP,   OP_INVALID },
+    { OP_STORE, OP_STORED, OP_STOREP, OP_INVALID },
+};
+
+static FORCE_INLINE int is_char(const Token *t, char c) {
+    return t->kind == TOK_OTHER && t->len == 1 && t->start[0] == c;
+}
+
+/* the memory operand opening at tok[i] ('['), the number of tokens it takes or -1 */
+static HOT_REGION int parse_mem_operand(const Token *tok, int count, int i, MemOperand *m) {
+    int n = i + 1;
+    if (n >= count || tok[n].kind != TOK_IDENT) return -1;
+    m->base = &tok[n++];
+    m->offset = NULL;
+    m->post = 0;
+
+    if (n + 1 < count && is_char(&tok[n], '+') && (tok[n + 1].kind == TOK_IDENT || tok[n + 1].kind == TOK_NUMBER)) {
+        m->offset = &tok[n + 1];
+        n += 2;
+    }
+    if (n >= count || !is_char(&tok[n], ']')) return -1;
+    n++;
+    if (!m->offset && n < count && is_char(&tok[n], '+')) {
+        m->post = 1;
+        n++;
+    }
+    return n - i;
+}
+
+/* Rd or Rs and a memory operand; the mode picks the opcode out of forms */
+static HOT_REGION int emit_memory(Assembler *asm_ctx, ErrorContext *err_ctx, int at, const Opcode forms[4],
+                                  const Token *reg_tok, const MemOperand *m) {
+    int reg = get_register(reg_tok);
+    int base = get_register(m->base);
+    int index = m->offset ? get_register(m->offset) : -1;
+    if (UNLIKELY(reg < 0)) return register_error(asm_ctx, err_ctx, reg_tok);
+    if (UNLIKELY(base < 0)) return register_error(asm_ctx, err_ctx, m->base);
+    if (UNLIKELY(m->offset && m->offset->kind == TOK_IDENT && index < 0))
+        return register_error(asm_ctx, err_ctx, m->offset);
+
+    int disp = m->offset && index < 0 ? parse_number(m->offset) : 0;
+    if (UNLIKELY(disp < 0 || disp > 255)) {
+        error_push(err_ctx, ERR_IMMEDIATE_OVERFLOW, SEVERITY_ERROR, asm_ctx->current_line, m->offset->col,
+                   asm_ctx->current_source, "displacement %d out of range [0..255]", disp);
+        return -1;
     }
 
-    arg1[0] = '\0';
-    arg2[0] = '\0';
-    arg3[0] = '\0';
+    Opcode form = m->post ? forms[2] : index >= 0 ? forms[0] : m->offset || forms[3] == OP_INVALID ? forms[1] : forms[3];
+    change_opcode(asm_ctx, at, form);
+    emit_byte(asm_ctx, err_ctx, reg);
+    emit_byte(asm_ctx, err_ctx, base);
+    if (form == forms[0]) emit_byte(asm_ctx, err_ctx, index);
+    else if (form == forms[1]) emit_byte(asm_ctx, err_ctx, disp);
+    return 0;
+}
 
-    sscanf(line, "%31s %31[^,],%31[^,],%31[^,]", mnemonic, arg1, arg2, arg3);
+/* jump, CALL or SPAWN target: a label is patched later, a number is checked now */
+static HOT_REGION int emit_target(Assembler *asm_ctx, ErrorContext *err_ctx, FixupKind kind, const Token *t) {
+    if (LIKELY(t->kind == TOK_IDENT)) {
+        add_fixup(asm_ctx, err_ctx, kind, t);
+        emit16(asm_ctx, err_ctx, 0);
+        return 0;
+    }
 
-    /* strip internal whitespace from operands */
-    for (char *p = arg1; *p; p++) if (UNLIKELY(isspace((unsigned char)*p))) memmove(p, p+1, strlen(p)+1);
-    for (char *p = arg2; *p; p++) if (UNLIKELY(isspace((unsigned char)*p))) memmove(p, p+1, strlen(p)+1);
-    for (char *p = arg3; *p; p++) if (UNLIKELY(isspace((unsigned char)*p))) memmove(p, p+1, strlen(p)+1);
+    int addr = parse_number(t);
+    if (UNLIKELY(addr < 0 || addr >= MAX_BYTECODE)) {
+        error_push(err_ctx, ERR_JUMP_OUT_OF_RANGE, SEVERITY_ERROR,
+                   asm_ctx->current_line, t->col, asm_ctx->current_source,
+                   "%s 0x%04X is out of valid range [0x0000..0x%04X]",
+                   kind == FIX_SPAWN ? "thread entry" : "jump target", addr, MAX_BYTECODE - 1);
+        return -1;
+    }
+    if (UNLIKELY(kind == FIX_JUMP && addr == asm_ctx->bytecode_pos + 2)) {
+        error_push(err_ctx, WARN_JUMP_NEXT, SEVERITY_WARNING,
+                   asm_ctx->current_line, t->col, asm_ctx->current_source,
+                   "jump target is the next instruction (0x%04X) — has no effect", addr);
+    }
+    emit16(asm_ctx, err_ctx, addr);
+    return 0;
+}
 
-    for (char *p = mnemonic; *p; p++) *p = toupper((unsigned char)*p);
+/* [label:] [MNEMONIC [operand {, operand}]] - up to three operands, each a single token or a memory operand */
+FORCE_INLINE HOT_REGION int parse_instruction(Assembler *asm_ctx, ErrorContext *err_ctx,
+                                              const Token *tok, int count) {
+    /* label on this line? */
+    if (UNLIKELY(count >= 2 && tok[1].kind == TOK_COLON)) {
+        add_label(asm_ctx, err_ctx, &tok[0], asm_ctx->bytecode_pos, LABEL_CODE);
+        tok += 2;
+        count -= 2;
+        if (count == 0) return 0;
+    }
+
+    const Token *mnemonic = &tok[0];
+    const Token *arg1 = &no_token, *arg2 = &no_token, *arg3 = &no_token;
+    const Token **next_arg[3] = { &arg1, &arg2, &arg3 };
+    const Token *mem_at = NULL; /* '[' of the memory operand, which is one of the args */
+    MemOperand mem = {0};
+    int arg_count = 0;
+
+    /* operands separated by commas */
+    for (int i = 1; i < count; ) {
+        const Token *t = &tok[i];
+        if (UNLIKELY(is_char(t, '[') && !mem_at && arg_count < 3)) {
+            int used = parse_mem_operand(tok, count, i, &mem);
+            if (UNLIKELY(used < 0)) {
+                error_push(err_ctx, ERR_INVALID_OPERAND, SEVERITY_ERROR,
+                           asm_ctx->current_line, t->col, asm_ctx->current_source,
+                           "malformed memory operand, expected [Ra], [Ra+Rb], [Ra+disp] or [Ra]+");
+                return -1;
+            }
+            mem_at = t;
+            i += used;
+        } else if (LIKELY((t->kind == TOK_IDENT || t->kind == TOK_NUMBER) && arg_count < 3)) {
+            i++;
+        } else {
+            return unexpected_token(asm_ctx, err_ctx, t);
+        }
+        *next_arg[arg_count++] = t;
+
+        if (i < count) {
+            if (UNLIKELY(tok[i].kind != TOK_COMMA || i + 1 >= count)) return unexpected_token(asm_ctx, err_ctx, &tok[i]);
+            i++;
+        }
+    }
 
     Opcode opcode = get_opcode(mnemonic);
-    if (UNLIKELY(opcode == OP_INVALID && pass == 2)) {
+    if (UNLIKELY(opcode == OP_INVALID)) {
         error_push(err_ctx, ERR_UNKNOWN_INSTRUCTION, SEVERITY_ERROR,
-                   asm_ctx->current_line, 0, asm_ctx->current_source,
-                   "unknown instruction '%s'", mnemonic);
+                   asm_ctx->current_line, mnemonic->col, asm_ctx->current_source,
+                   "unknown instruction '%.*s'", SPAN(*mnemonic));
         return -1;
     }
 
@@ -275,264 +858,298 @@ FORCE_INLINE HOT_REGION int parse_instruction(Assembler *asm_ctx, ErrorContext *
         asm_ctx->last_nop_line = asm_ctx->current_line;
     }
 
-    if (LIKELY(opcode != OP_INVALID)) {
-        emit_or_skip(asm_ctx, err_ctx, pass, opcode);
+    if (LIKELY(asm_ctx->line_count < MAX_BYTECODE)) {
+        LineEntry *entry = &asm_ctx->lines[asm_ctx->line_count++];
+        entry->address = asm_ctx->bytecode_pos;
+        entry->line = asm_ctx->current_line;
 
-        switch (opcode) {
-            /* group 1 - no operands */
-            case OP_HALT:
-            case OP_RET:
-            case OP_NOP:
-            case OP_DBG:
-                break;
+        Instr *ins = &asm_ctx->ir[asm_ctx->ir_count++];
+        ins->opcode = opcode;
+        ins->address = asm_ctx->bytecode_pos;
+        ins->line = asm_ctx->current_line;
+        ins->label = -1;
+    }
+    int at = asm_ctx->bytecode_pos;
+    emit_byte(asm_ctx, err_ctx, opcode);
 
-            /* group 2 - single register */
-            case OP_PUSH:
-            case OP_POP:
-            case OP_PRINT:
-            case OP_PRINTC:
-            case OP_PRINTS:
-            case OP_READ:
-            case OP_READC: {
-                int reg = get_register(arg1);
-                if (LIKELY(reg >= 0)) {
-                    if (pass == 2) emit_byte(asm_ctx, err_ctx, reg);
-                    else asm_ctx->bytecode_pos++;
-                } else if (UNLIKELY(pass == 2)) {
-                    error_push(err_ctx, ERR_INVALID_REGISTER, SEVERITY_ERROR,
-                               asm_ctx->current_line, 0, asm_ctx->current_source,
-                               "invalid register '%s'", arg1);
-                    return -1;
-                }
-                break;
-            }
+    /* LDB, LDW, STB, STORE Rd, [...] - the addressing mode picks the opcode */
+    if (UNLIKELY(mem_at != NULL)) {
+        int row = opcode == OP_LDB ? 0 : opcode == OP_LDWD ? 1 : opcode == OP_STBD ? 2 : opcode == OP_STORE ? 3 : -1;
+        if (UNLIKELY(row < 0 || arg2 != mem_at || arg_count != 2))
+            return operand_error(asm_ctx, err_ctx, ERR_INVALID_OPERAND, mem_at,
+                                 row < 0 ? "'%.*s' takes no memory operand"
+                                         : "'%.*s' takes a register and a memory operand", mnemonic);
+        return emit_memory(asm_ctx, err_ctx, at, mem_forms[row], arg1, &mem);
+    }
 
-            /* group 3 - jump/call: 2-byte address */
-            case OP_JMP:
-            case OP_JE:
-            case OP_JNE:
-            case OP_JG:
-            case OP_JGE:
-            case OP_JL:
-            case OP_JLE:
-            case OP_JNZ:
-            case OP_CALL: {
-                int addr = find_label(asm_ctx, arg1);
-                if (UNLIKELY(addr < 0))
-                    addr = parse_number(arg1);
-
-                if (UNLIKELY(pass == 2 && arg1[0] == '\0')) {
-                    error_push(err_ctx, ERR_OPERAND_MISSING, SEVERITY_ERROR,
-                               asm_ctx->current_line, 0, asm_ctx->current_source,
-                               "'%s' requires a label or address operand", mnemonic);
-                    return -1;
-                }
-                if (UNLIKELY(pass == 2 && (addr < 0 || addr >= MAX_BYTECODE))) {
-                    error_push(err_ctx, ERR_JUMP_OUT_OF_RANGE, SEVERITY_ERROR,
-                               asm_ctx->current_line, 0, asm_ctx->current_source,
-                               "jump target 0x%04X is out of valid range [0x0000..0x%04X]",
-                               addr, MAX_BYTECODE - 1);
-                    return -1;
-                }
-                if (UNLIKELY(pass == 2 && addr == asm_ctx->bytecode_pos + 2)) {
-                    error_push(err_ctx, WARN_JUMP_NEXT, SEVERITY_WARNING,
-                               asm_ctx->current_line, 0, asm_ctx->current_source,
-                               "jump target is the next instruction (0x%04X) — has no effect", addr);
-                }
-                if (pass == 2) {
-                    emit_byte(asm_ctx, err_ctx, (addr >> 8) & 0xFF);
-                    emit_byte(asm_ctx, err_ctx, addr & 0xFF);
-                } else {
-                    asm_ctx->bytecode_pos += 2;
-                }
+    switch (opcode) {
+        /* group 1 - no operands */
+        case OP_HALT:
+        case OP_RET:
+        case OP_NOP:
+        case OP_DBG:
+        case OP_YIELD:
+        case OP_RESET:
+            break;
+
+        /* group 2 - single register */
+        case OP_PUSH:
+        case OP_POP:
+        case OP_PRINT:
+        case OP_PRINTC:
+        case OP_PRINTS:
+        case OP_READ:
+        case OP_READC:
+        case OP_JOIN:
+        case OP_FREE: {
+            int reg = get_register(arg1);
+            if (UNLIKELY(reg < 0)) return register_error(asm_ctx, err_ctx, arg1);
+            emit_byte(asm_ctx, err_ctx, reg);
+            break;
+        }
+
+        /* group 3 - jump/call: 2-byte address; JMP and CALL also take a register */
+        case OP_JMP:
+        case OP_JE:
+        case OP_JNE:
+        case OP_JG:
+        case OP_JGE:
+        case OP_JL:
+        case OP_JLE:
+        case OP_JNZ:
+        case OP_CALL:
+            if (UNLIKELY(arg1->len == 0))
+                return operand_error(asm_ctx, err_ctx, ERR_OPERAND_MISSING, mnemonic,
+                                     "'%.*s' requires a label or address operand", mnemonic);
+            if (UNLIKELY((opcode == OP_JMP || opcode == OP_CALL) && get_register(arg1) >= 0)) { /* JMP Rn, CALL Rn */
+                change_opcode(asm_ctx, at, opcode == OP_JMP ? OP_JMPR : OP_CALLR);
+                emit_byte(asm_ctx, err_ctx, get_register(arg1));
                 break;
             }
+            return emit_target(asm_ctx, err_ctx, FIX_JUMP, arg1);
+
+        /* group 3a - SPAWN Rd, label: 2-byte address */
+        case OP_SPAWN: {
+            if (UNLIKELY(arg2->len == 0))
+                return operand_error(asm_ctx, err_ctx, ERR_OPERAND_MISSING, mnemonic,
+                                     "'%.*s' requires a register and a label: SPAWN Rd, label", mnemonic);
+            int reg = get_register(arg1);
+            if (UNLIKELY(reg < 0)) return register_error(asm_ctx, err_ctx, arg1);
+            emit_byte(asm_ctx, err_ctx, reg);
+            return emit_target(asm_ctx, err_ctx, FIX_SPAWN, arg2);
+        }
+
+        /* group 3b - DJNZ Rn, label: 2-byte address */
+        case OP_DJNZ: {
+            if (UNLIKELY(arg2->len == 0))
+                return operand_error(asm_ctx, err_ctx, ERR_OPERAND_MISSING, mnemonic,
+                                     "'%.*s' requires a register and a label: DJNZ Rn, label", mnemonic);
+            int reg = get_register(arg1);
+            if (UNLIKELY(reg < 0)) return register_error(asm_ctx, err_ctx, arg1);
+            emit_byte(asm_ctx, err_ctx, reg);
+            return emit_target(asm_ctx, err_ctx, FIX_JUMP, arg2);
+        }
+
+        /* group 3c - compare and branch: Rs, Rt | imm, 2-byte address */
+        case OP_BEQ:
+        case OP_BNE:
+        case OP_BLT:
+        case OP_BLE:
+        case OP_BGT:
+        case OP_BGE:
+        case OP_BEQI:
+        case OP_BNEI:
+        case OP_BLTI:
+        case OP_BLEI:
+        case OP_BGTI:
+        case OP_BGEI: {
+            if (UNLIKELY(arg3->len == 0))
+                return operand_error(asm_ctx, err_ctx, ERR_OPERAND_MISSING, mnemonic,
+                                     "'%.*s' requires three operands: register, register or immediate, label", mnemonic);
+            int reg1 = get_register(arg1);
+            if (UNLIKELY(reg1 < 0)) return register_error(asm_ctx, err_ctx, arg1);
+            emit_byte(asm_ctx, err_ctx, reg1);
 
-            /* group 4 - two registers */
-            case OP_MOV:
-            case OP_CMP: {
-                int reg1 = get_register(arg1);
+            if (opcode >= OP_BEQI) {
+                if (UNLIKELY(arg2->kind != TOK_NUMBER))
+                    return operand_error(asm_ctx, err_ctx, ERR_INVALID_OPERAND, arg2,
+                                         "'%.*s' compares with a number", mnemonic);
+                int val = parse_number(arg2);
+                check_immediate(asm_ctx, err_ctx, val, arg2);
+                emit_byte(asm_ctx, err_ctx, val & 0xFF);
+            } else {
                 int reg2 = get_register(arg2);
-                if (LIKELY(reg1 >= 0 && reg2 >= 0)) {
-                    if (pass == 2) {
-                        emit_byte(asm_ctx, err_ctx, reg1);
-                        emit_byte(asm_ctx, err_ctx, reg2);
-                    } else {
-                        asm_ctx->bytecode_pos += 2;
-                    }
-                } else if (UNLIKELY(pass == 2)) {
-                    error_push(err_ctx, ERR_INVALID_REGISTER, SEVERITY_ERROR,
-                               asm_ctx->current_line, 0, asm_ctx->current_source,
-                               "invalid registers '%s', '%s'", arg1, arg2);
-                    return -1;
-                }
-                break;
+                if (UNLIKELY(reg2 < 0)) return register_error(asm_ctx, err_ctx, arg2);
+                emit_byte(asm_ctx, err_ctx, reg2);
             }
+            return emit_target(asm_ctx, err_ctx, FIX_JUMP, arg3);
+        }
 
-            /* group 5 - register + immediate/label */
-            case OP_CMPI:
-            case OP_STOREI: {
-                int reg = get_register(arg1);
-                int label_addr = find_label(asm_ctx, arg2);
-                int val = (UNLIKELY(label_addr >= 0)) ? label_addr : parse_number(arg2);
-
-                if (UNLIKELY(pass == 2 && arg2[0] == '\0')) {
-                    error_push(err_ctx, ERR_OPERAND_MISSING, SEVERITY_ERROR,
-                               asm_ctx->current_line, 0, asm_ctx->current_source,
-                               "'%s' requires two operands: register and immediate/label", mnemonic);
-                    return -1;
-                }
-                if (UNLIKELY(pass == 2 && label_addr < 0))
-                    check_immediate(asm_ctx, err_ctx, val, arg2);
-
-                if (LIKELY(reg >= 0)) {
-                    if (pass == 2) {
-                        emit_byte(asm_ctx, err_ctx, reg);
-                        emit_byte(asm_ctx, err_ctx, val & 0xFF);
-                    } else {
-                        asm_ctx->bytecode_pos += 2;
-                    }
-                } else if (UNLIKELY(pass == 2)) {
-                    error_push(err_ctx, ERR_INVALID_REGISTER, SEVERITY_ERROR,
-                               asm_ctx->current_line, 0, asm_ctx->current_source,
-                               "invalid register '%s'", arg1);
-                    return -1;
-                }
-                break;
-            }
+        /* group 3d - NCALL native name | index */
+        case OP_NCALL: {
+            int index = find_native(asm_ctx, arg1);
+            if (UNLIKELY(index < 0 && arg1->kind == TOK_NUMBER))
+                index = parse_number(arg1);
 
-            /* group 5b - LDB Rdest, Raddr */
-            case OP_LDB: {
-                int reg_dest = get_register(arg1);
-                int reg_addr = get_register(arg2);
-                if (LIKELY(reg_dest >= 0 && reg_addr >= 0)) {
-                    if (pass == 2) {
-                        emit_byte(asm_ctx, err_ctx, reg_dest);
-                        emit_byte(asm_ctx, err_ctx, reg_addr);
-                    } else {
-                        asm_ctx->bytecode_pos += 2;
-                    }
-                } else if (UNLIKELY(pass == 2)) {
-                    error_push(err_ctx, ERR_INVALID_REGISTER, SEVERITY_ERROR,
-                               asm_ctx->current_line, 0, asm_ctx->current_source,
-                               "LDB requires two registers: LDB Rdest, Raddr");
-                    return -1;
-                }
-                break;
+            if (UNLIKELY(index < 0 || index >= MAX_NATIVES)) {
+                error_push(err_ctx, ERR_NATIVE_NOT_FOUND, SEVERITY_ERROR,
+                           asm_ctx->current_line, arg1->col, asm_ctx->current_source,
+                           "unknown native '%.*s' (declare it with .native NAME, index)", SPAN(*arg1));
+                return -1;
             }
+            emit_byte(asm_ctx, err_ctx, index);
+            break;
+        }
 
-            /* group 6 - READS addr, maxlen */
-            case OP_READS: {
-                int addr = parse_number(arg1);
-                int maxlen = parse_number(arg2);
-                if (pass == 2) {
-                    emit_byte(asm_ctx, err_ctx, addr & 0xFF);
-                    emit_byte(asm_ctx, err_ctx, maxlen & 0xFF);
-                } else {
-                    asm_ctx->bytecode_pos += 2;
-                }
+        /* group 3e - SWITCH Rn, table: 2-byte address of a .table */
+        case OP_SWITCH: {
+            if (UNLIKELY(arg2->len == 0))
+                return operand_error(asm_ctx, err_ctx, ERR_OPERAND_MISSING, mnemonic,
+                                     "'%.*s' requires a register and a table: SWITCH Rn, table", mnemonic);
+            int reg = get_register(arg1);
+            if (UNLIKELY(reg < 0)) return register_error(asm_ctx, err_ctx, arg1);
+            emit_byte(asm_ctx, err_ctx, reg);
+            if (UNLIKELY(arg2->kind != TOK_IDENT))
+                return operand_error(asm_ctx, err_ctx, ERR_INVALID_OPERAND, arg2,
+                                     "'%.*s' takes the label of a .table", mnemonic);
+            add_fixup(asm_ctx, err_ctx, FIX_ADDR16, arg2);
+            emit16(asm_ctx, err_ctx, 0);
+            break;
+        }
+
+        /* group 4 - two registers */
+        case OP_MOV:
+        case OP_CMP:
+        case OP_LDB:
+        case OP_ALLOC: {
+            int reg1 = get_register(arg1);
+            int reg2 = get_register(arg2);
+            if (UNLIKELY(reg1 < 0)) return register_error(asm_ctx, err_ctx, arg1);
+            if (UNLIKELY(reg2 < 0)) return register_error(asm_ctx, err_ctx, arg2);
+            emit_byte(asm_ctx, err_ctx, reg1);
+            emit_byte(asm_ctx, err_ctx, reg2);
+            break;
+        }
+
+        /* group 5 - register + immediate/label */
+        case OP_CMPI:
+        case OP_STOREI: {
+            if (UNLIKELY(arg2->len == 0))
+                return operand_error(asm_ctx, err_ctx, ERR_OPERAND_MISSING, mnemonic,
+                                     "'%.*s' requires two operands: register and immediate/label", mnemonic);
+            int reg = get_register(arg1);
+            if (UNLIKELY(reg < 0)) return register_error(asm_ctx, err_ctx, arg1);
+            emit_byte(asm_ctx, err_ctx, reg);
+
+            if (UNLIKELY(arg2->kind == TOK_IDENT)) {
+                add_fixup(asm_ctx, err_ctx, FIX_BYTE, arg2);
+                emit_byte(asm_ctx, err_ctx, 0);
                 break;
             }
-
-            /* group 7 - three registers */
-            case OP_ADD:
-            case OP_SUB:
-            case OP_MUL:
-            case OP_DIV:
-            case OP_XOR:
-            case OP_OR:
-            case OP_AND:
-            case OP_SHL:
-            case OP_SHR:
-            case OP_STORE: {
-                int reg1 = get_register(arg1);
-                int reg2 = get_register(arg2);
-                int reg3 = get_register(arg3);
-                if (LIKELY(reg1 >= 0 && reg2 >= 0 && reg3 >= 0)) {
-                    if (pass == 2) {
-                        emit_byte(asm_ctx, err_ctx, reg1);
-                        emit_byte(asm_ctx, err_ctx, reg2);
-                        emit_byte(asm_ctx, err_ctx, reg3);
-                    } else {
-                        asm_ctx->bytecode_pos += 3;
-                    }
-                } else if (UNLIKELY(pass == 2)) {
-                    error_push(err_ctx, ERR_INVALID_REGISTER, SEVERITY_ERROR,
-                               asm_ctx->current_line, 0, asm_ctx->current_source,
-                               "invalid registers '%s', '%s', '%s'", arg1, arg2, arg3);
-                    return -1;
-                }
+            int val = parse_number(arg2);
+            if (opcode == OP_CMPI && (val < 0 || val > 255)) {
+                uint32_t imm;
+                if (UNLIKELY(parse_imm32(asm_ctx, err_ctx, arg2, &imm) < 0)) return -1;
+                change_opcode(asm_ctx, at, OP_CMPIW);
+                emit32(asm_ctx, err_ctx, imm);
                 break;
             }
+            check_immediate(asm_ctx, err_ctx, val, arg2);
+            emit_byte(asm_ctx, err_ctx, val & 0xFF);
+            break;
+        }
 
-            /* group 8 - two registers + immediate */
-            case OP_ADDI:
-            case OP_XORI:
-            case OP_ORI:
-            case OP_SHLI:
-            case OP_SHRI: {
-                int reg1 = get_register(arg1);
-                int reg2 = get_register(arg2);
-                int val  = parse_number(arg3);
+        /* group 6 - READS addr, maxlen */
+        case OP_READS:
+            emit_byte(asm_ctx, err_ctx, parse_number(arg1) & 0xFF);
+            emit_byte(asm_ctx, err_ctx, parse_number(arg2) & 0xFF);
+            break;
 
-                if (UNLIKELY(pass == 2 && arg3[0] == '\0')) {
-                    error_push(err_ctx, ERR_OPERAND_MISSING, SEVERITY_ERROR,
-                               asm_ctx->current_line, 0, asm_ctx->current_source,
-                               "'%s' requires three operands: Rdest, Rsrc, immediate", mnemonic);
-                    return -1;
-                }
-                if (UNLIKELY(pass == 2))
-                    check_immediate(asm_ctx, err_ctx, val, arg3);
-
-                if (LIKELY(reg1 >= 0 && reg2 >= 0)) {
-                    if (pass == 2) {
-                        emit_byte(asm_ctx, err_ctx, reg1);
-                        emit_byte(asm_ctx, err_ctx, reg2);
-                        emit_byte(asm_ctx, err_ctx, val & 0xFF);
-                    } else {
-                        asm_ctx->bytecode_pos += 3;
-                    }
-                } else if (UNLIKELY(pass == 2)) {
-                    error_push(err_ctx, ERR_INVALID_REGISTER, SEVERITY_ERROR,
-                               asm_ctx->current_line, 0, asm_ctx->current_source,
-                               "invalid registers '%s', '%s'", arg1, arg2);
-                    return -1;
-                }
+        /* group 7 - three registers */
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+        case OP_XOR:
+        case OP_OR:
+        case OP_AND:
+        case OP_SHL:
+        case OP_SHR:
+        case OP_STORE: {
+            const Token *args[3] = { arg1, arg2, arg3 };
+            for (int i = 0; i < 3; i++) {
+                int reg = get_register(args[i]);
+                if (UNLIKELY(reg < 0)) return register_error(asm_ctx, err_ctx, args[i]);
+                emit_byte(asm_ctx, err_ctx, reg);
+            }
+            break;
+        }
+
+        /* group 8 - two registers + immediate, 32 bits wide when it does not fit a byte */
+        case OP_ADDI:
+        case OP_XORI:
+        case OP_ORI:
+        case OP_SHLI:
+        case OP_SHRI: {
+            if (UNLIKELY(arg3->len == 0))
+                return operand_error(asm_ctx, err_ctx, ERR_OPERAND_MISSING, mnemonic,
+                                     "'%.*s' requires three operands: Rdest, Rsrc, immediate", mnemonic);
+            int reg1 = get_register(arg1);
+            int reg2 = get_register(arg2);
+            int val  = parse_number(arg3);
+            if (UNLIKELY(reg1 < 0)) return register_error(asm_ctx, err_ctx, arg1);
+            if (UNLIKELY(reg2 < 0)) return register_error(asm_ctx, err_ctx, arg2);
+            if ((val < 0 || val > 255) && opcode != OP_SHLI && opcode != OP_SHRI) {
+                uint32_t imm;
+                if (UNLIKELY(parse_imm32(asm_ctx, err_ctx, arg3, &imm) < 0)) return -1;
+                change_opcode(asm_ctx, at, opcode == OP_ADDI ? OP_ADDIW : opcode == OP_XORI ? OP_XORIW : OP_ORIW);
+                emit_byte(asm_ctx, err_ctx, reg1);
+                emit_byte(asm_ctx, err_ctx, reg2);
+                emit32(asm_ctx, err_ctx, imm);
                 break;
             }
+            check_immediate(asm_ctx, err_ctx, val, arg3);
+            emit_byte(asm_ctx, err_ctx, reg1);
+            emit_byte(asm_ctx, err_ctx, reg2);
+            emit_byte(asm_ctx, err_ctx, val & 0xFF);
+            break;
+        }
 
-            /* group 9 - LOAD reg, label | reg, high, low */
-            case OP_LOAD: {
-                int reg = get_register(arg1);
-                int val_high, val_low;
+        /* group 9 - LOAD reg, label | reg, value | reg, high, low; a value above 16 bits takes the wide form */
+        case OP_LOAD: {
+            int reg = get_register(arg1);
+            if (UNLIKELY(reg < 0)) return register_error(asm_ctx, err_ctx, arg1);
+            emit_byte(asm_ctx, err_ctx, reg);
 
-                int label_addr = find_label(asm_ctx, arg2);
-                if (UNLIKELY(label_addr >= 0)) {
-                    val_high = (label_addr >> 8) & 0xFF;
-                    val_low = label_addr & 0xFF;
+            if (UNLIKELY(arg2->kind == TOK_IDENT)) {
+                add_fixup(asm_ctx, err_ctx, FIX_ADDR16, arg2);
+                emit16(asm_ctx, err_ctx, 0);
+            } else if (arg3->len == 0) {
+                uint32_t imm;
+                if (UNLIKELY(parse_imm32(asm_ctx, err_ctx, arg2, &imm) < 0)) return -1;
+                if (imm <= 0xFFFF) {
+                    emit16(asm_ctx, err_ctx, imm);
                 } else {
-                    val_high = parse_number(arg2);
-                    val_low = parse_number(arg3);
+                    change_opcode(asm_ctx, at, OP_LOADW);
+                    emit32(asm_ctx, err_ctx, imm);
                 }
-
-                if (LIKELY(reg >= 0)) {
-                    if (pass == 2) {
-                        emit_byte(asm_ctx, err_ctx, reg);
-                        emit_byte(asm_ctx, err_ctx, val_high & 0xFF);
-                        emit_byte(asm_ctx, err_ctx, val_low & 0xFF);
-                    } else {
-                        asm_ctx->bytecode_pos += 3;
-                    }
-                } else if (UNLIKELY(pass == 2)) {
-                    error_push(err_ctx, ERR_INVALID_REGISTER, SEVERITY_ERROR,
-                               asm_ctx->current_line, 0, asm_ctx->current_source,
-                               "invalid register '%s'", arg1);
-                    return -1;
-                }
-                break;
+            } else {
+                emit_byte(asm_ctx, err_ctx, parse_number(arg2) & 0xFF);
+                emit_byte(asm_ctx, err_ctx, parse_number(arg3) & 0xFF);
             }
+            break;
         }
+
+        /* group 10 - LDW/STB reg, memory operand (handled above) */
+        case OP_LDWD:
+        case OP_STBD:
+            return operand_error(asm_ctx, err_ctx, ERR_OPERAND_MISSING, mnemonic,
+                                 "'%.*s' requires a register and a memory operand: [Ra], [Ra+Rb], [Ra+disp] or [Ra]+",
+                                 mnemonic);
+
+        default:
+            break;
     }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "../include/common.h"
+#include "../include/types.h"
+#include "../include/error.h"
+#include "../include/assembler.h"
+#include "../include/lexer.h"
+#include "../include/vobj.h"
+#include "../include/build.h"
+
+/*
+ * Sources of a multi-file build are assembled into objects next to them
+ * (prog.vasm -> prog.vobj), one process per source and up to -jN at once.
+ * An object newer than its source is reused as it is, so after an edit only
+ * the changed files are assembled again before the link.
+ */
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/wait.h>
+#include <unistd.h>
+#define VASM_FORK
+#endif
+
+/* -------- ONE SOURCE -------- */
+
+/* .text -> 0, .data -> 1, .bss -> 2, anything else -> -1 */
+static int section_of(const Token *directive) {
+    if (token_is(directive, ".text")) return 0;
+    if (token_is(directive, ".data")) return 1;
+    if (token_is(directive, ".bss")) return 2;
+    return -1;
+}
+
+/* the whole source in one pass; label operands are left to link_labels() or the linker */
+HOT_REGION void assemble(Assembler *asm_ctx, ErrorContext *err_ctx, const Source *src) {
+    Token tok[MAX_LINE_TOKENS];
+    Lexer lx;
+    int count;
+
+    lexer_init(&lx, src);
+    while (LIKELY((count = lex_line(&lx, tok, MAX_LINE_TOKENS)) > 0)) {
+        asm_ctx->current_line = lx.line;
+        asm_ctx->current_source = lx.line_start;
+
+        if (UNLIKELY(count > MAX_LINE_TOKENS)) {
+            error_push(err_ctx, ERR_INVALID_OPERAND, SEVERITY_ERROR, lx.line, 0, lx.line_start,
+                       "line has more than %d tokens", MAX_LINE_TOKENS);
+            continue;
+        }
+
+        if (UNLIKELY(tok[0].kind == TOK_DIRECTIVE)) {
+            int section = section_of(&tok[0]);
+            if (section >= 0) asm_ctx->in_data_section = section;
+            else if (token_is(&tok[0], ".native")) parse_native_directive(asm_ctx, err_ctx, tok, count);
+            else if (token_is(&tok[0], ".entry")) parse_entry_directive(asm_ctx, err_ctx, tok, count);
+            else if (token_is(&tok[0], ".global")) parse_scope_directive(asm_ctx, err_ctx, tok, count, SCOPE_GLOBAL);
+            else if (token_is(&tok[0], ".extern")) parse_scope_directive(asm_ctx, err_ctx, tok, count, SCOPE_EXTERN);
+            else
+                error_push(err_ctx, ERR_UNKNOWN_INSTRUCTION, SEVERITY_ERROR, lx.line, tok[0].col, lx.line_start,
+                           "unknown directive '%.*s'", SPAN(tok[0]));
+            continue;
+        }
+
+        if (UNLIKELY(asm_ctx->in_data_section)) parse_data_directive(asm_ctx, err_ctx, tok, count);
+        else parse_instruction(asm_ctx, err_ctx, tok, count);
+    }
+}
+
+/* assembles one source into an object file, printing its own errors; 0 on success */
+COLD_REGION int compile_object(const char *source_path, const char *object_path, int silent) {
+    Assembler *asm_ctx = calloc(1, sizeof(Assembler));
+    ErrorContext *err_ctx = calloc(1, sizeof(ErrorContext));
+    int result = 1;
+    Source src;
+
+    if (UNLIKELY(!asm_ctx || !err_ctx)) {
+        fprintf(stderr, "out of memory assembling '%s'\n", source_path);
+    } else if (UNLIKELY(source_open(&src, source_path) != 0)) {
+        error_push(err_ctx, ERR_FILE_OPEN, SEVERITY_ERROR, 0, 0, NULL, "could not open file '%s'", source_path);
+    } else {
+        if (LIKELY(!silent))
+            printf("Assembling %s...\n", strcmp(source_path, "-") == 0 ? "standard input" : source_path);
+        assemble(asm_ctx, err_ctx, &src);
+        check_object(asm_ctx, err_ctx);
+        source_close(&src);
+        asm_ctx->current_source = NULL;
+    }
+
+    if (asm_ctx && err_ctx && LIKELY(!error_has_errors(err_ctx))) {
+        FILE *output = fopen(object_path, "wb");
+        size_t bytes_written = 0;
+        int size = -1;
+        if (LIKELY(output != NULL)) {
+            size = write_object(asm_ctx, output, &bytes_written);
+            if (UNLIKELY(fclose(output) != 0)) size = -1;
+        }
+        if (LIKELY(size >= 0 && bytes_written == (size_t)size)) result = 0;
+        else error_push(err_ctx, ERR_FILE_WRITE, SEVERITY_ERROR, 0, 0, NULL, "could not write object '%s'", object_path);
+    }
+    if (result != 0) remove(object_path); /* an old object must not be linked instead */
+
+    if (err_ctx && err_ctx->count > 0) {
+        fprintf(stderr, "\n%s:", source_path); /* several sources may report at once */
+        error_dump(err_ctx);
+    }
+    if (asm_ctx) free_labels(asm_ctx);
+    free(asm_ctx);
+    free(err_ctx);
+    return result;
+}
+
+/* -------- MANY SOURCES -------- */
+
+/* the object is newer than the source and written by this version of vasm */
+static COLD_REGION int up_to_date(const char *source_path, const char *object_path) {
+    struct stat src, obj;
+    if (stat(source_path, &src) != 0 || stat(object_path, &obj) != 0 || obj.st_mtime <= src.st_mtime)
+        return 0; /* same second: the source may have changed after the object was written */
+
+    uint8_t header[6];
+    FILE *file = fopen(object_path, "rb");
+    if (!file) return 0;
+    int ok = fread(header, 1, sizeof(header), file) == sizeof(header) &&
+             memcmp(header, VOBJ_MAGIC, 4) == 0 && vobj_get16(header + 4) == VOBJ_VERSION;
+    fclose(file);
+    return ok;
+}
+
+int default_jobs(void) {
+#ifdef VASM_FORK
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (int)cpus : 1;
+#else
+    return 1;
+#endif
+}
+
+#ifdef VASM_FORK
+/* reaps one finished worker, 1 if it failed */
+static COLD_REGION int wait_worker(void) {
+    int status;
+    if (wait(&status) < 0) return 1;
+    return !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+}
+#endif
+
+/* brings every object up to date (rebuild: assembles them all), -1 if any source failed */
+COLD_REGION int build_objects(char *const sources[], char *const objects[], int count, int jobs, int rebuild,
+                              int silent) {
+    int failed = 0;
+#ifdef VASM_FORK
+    int running = 0;
+#endif
+
+    for (int i = 0; i < count; i++) {
+        if (!rebuild && up_to_date(sources[i], objects[i])) {
+            if (LIKELY(!silent)) printf("Up to date: %s\n", objects[i]);
+            continue;
+        }
+
+#ifdef VASM_FORK
+        if (jobs > 1) {
+            while (running >= jobs) {
+                failed |= wait_worker();
+                running--;
+            }
+            fflush(NULL); /* the worker must not print what is still buffered here */
+            pid_t pid = fork();
+            if (pid == 0) exit(compile_object(sources[i], objects[i], silent));
+            if (pid > 0) {
+                running++;
+                continue;
+            }
+            /* no process to spare: assemble it here */
+        }
+#else
+        (void)jobs;
+#endif
+        failed |= compile_object(sources[i], objects[i], silent) != 0;
+    }
+
+#ifdef VASM_FORK
+    while (running > 0) {
+        failed |= wait_worker();
+        running--;
+    }
+#endif
+    return failed ? -1 : 0;
+}
@@ -4,6 +4,7 @@
 #include "../include/common.h"
 #include "../include/types.h"
 #include "../include/opcodes.h"
+#include "../include/assembler.h"
 #include "../include/disasm.h"
 
 COLD_REGION void disass_vasm(Assembler *asm_ctx) {
@@ -27,10 +28,28 @@ COLD_REGION void disass_vasm(Assembler *asm_ctx) {
      *  6 - addr16  (jump/call)
      *  7 - Rn, addr16  (LOAD)
      *  8 - addr8, imm8  (READS)
+ *  9 - native index  (NCALL)
+ * 10 - Rn, addr16  (SPAWN, DJNZ, SWITCH)
+ * 11 - Rn, Rm, imm32  (wide ADDI/XORI/ORI)
+ * 12 - Rn, imm32  (wide CMPI/LOAD)
+ * 13 - Rn, [Rm+Rk]
+ * 14 - Rn, [Rm+imm8]
+ * 15 - Rn, [Rm]+
+ * 16 - Rn, Rm, addr16  (compare and branch)
+ * 17 - Rn, imm8, addr16  (compare with an immediate and branch)
+ * 18 - Rn:Rm  (packed MOV, LDB, CMP)
+ * 19 - Rn:Rm, Rk  (packed three-register ALU)
+ * 20 - Rn:Rm, imm8  (packed ALU with an immediate)
+ * 21 - Rn, imm8 unsigned  (8-bit LOAD)
+ * 22 - rel8  (short jump)
+ * 23 - Rn, rel8  (short DJNZ)
+ * 24 - Rn:Rm, rel8  (short compare and branch)
+ * 25 - Rn, imm8, rel8  (short compare with an immediate and branch)
      */
     static const InstrDesc table[] = {
         { OP_HALT,   "HALT",   0 }, { OP_RET,    "RET",    0 },
         { OP_NOP,    "NOP",    0 }, { OP_DBG,    "DBG",    0 },
+        { OP_YIELD,  "YIELD",  0 }, { OP_JOIN,   "JOIN",   1 },
         { OP_PUSH,   "PUSH",   1 }, { OP_POP,    "POP",    1 },
         { OP_PRINT,  "PRINT",  1 }, { OP_PRINTC, "PRINTC", 1 },
         { OP_PRINTS, "PRINTS", 1 }, { OP_READ,   "READ",   1 },
@@ -53,6 +72,69 @@ COLD_REGION void disass_vasm(Assembler *asm_ctx) {
         { OP_CALL,   "CALL",   6 },
         { OP_LOAD,   "LOAD",   7 },
         { OP_READS,  "READS",  8 },
+        { OP_NCALL,  "NCALL",  9 },
+        { OP_SPAWN,  "SPAWN", 10 }, { OP_DJNZ,   "DJNZ",  10 },
+        { OP_BEQ,    "BEQ",   16 }, { OP_BNE,    "BNE",   16 },
+        { OP_BLT,    "BLT",   16 }, { OP_BLE,    "BLE",   16 },
+        { OP_BGT,    "BGT",   16 }, { OP_BGE,    "BGE",   16 },
+        { OP_BEQI,   "BEQI",  17 }, { OP_BNEI,   "BNEI",  17 },
+        { OP_BLTI,   "BLTI",  17 }, { OP_BLEI,   "BLEI",  17 },
+        { OP_BGTI,   "BGTI",  17 }, { OP_BGEI,   "BGEI",  17 },
+        { OP_JMPR,   "JMP",    1 }, { OP_CALLR,  "CALL",   1 },
+        { OP_SWITCH, "SWITCH", 10 },
+        { OP_POP_NF,  "POP.NF",  1 }, { OP_MOV_NF,  "MOV.NF",  2 },
+        { OP_LDB_NF,  "LDB.NF",  2 }, { OP_ADD_NF,  "ADD.NF",  3 },
+        { OP_SUB_NF,  "SUB.NF",  3 }, { OP_MUL_NF,  "MUL.NF",  3 },
+        { OP_DIV_NF,  "DIV.NF",  3 }, { OP_XOR_NF,  "XOR.NF",  3 },
+        { OP_OR_NF,   "OR.NF",   3 }, { OP_AND_NF,  "AND.NF",  3 },
+        { OP_SHL_NF,  "SHL.NF",  3 }, { OP_SHR_NF,  "SHR.NF",  3 },
+        { OP_ADDI_NF, "ADDI.NF", 5 }, { OP_XORI_NF, "XORI.NF", 5 },
+        { OP_ORI_NF,  "ORI.NF",  5 }, { OP_SHLI_NF, "SHLI.NF", 5 },
+        { OP_SHRI_NF, "SHRI.NF", 5 }, { OP_LOAD_NF, "LOAD.NF", 7 },
+        { OP_ADDIW,   "ADDI",   11 }, { OP_XORIW,   "XORI",   11 },
+        { OP_ORIW,    "ORI",    11 }, { OP_CMPIW,   "CMPI",   12 },
+        { OP_LOADW,   "LOAD",   12 },
+        { OP_ADDIW_NF, "ADDI.NF", 11 }, { OP_XORIW_NF, "XORI.NF", 11 },
+        { OP_ORIW_NF,  "ORI.NF",  11 }, { OP_LOADW_NF, "LOAD.NF", 12 },
+        { OP_LDBX,    "LDB",    13 }, { OP_LDBD,    "LDB",    14 },
+        { OP_LDBP,    "LDB",    15 }, { OP_LDWX,    "LDW",    13 },
+        { OP_LDWD,    "LDW",    14 }, { OP_LDWP,    "LDW",    15 },
+        { OP_STBX,    "STB",    13 }, { OP_STBD,    "STB",    14 },
+        { OP_STBP,    "STB",    15 }, { OP_STORED,  "STORE",  14 },
+        { OP_STOREP,  "STORE",  15 },
+        { OP_LDBX_NF, "LDB.NF", 13 }, { OP_LDBD_NF, "LDB.NF", 14 },
+        { OP_LDBP_NF, "LDB.NF", 15 }, { OP_LDWX_NF, "LDW.NF", 13 },
+        { OP_LDWD_NF, "LDW.NF", 14 }, { OP_LDWP_NF, "LDW.NF", 15 },
+        { OP_MOV_PK,  "MOV",    18 }, { OP_LDB_PK,  "LDB",    18 },
+        { OP_CMP_PK,  "CMP",    18 }, { OP_ADD_PK,  "ADD",    19 },
+        { OP_SUB_PK,  "SUB",    19 }, { OP_MUL_PK,  "MUL",    19 },
+        { OP_DIV_PK,  "DIV",    19 }, { OP_AND_PK,  "AND",    19 },
+        { OP_OR_PK,   "OR",     19 }, { OP_XOR_PK,  "XOR",    19 },
+        { OP_SHL_PK,  "SHL",    19 }, { OP_SHR_PK,  "SHR",    19 },
+        { OP_ADDI_PK, "ADDI",   20 }, { OP_XORI_PK, "XORI",   20 },
+        { OP_ORI_PK,  "ORI",    20 }, { OP_SHLI_PK, "SHLI",   20 },
+        { OP_SHRI_PK, "SHRI",   20 }, { OP_LOADB,   "LOAD",   21 },
+        { OP_ALLOC,   "ALLOC",  2 },  { OP_FREE,    "FREE",   1 },
+        { OP_RESET,   "RESET",  0 },
+        { OP_MOV_PK_NF,  "MOV.NF",  18 }, { OP_LDB_PK_NF,  "LDB.NF",  18 },
+        { OP_ADD_PK_NF,  "ADD.NF",  19 }, { OP_SUB_PK_NF,  "SUB.NF",  19 },
+        { OP_MUL_PK_NF,  "MUL.NF",  19 }, { OP_DIV_PK_NF,  "DIV.NF",  19 },
+        { OP_AND_PK_NF,  "AND.NF",  19 }, { OP_OR_PK_NF,   "OR.NF",   19 },
+        { OP_XOR_PK_NF,  "XOR.NF",  19 }, { OP_SHL_PK_NF,  "SHL.NF",  19 },
+        { OP_SHR_PK_NF,  "SHR.NF",  19 }, { OP_ADDI_PK_NF, "ADDI.NF", 20 },
+        { OP_XORI_PK_NF, "XORI.NF", 20 }, { OP_ORI_PK_NF,  "ORI.NF",  20 },
+        { OP_SHLI_PK_NF, "SHLI.NF", 20 }, { OP_SHRI_PK_NF, "SHRI.NF", 20 },
+        { OP_LOADB_NF,   "LOAD.NF", 21 },
+        { OP_JMP_S,   "JMP.S",  22 }, { OP_JE_S,    "JE.S",   22 },
+        { OP_JNE_S,   "JNE.S",  22 }, { OP_JG_S,    "JG.S",   22 },
+        { OP_JGE_S,   "JGE.S",  22 }, { OP_JL_S,    "JL.S",   22 },
+        { OP_JLE_S,   "JLE.S",  22 }, { OP_DJNZ_S,  "DJNZ.S", 23 },
+        { OP_BEQ_S,   "BEQ.S",  24 }, { OP_BNE_S,   "BNE.S",  24 },
+        { OP_BLT_S,   "BLT.S",  24 }, { OP_BLE_S,   "BLE.S",  24 },
+        { OP_BGT_S,   "BGT.S",  24 }, { OP_BGE_S,   "BGE.S",  24 },
+        { OP_BEQI_S,  "BEQI.S", 25 }, { OP_BNEI_S,  "BNEI.S", 25 },
+        { OP_BLTI_S,  "BLTI.S", 25 }, { OP_BLEI_S,  "BLEI.S", 25 },
+        { OP_BGTI_S,  "BGTI.S", 25 }, { OP_BGEI_S,  "BGEI.S", 25 },
     };
     static const int table_size = sizeof(table) / sizeof(table[0]);
 
@@ -61,6 +143,7 @@ COLD_REGION void disass_vasm(Assembler *asm_ctx) {
         const char *_n = NULL;                                      \
         for (int _i = 0; _i < asm_ctx->label_count; _i++)           \
             if (!asm_ctx->labels[_i].is_data &&                     \
+                asm_ctx->labels[_i].defined &&                      \
                 asm_ctx->labels[_i].address == (int)(addr))         \
                 { _n = asm_ctx->labels[_i].name; break; }           \
         _n; })
@@ -98,7 +181,12 @@ COLD_REGION void disass_vasm(Assembler *asm_ctx) {
         uint8_t b = (pc + 1 < size) ? code[pc + 1] : 0;
         uint8_t c = (pc + 2 < size) ? code[pc + 2] : 0;
 
-        char operands[64] = "";
+        char operands[80] = ""; /* room for "R255, " and a full label name */
+        int32_t wide = 0; /* imm32 after one (fmt 12) or two (fmt 11) registers */
+        if (d->fmt == 11 || d->fmt == 12)
+            for (int i = d->fmt == 11 ? 2 : 1, k = 0; k < 4; i++, k++)
+                wide = (int32_t)((uint32_t)wide << 8 | (pc + i < size ? code[pc + i] : 0));
+
         switch (d->fmt) {
             case 0: break;
             case 1: snprintf(operands, sizeof(operands), "R%d", a); pc += 1; break;
@@ -123,6 +211,57 @@ COLD_REGION void disass_vasm(Assembler *asm_ctx) {
                 break;
             }
             case 8: snprintf(operands, sizeof(operands), "0x%02X, %d", a, b); pc += 2; break;
+            case 10: {
+                uint16_t target = ((uint16_t)b << 8) | c;
+                const char *t = label_at(target);
+                if (t) snprintf(operands, sizeof(operands), "R%d, %s", a, t);
+                else snprintf(operands, sizeof(operands), "R%d, 0x%04X", a, target);
+                pc += 3;
+                break;
+            }
+            case 11: snprintf(operands, sizeof(operands), "R%d, R%d, %d", a, b, wide); pc += 6; break;
+            case 12: snprintf(operands, sizeof(operands), "R%d, %d", a, wide); pc += 5; break;
+            case 13: snprintf(operands, sizeof(operands), "R%d, [R%d+R%d]", a, b, c); pc += 3; break;
+            case 14: snprintf(operands, sizeof(operands), "R%d, [R%d+%d]", a, b, c); pc += 3; break;
+            case 15: snprintf(operands, sizeof(operands), "R%d, [R%d]+", a, b); pc += 2; break;
+            case 16:
+            case 17: {
+                uint16_t target = ((uint16_t)c << 8) | (pc + 3 < size ? code[pc + 3] : 0);
+                const char *t = label_at(target);
+                int n = snprintf(operands, sizeof(operands), d->fmt == 16 ? "R%d, R%d, " : "R%d, %d, ", a,
+                                 d->fmt == 16 ? (int)b : (int8_t)b);
+                if (t) snprintf(operands + n, sizeof(operands) - n, "%s", t);
+                else snprintf(operands + n, sizeof(operands) - n, "0x%04X", target);
+                pc += 4;
+                break;
+            }
+            case 18: snprintf(operands, sizeof(operands), "R%d, R%d", a >> 4, a & 0x0F); pc += 1; break;
+            case 19: snprintf(operands, sizeof(operands), "R%d, R%d, R%d", a >> 4, a & 0x0F, b); pc += 2; break;
+            case 20: snprintf(operands, sizeof(operands), "R%d, R%d, %d", a >> 4, a & 0x0F, (int8_t)b); pc += 2; break;
+            case 21: snprintf(operands, sizeof(operands), "R%d, %d", a, b); pc += 2; break;
+            case 22:
+            case 23:
+            case 24:
+            case 25: {
+                int n = 0, len = d->fmt == 22 ? 1 : d->fmt == 25 ? 3 : 2;
+                int8_t rel = (int8_t)(len == 1 ? a : len == 2 ? b : c); /* from the end of the instruction */
+                uint16_t target = (uint16_t)(pc + len + rel);
+                const char *t = label_at(target);
+                if (d->fmt == 23) n = snprintf(operands, sizeof(operands), "R%d, ", a);
+                if (d->fmt == 24) n = snprintf(operands, sizeof(operands), "R%d, R%d, ", a >> 4, a & 0x0F);
+                if (d->fmt == 25) n = snprintf(operands, sizeof(operands), "R%d, %d, ", a, (int8_t)b);
+                if (t) snprintf(operands + n, sizeof(operands) - n, "%s", t);
+                else snprintf(operands + n, sizeof(operands) - n, "0x%04X", target);
+                pc += len;
+                break;
+            }
+            case 9: {
+                const char *n = native_name(asm_ctx, a);
+                if (n) snprintf(operands, sizeof(operands), "%s", n);
+                else snprintf(operands, sizeof(operands), "%d", a);
+                pc += 1;
+                break;
+            }
         }
 
         /* raw bytes column */
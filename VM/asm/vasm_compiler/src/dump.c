@@ -6,12 +6,21 @@
 
 COLD_REGION void help_print(char *argv[]) {
     printf("Usage: %s <input_file.vasm> <output_file.bin> <-flag>\n", argv[0]);
+    printf("       %s - <output_file.bin> <-flag>   (source from standard input)\n", argv[0]);
+    printf("       %s <a.vasm|a.vobj> <b.vasm|b.vobj>... <output_file.bin> <-flag>   (build and link)\n", argv[0]);
+    printf("       %s <a.vasm>... -c   (objects only: a.vobj ...)\n", argv[0]);
     printf("Flags:\n");
     printf("  -v, --vasm        Disassemble input file\n");
     printf("  -d, --debug       Dump generated bytecode in hex format\n");
     printf("  -l, --labels      Dump collected labels and their addresses\n");
     printf("  -s, --silent      Silent mode (no compilation output)\n");
     printf("  -D, --data        Dump .data section contents\n");
+    printf("  -r, --raw         Write a raw image instead of a VBIN container\n");
+    printf("  -O, --optimize    Optimizer (leaf inlining, jump threading, dead stores, constant folding)\n");
+    printf("  -P, --profile F   -O, and lay out code by the counts in F (from vm --profile)\n");
+    printf("  -z, --dense       -O, and use the dense forms: packed registers, short jumps, 8-bit LOAD\n");
+    printf("  -c, --compile     Write an object file per source instead of linking\n");
+    printf("  -jN               Assemble up to N sources at once (default: one per core)\n");
     printf("  -h, --help        Show this help message\n");
 }
 
@@ -34,7 +43,8 @@ COLD_REGION void dump_labels(Assembler *asm_ctx) {
     printf("Data labels:\n");
     for (int i = 0; i < asm_ctx->label_count; i++) {
         if (asm_ctx->labels[i].is_data)
-            printf("  %s -> 0x%04X (data)\n", asm_ctx->labels[i].name, asm_ctx->labels[i].address);
+            printf("  %s -> 0x%04X (%s)\n", asm_ctx->labels[i].name, asm_ctx->labels[i].address,
+                   asm_ctx->labels[i].is_data == LABEL_BSS ? "bss" : "data");
     }
 }
 
@@ -55,10 +55,14 @@ COLD_REGION void error_push(ErrorContext *ctx, ErrorCode code, Severity severity
     err->col  = col;
     err->severity = severity;
 
-    if (source_line)
-        strncpy(err->source_line, source_line, sizeof(err->source_line) - 1);
-    else
-        err->source_line[0] = '\0';
+    /* source_line points into the source buffer: copy up to the end of the line */
+    int n = 0;
+    while (source_line && n < (int)sizeof(err->source_line) - 1 &&
+           source_line[n] && source_line[n] != '\n' && source_line[n] != '\r') {
+        err->source_line[n] = source_line[n];
+        n++;
+    }
+    err->source_line[n] = '\0';
 
     va_list args;
     va_start(args, fmt);
@@ -71,8 +75,8 @@ COLD_REGION void error_push(ErrorContext *ctx, ErrorCode code, Severity severity
     if (UNLIKELY(severity == SEVERITY_FATAL)) {
         ctx->has_fatal = 1;
         fprintf(stderr, COLOR_RED "[FATAL]" COLOR_RESET " line %d: %s\n", line, err->message);
-        if (source_line && source_line[0]) {
-            fprintf(stderr, "  | %s\n", source_line);
+        if (err->source_line[0]) {
+            fprintf(stderr, "  | %s\n", err->source_line);
             if (col > 0) {
                 fprintf(stderr, "  | ");
                 for (int i = 0; i < col - 1; i++) fprintf(stderr, " ");
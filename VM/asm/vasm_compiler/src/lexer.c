@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "../include/common.h"
+#include "../include/lexer.h"
+
+/*
+ * The source is mapped (or read) once and lexed in place: tokens are spans
+ * into the buffer, so a line costs one scan over its characters and nothing
+ * is copied, terminated or trimmed.
+ */
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define VASM_MMAP
+#endif
+
+/* -------- SOURCE -------- */
+
+/* the text always ends in a NUL so the lexer may look one character ahead; "-" reads stdin */
+COLD_REGION int source_open(Source *src, const char *path) {
+    memset(src, 0, sizeof(*src));
+    int from_stdin = strcmp(path, "-") == 0;
+
+#ifdef VASM_MMAP
+    int fd = from_stdin ? -1 : open(path, O_RDONLY);
+    struct stat st;
+    long page = sysconf(_SC_PAGESIZE);
+    if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 &&
+        page > 0 && st.st_size % page != 0) {
+        /* the rest of the last page reads as zero: that is the NUL */
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            close(fd);
+            src->text = map;
+            src->size = st.st_size;
+            src->mapped = st.st_size;
+            return 0;
+        }
+    }
+    if (fd >= 0) close(fd);
+#endif
+
+    /* pipes, terminals and files mmap cannot take: read to the end */
+    FILE *file = from_stdin ? stdin : fopen(path, "rb");
+    if (!file) return -1;
+    size_t cap = 1 << 16, size = 0, got;
+    char *text = malloc(cap + 1);
+    while (text && (got = fread(text + size, 1, cap - size, file)) > 0) {
+        size += got;
+        if (size == cap) {
+            char *grown = realloc(text, 2 * cap + 1);
+            if (!grown) {
+                free(text);
+                text = NULL;
+                break;
+            }
+            text = grown;
+            cap *= 2;
+        }
+    }
+    if (!from_stdin) fclose(file);
+    if (!text) return -1;
+    text[size] = '\0';
+    src->text = text;
+    src->size = size;
+    return 0;
+}
+
+COLD_REGION void source_close(Source *src) {
+#ifdef VASM_MMAP
+    if (src->mapped) munmap((void *)src->text, src->mapped);
+    else free((void *)src->text);
+#else
+    free((void *)src->text);
+#endif
+    src->text = NULL;
+}
+
+/* -------- LEXER -------- */
+
+enum { C_OTHER, C_SPACE, C_NEWLINE, C_IDENT, C_DIGIT, C_END };
+
+static uint8_t char_class[256];
+
+static COLD_REGION void init_classes(void) {
+    for (int c = 'A'; c <= 'Z'; c++) char_class[c] = char_class[c + 32] = C_IDENT;
+    for (int c = '0'; c <= '9'; c++) char_class[c] = C_DIGIT;
+    char_class['_'] = C_IDENT;
+    char_class[' '] = char_class['\t'] = char_class['\r'] = char_class['\v'] = char_class['\f'] = C_SPACE;
+    char_class['\n'] = C_NEWLINE;
+    char_class['\0'] = C_END;
+}
+
+void lexer_init(Lexer *lx, const Source *src) {
+    if (!char_class['a']) init_classes();
+    lx->pos = src->text;
+    lx->end = src->text + src->size;
+    lx->line_start = src->text;
+    lx->line = 0;
+    lx->next_line = 1;
+}
+
+static FORCE_INLINE int is_word(uint8_t c) {
+    return char_class[c] == C_IDENT || char_class[c] == C_DIGIT;
+}
+
+/*
+ * Tokens of the next line that has any; comments and blank lines are
+ * skipped. Returns how many tokens the line has, of which the first max
+ * are stored, and 0 at the end of the source.
+ */
+HOT_REGION int lex_line(Lexer *lx, Token *tok, int max) {
+    const char *p = lx->pos;
+    const char *line_start = p;
+    int line = lx->next_line;
+    int count = 0;
+
+    for (;;) {
+        while (char_class[(uint8_t)*p] == C_SPACE) p++;
+
+        const char *start = p;
+        TokenKind kind;
+        switch (char_class[(uint8_t)*p]) {
+            case C_NEWLINE:
+                p++;
+                if (count > 0) {
+                    lx->next_line = line + 1;
+                    goto done;
+                }
+                line++;
+                line_start = p;
+                continue;
+            case C_END:
+                if (p >= lx->end) {
+                    lx->next_line = line;
+                    goto done;
+                }
+                p++; /* a NUL inside the file is just another character */
+                kind = TOK_OTHER;
+                break;
+            case C_IDENT:
+                while (is_word((uint8_t)*p)) p++;
+                kind = TOK_IDENT;
+                break;
+            case C_DIGIT:
+                while (is_word((uint8_t)*p)) p++;
+                kind = TOK_NUMBER;
+                break;
+            default:
+                switch (*p) {
+                    case ';':
+                        while (*p != '\n' && p < lx->end) p++;
+                        continue;
+                    case ',': p++; kind = TOK_COMMA; break;
+                    case ':': p++; kind = TOK_COLON; break;
+                    case '.':
+                        p++;
+                        while (is_word((uint8_t)*p)) p++;
+                        kind = p - start > 1 ? TOK_DIRECTIVE : TOK_OTHER;
+                        break;
+                    case '-':
+                        p++;
+                        if (char_class[(uint8_t)*p] == C_DIGIT) {
+                            while (is_word((uint8_t)*p)) p++;
+                            kind = TOK_NUMBER;
+                        } else {
+                            kind = TOK_OTHER;
+                        }
+                        break;
+                    case '"':
+                        /* to the closing quote or the end of the line; \" does not close */
+                        p++;
+                        while (*p != '"' && *p != '\n' && p < lx->end)
+                            p += (*p == '\\' && p[1] != '\n' && p + 1 < lx->end) ? 2 : 1;
+                        if (*p == '"') p++;
+                        kind = TOK_STRING;
+                        break;
+                    default:
+                        p++;
+                        kind = TOK_OTHER;
+                        break;
+                }
+                break;
+        }
+
+        if (count < max) {
+            tok[count].start = start;
+            tok[count].len = (int)(p - start);
+            tok[count].col = (int)(start - line_start) + 1;
+            tok[count].kind = kind;
+        }
+        count++;
+    }
+
+done:
+    lx->pos = p;
+    lx->line = line;
+    lx->line_start = line_start;
+    return count;
+}
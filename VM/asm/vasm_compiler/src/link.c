@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/common.h"
+#include "../include/types.h"
+#include "../include/error.h"
+#include "../include/assembler.h"
+#include "../include/vobj.h"
+#include "../include/link.h"
+
+/*
+ * Objects are laid out in command-line order: the code of every object,
+ * then every .data, then every .bss. The result is an Assembler as if one
+ * source had been assembled, with section offsets and fixups moved by the
+ * object's base, so link_labels(), -O and the VBIN writer work on it as
+ * they do on a single file.
+ *
+ * Local labels of different objects may share a name: only .global labels
+ * are put in the name table, and .extern references are resolved through it.
+ */
+
+typedef struct {
+    Object obj;
+    int *map;           /* object label -> asm_ctx label, -1 unresolved */
+    uint16_t code_base;
+    uint16_t data_base;
+    uint16_t bss_base;
+} Module;
+
+/* reads every object and copies its code and data behind the previous ones */
+static COLD_REGION int load_modules(Assembler *asm_ctx, ErrorContext *err_ctx, Module *mods, char *const paths[],
+                                    int count) {
+    for (int k = 0; k < count; k++) {
+        Module *m = &mods[k];
+        int result = read_object(&m->obj, paths[k]);
+        if (UNLIKELY(result != 0)) {
+            error_push(err_ctx, result == -1 ? ERR_FILE_OPEN : ERR_OBJECT_INVALID, SEVERITY_ERROR, 0, 0, NULL,
+                       result == -1 ? "could not read object '%s'" : "'%s' is not a valid vasm object", paths[k]);
+            continue;
+        }
+        if (UNLIKELY(asm_ctx->bytecode_pos + m->obj.code_size > MAX_BYTECODE ||
+                     asm_ctx->data_pos + m->obj.data_size > MAX_DATA_SECTION ||
+                     asm_ctx->bss_size + m->obj.bss_size > MAX_BYTECODE)) {
+            error_push(err_ctx, ERR_BYTECODE_OVERFLOW, SEVERITY_ERROR, 0, 0, NULL,
+                       "linked program too large at '%s' (code max %d bytes, data max %d bytes)",
+                       paths[k], MAX_BYTECODE, MAX_DATA_SECTION);
+            return -1;
+        }
+        m->map = malloc((m->obj.label_count + 1) * sizeof(int));
+        if (UNLIKELY(!m->map)) {
+            error_push(err_ctx, ERR_LABEL_TOO_MANY, SEVERITY_FATAL, 0, 0, NULL, "out of memory linking '%s'", paths[k]);
+            return -1;
+        }
+
+        m->code_base = asm_ctx->bytecode_pos;
+        m->data_base = asm_ctx->data_pos;
+        m->bss_base = asm_ctx->bss_size;
+        memcpy(asm_ctx->bytecode + m->code_base, m->obj.code, m->obj.code_size);
+        memcpy(asm_ctx->data_section + m->data_base, m->obj.data, m->obj.data_size);
+        asm_ctx->bytecode_pos += m->obj.code_size;
+        asm_ctx->data_pos += m->obj.data_size;
+        asm_ctx->bss_size += m->obj.bss_size;
+    }
+    return error_has_errors(err_ctx) ? -1 : 0;
+}
+
+/* defined labels, moved by their section's base; a second definition of a global is an error */
+static COLD_REGION void add_definitions(Assembler *asm_ctx, ErrorContext *err_ctx, Module *m, const char **owner) {
+    const uint8_t *p = m->obj.labels;
+    for (uint32_t i = 0; i < m->obj.label_count; p += 6 + p[5], i++) {
+        m->map[i] = -1;
+        if (!p[4]) continue;
+
+        Label lbl = {0};
+        memcpy(lbl.name, p + 6, p[5]);
+        lbl.is_data = p[2];
+        lbl.scope = p[3] == SCOPE_GLOBAL ? SCOPE_GLOBAL : SCOPE_LOCAL;
+        lbl.defined = 1;
+        lbl.address = vobj_get16(p) + (lbl.is_data == LABEL_CODE ? m->code_base :
+                                       lbl.is_data == LABEL_DATA ? m->data_base : m->bss_base);
+
+        int g = lbl.scope == SCOPE_GLOBAL ? find_label(asm_ctx, lbl.name, p[5]) : -1;
+        if (UNLIKELY(g >= 0)) {
+            error_push(err_ctx, ERR_LABEL_DUPLICATE, SEVERITY_ERROR, 0, 0, NULL,
+                       "global label '%s' is defined in both '%s' and '%s'", lbl.name, owner[g], m->obj.path);
+            m->map[i] = g; /* references still resolve, to the first one */
+            continue;
+        }
+        m->map[i] = append_label(asm_ctx, &lbl);
+        if (UNLIKELY(m->map[i] < 0))
+            error_push(err_ctx, ERR_LABEL_TOO_MANY, SEVERITY_FATAL, 0, 0, NULL, "out of memory for labels");
+        owner[m->map[i]] = m->obj.path;
+    }
+}
+
+/* references to labels of other objects, through the global names */
+static COLD_REGION void resolve_externs(Assembler *asm_ctx, Module *m) {
+    const uint8_t *p = m->obj.labels;
+    for (uint32_t i = 0; i < m->obj.label_count; p += 6 + p[5], i++) {
+        if (!p[4]) m->map[i] = find_label(asm_ctx, (const char *)p + 6, p[5]);
+    }
+}
+
+/* label operands move by the code base (.table entries by the data base) and refer to the merged labels */
+static COLD_REGION void add_fixups(Assembler *asm_ctx, ErrorContext *err_ctx, Module *m) {
+    for (uint32_t i = 0; i < m->obj.fixup_count; i++) {
+        const uint8_t *p = m->obj.fixups + i * VOBJ_FIXUP_SIZE;
+        uint32_t label = vobj_get32(p);
+        int line = vobj_get16(p + 7), col = vobj_get16(p + 9);
+
+        if (UNLIKELY(m->map[label] < 0)) {
+            const uint8_t *name = m->obj.labels;
+            for (uint32_t l = 0; l < label; l++) name += 6 + name[5];
+            error_push(err_ctx, ERR_LABEL_NOT_FOUND, SEVERITY_ERROR, line, col, NULL,
+                       "label '%.*s' used in '%s' is not defined by any object", name[5], name + 6, m->obj.path);
+            continue;
+        }
+
+        Fixup *f = &asm_ctx->fixups[asm_ctx->fixup_count++];
+        f->label = m->map[label];
+        f->at = vobj_get16(p + 4) + (p[6] == FIX_TABLE ? m->data_base : m->code_base);
+        f->kind = p[6];
+        f->line = line;
+        f->col = col;
+        f->source = NULL;
+    }
+}
+
+/* the instruction list behind the line table and -O */
+static COLD_REGION void add_instructions(Assembler *asm_ctx, Module *m) {
+    for (uint32_t i = 0; i < m->obj.instr_count; i++) {
+        const uint8_t *p = m->obj.instrs + i * VOBJ_INSTR_SIZE;
+        uint32_t label = vobj_get32(p + 5);
+
+        Instr *in = &asm_ctx->ir[asm_ctx->ir_count++];
+        in->opcode = p[0];
+        in->address = vobj_get16(p + 1) + m->code_base;
+        in->line = vobj_get16(p + 3);
+        in->label = label == VOBJ_NO_LABEL ? -1 : m->map[label];
+
+        LineEntry *entry = &asm_ctx->lines[asm_ctx->line_count++];
+        entry->address = in->address;
+        entry->line = in->line;
+    }
+}
+
+/* merges the objects into asm_ctx (zeroed) and links them; -1 if anything went wrong */
+COLD_REGION int link_objects(Assembler *asm_ctx, ErrorContext *err_ctx, char *const paths[], int count) {
+    Module *mods = calloc(count, sizeof(Module));
+    if (UNLIKELY(!mods)) return -1;
+    asm_ctx->linking = 1;
+
+    if (load_modules(asm_ctx, err_ctx, mods, paths, count) == 0) {
+        uint32_t label_count = 0, fixup_count = 0;
+        for (int k = 0; k < count; k++) {
+            label_count += mods[k].obj.label_count;
+            fixup_count += mods[k].obj.fixup_count;
+        }
+        const char **owner = malloc((label_count + 1) * sizeof(const char *)); /* object of each merged label */
+        asm_ctx->fixups = malloc((fixup_count + 1) * sizeof(Fixup));
+        asm_ctx->fixup_capacity = fixup_count;
+        if (UNLIKELY(!owner || !asm_ctx->fixups))
+            error_push(err_ctx, ERR_LABEL_TOO_MANY, SEVERITY_FATAL, 0, 0, NULL, "out of memory for %u labels", label_count);
+
+        for (int k = 0; k < count; k++) add_definitions(asm_ctx, err_ctx, &mods[k], owner);
+        for (int k = 0; k < count; k++) resolve_externs(asm_ctx, &mods[k]);
+
+        const char *entry_owner = NULL;
+        for (int k = 0; k < count; k++) {
+            Module *m = &mods[k];
+            add_fixups(asm_ctx, err_ctx, m);
+            add_instructions(asm_ctx, m);
+            if (!(m->obj.flags & VOBJ_HAS_ENTRY)) continue;
+            if (UNLIKELY(entry_owner))
+                error_push(err_ctx, ERR_LABEL_DUPLICATE, SEVERITY_ERROR, 0, 0, NULL,
+                           "'.entry' is set in both '%s' and '%s'", entry_owner, m->obj.path);
+            entry_owner = m->obj.path;
+            asm_ctx->entry = m->code_base + m->obj.entry; /* a FIX_ENTRY fixup overrides it */
+            asm_ctx->entry_set = 1;
+        }
+        free(owner);
+
+        if (LIKELY(!error_has_errors(err_ctx))) link_labels(asm_ctx, err_ctx);
+    }
+
+    for (int k = 0; k < count; k++) {
+        free_object(&mods[k].obj);
+        free(mods[k].map);
+    }
+    free(mods);
+    return error_has_errors(err_ctx) ? -1 : 0;
+}
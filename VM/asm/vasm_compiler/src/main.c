@@ -6,124 +6,186 @@
 #include "../include/types.h"
 #include "../include/error.h"
 #include "../include/assembler.h"
+#include "../include/lexer.h"
 #include "../include/disasm.h"
 #include "../include/dump.h"
+#include "../include/vbin.h"
+#include "../include/optimize.h"
+#include "../include/build.h"
+#include "../include/link.h"
+
+/* a.vasm -> a.vobj, next to the source */
+static char *object_path(const char *source_path) {
+    size_t len = strlen(source_path);
+    char *path = malloc(len + 1);
+    if (path) {
+        memcpy(path, source_path, len - 5);
+        strcpy(path + len - 5, ".vobj");
+    }
+    return path;
+}
+
+static int has_extension(const char *path, const char *ext) {
+    size_t len = strlen(path), ext_len = strlen(ext);
+    return len > ext_len && strcmp(path + len - ext_len, ext) == 0;
+}
+
+static COLD_REGION int usage(char *argv[]) {
+    printf("Usage: %s <input_file.vasm> <output_file.bin> <-flag>\n", argv[0]);
+    return 1;
+}
+
+/* -c: every source to its object, or the one source to the named object */
+static COLD_REGION int compile_only(char *inputs[], int count, const char *output, const InputArguments *args) {
+    if (output) return compile_object(inputs[0], output, args->silent);
+
+    char **objects = calloc(count, sizeof(char *));
+    int result = objects ? 0 : -1;
+    for (int i = 0; i < count && result == 0; i++)
+        if (!(objects[i] = object_path(inputs[i]))) result = -1;
+    if (result == 0) result = build_objects(inputs, objects, count, args->jobs, 1, args->silent);
+
+    for (int i = 0; objects && i < count; i++) free(objects[i]);
+    free(objects);
+    return result == 0 ? 0 : 1;
+}
+
+/* sources are brought up to date as objects, then every object is linked */
+static COLD_REGION int build_and_link(Assembler *asm_ctx, ErrorContext *err_ctx, char *inputs[], int count,
+                                      const InputArguments *args) {
+    char **objects = calloc(count, sizeof(char *));
+    char **sources = calloc(count, sizeof(char *));
+    char **source_objects = calloc(count, sizeof(char *));
+    int source_count = 0, result = objects && sources && source_objects ? 0 : -1;
+
+    for (int i = 0; i < count && result == 0; i++) {
+        if (has_extension(inputs[i], ".vobj")) {
+            objects[i] = inputs[i];
+            continue;
+        }
+        if (!(objects[i] = object_path(inputs[i]))) result = -1;
+        sources[source_count] = inputs[i];
+        source_objects[source_count++] = objects[i];
+    }
+    if (result == 0 && source_count > 0)
+        result = build_objects(sources, source_objects, source_count, args->jobs, 0, args->silent);
 
-HOT_REGION int main(int argc, char *argv[]) {
-    InputArguments input_args = {0};
-
-    if (UNLIKELY(argc < 2)) {
-        printf("Usage: %s <input_file.vasm> <output_file.bin> <-flag>\n", argv[0]);
-        return 1;
+    if (result == 0) {
+        if (LIKELY(!args->silent)) printf("Linking %d object%s...\n", count, count == 1 ? "" : "s");
+        result = link_objects(asm_ctx, err_ctx, objects, count);
     }
 
-    /* parse flags */
-    for (int i = 2; i < argc; i++) {
-        if (!strcmp(argv[i], "-d") || !strcmp(argv[i], "--debug"))  input_args.debug_mode = 1;
+    for (int i = 0; i < source_count; i++) free(source_objects[i]);
+    free(source_objects);
+    free(sources);
+    free(objects);
+    return result;
+}
+
+HOT_REGION int main(int argc, char *argv[]) {
+    InputArguments input_args = {0};
+    input_args.jobs = default_jobs();
+
+    /* parse flags; everything else is a file, "-" included */
+    char **paths = malloc(argc * sizeof(char *));
+    int path_count = 0;
+    if (UNLIKELY(!paths)) return 1;
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] != '-' || argv[i][1] == '\0') paths[path_count++] = argv[i];
+        else if (!strcmp(argv[i], "-d") || !strcmp(argv[i], "--debug"))  input_args.debug_mode = 1;
         else if (!strcmp(argv[i], "-v") || !strcmp(argv[i], "--vasm")) input_args.disass = 1;
         else if (!strcmp(argv[i], "-l") || !strcmp(argv[i], "--labels")) input_args.dump_labels = 1;
         else if (!strcmp(argv[i], "-s") || !strcmp(argv[i], "--silent")) input_args.silent = 1;
         else if (!strcmp(argv[i], "-D") || !strcmp(argv[i], "--data")) input_args.dump_data = 1;
+        else if (!strcmp(argv[i], "-r") || !strcmp(argv[i], "--raw"))  input_args.raw = 1;
+        else if (!strcmp(argv[i], "-O") || !strcmp(argv[i], "--optimize")) input_args.optimize = 1;
+        else if ((!strcmp(argv[i], "-P") || !strcmp(argv[i], "--profile")) && i + 1 < argc) {
+            input_args.profile = argv[++i];
+            input_args.optimize = 1;
+        }
+        else if (!strcmp(argv[i], "-z") || !strcmp(argv[i], "--dense")) {
+            input_args.dense = 1;
+            input_args.optimize = 1;
+        }
+        else if (!strcmp(argv[i], "-c") || !strcmp(argv[i], "--compile")) input_args.object = 1;
+        else if (!strncmp(argv[i], "-j", 2) && atoi(argv[i] + 2) > 0) input_args.jobs = atoi(argv[i] + 2);
         else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) { help_print(argv); return 0; }
     }
 
     ErrorContext err_ctx = {0};
 
-    if (UNLIKELY(!input_args.disass && argc < 3)) {
-        printf("Usage: %s <input_file.vasm> <output_file.bin> <-flag>\n", argv[0]);
-        return 1;
-    }
+    /* the last file is the output: a .bin, a .vobj with -c, none with -v */
+    const char *output = NULL;
+    if (path_count > 1 && (!(input_args.object || input_args.disass) ||
+                           has_extension(paths[path_count - 1], input_args.object ? ".vobj" : ".bin")))
+        output = paths[--path_count];
+    if (UNLIKELY(path_count == 0 || (!output && !input_args.disass && !input_args.object)))
+        return usage(argv);
 
     /* validate file extensions */
-    size_t len_vasm = strlen(argv[1]);
-    if (UNLIKELY(len_vasm < 5 || strcmp(argv[1] + len_vasm - 5, ".vasm") != 0)) {
-        error_push(&err_ctx, ERR_FILE_OPEN, SEVERITY_FATAL, 0, 0, NULL,
-                   "input file must have .vasm extension");
-        return 1;
-    }
-
-    if (!input_args.disass) {
-        size_t len_bin = strlen(argv[2]);
-        if (UNLIKELY(len_bin < 4 || strcmp(argv[2] + len_bin - 4, ".bin") != 0)) {
+    int objects_in = 0;
+    for (int i = 0; i < path_count; i++) {
+        if (has_extension(paths[i], ".vobj") && !input_args.object) {
+            objects_in++;
+            continue;
+        }
+        if (UNLIKELY(strcmp(paths[i], "-") == 0 ? path_count > 1 : !has_extension(paths[i], ".vasm"))) {
             error_push(&err_ctx, ERR_FILE_OPEN, SEVERITY_FATAL, 0, 0, NULL,
-                       "output file must have .bin extension");
+                       strcmp(paths[i], "-") == 0 ? "standard input can only be assembled on its own"
+                                                  : "input file must have .vasm extension");
             return 1;
         }
     }
-
-    Assembler asm_ctx = {0};
-    asm_ctx.data_start_addr = 0x0100;
-
-    FILE *input = fopen(argv[1], "r");
-    if (UNLIKELY(!input)) {
+    if (UNLIKELY(output && !input_args.object && !has_extension(output, ".bin"))) {
         error_push(&err_ctx, ERR_FILE_OPEN, SEVERITY_FATAL, 0, 0, NULL,
-                   "could not open file '%s'", argv[1]);
+                   "output file must have .bin extension");
         return 1;
     }
-
-    char line[MAX_LINE_LENGTH];
-
-    /* ---- pass 1: collect labels ---- */
-    if (LIKELY(!input_args.silent))
-        printf("First pass - collecting labels...\n");
-
-    asm_ctx.current_line = 0;
-    while (LIKELY(fgets(line, sizeof(line), input))) {
-        asm_ctx.current_line++;
-        trim_line(line);
-        strncpy(asm_ctx.current_source, line, sizeof(asm_ctx.current_source) - 1);
-        asm_ctx.current_source[sizeof(asm_ctx.current_source) - 1] = '\0';
-
-        if (UNLIKELY(strncmp(line, ".data", 5) == 0) ||
-            UNLIKELY(strncmp(line, ".text", 5) == 0) ||
-            UNLIKELY(asm_ctx.in_data_section)) {
-            parse_data_directive(&asm_ctx, &err_ctx, line);
-            continue;
-        }
-
-        parse_instruction(&asm_ctx, &err_ctx, line, 1);
+    if (UNLIKELY(input_args.object && ((output && path_count > 1) || (!output && strcmp(paths[0], "-") == 0)))) {
+        error_push(&err_ctx, ERR_FILE_OPEN, SEVERITY_FATAL, 0, 0, NULL, output
+                   ? "a named object file takes exactly one source"
+                   : "standard input needs a named object file: - <output_file.vobj> -c");
+        return 1;
     }
 
-    /* recalculate .data label addresses after pass 1 */
-    asm_ctx.data_start_addr = asm_ctx.bytecode_pos;
-    for (int i = 0; i < asm_ctx.label_count; i++) {
-        if (UNLIKELY(asm_ctx.labels[i].is_data)) {
-            int offset = asm_ctx.labels[i].address - 0x0100;
-            asm_ctx.labels[i].address = asm_ctx.data_start_addr + offset;
-        }
+    if (input_args.object) {
+        int result = compile_only(paths, path_count, output, &input_args);
+        free(paths);
+        return result;
     }
 
-    /* ---- pass 2: emit bytecode ---- */
-    if (LIKELY(!input_args.silent))
-        printf("Second pass - generating code...\n");
-
-    rewind(input);
-    asm_ctx.bytecode_pos = 0;
-    asm_ctx.in_data_section = 0;
-    asm_ctx.current_line = 0;
-
-    while (LIKELY(fgets(line, sizeof(line), input))) {
-        asm_ctx.current_line++;
-        trim_line(line);
-        strncpy(asm_ctx.current_source, line, sizeof(asm_ctx.current_source) - 1);
-        asm_ctx.current_source[sizeof(asm_ctx.current_source) - 1] = '\0';
-
-        if (UNLIKELY(strncmp(line, ".data", 5) == 0) ||
-            UNLIKELY(strncmp(line, ".text", 5) == 0)) {
-            asm_ctx.in_data_section = (strncmp(line, ".data", 5) == 0);
-            continue;
+    Assembler asm_ctx = {0};
+
+    if (path_count > 1 || objects_in > 0) {
+        int result = build_and_link(&asm_ctx, &err_ctx, paths, path_count, &input_args);
+        if (UNLIKELY(result != 0 && !error_has_errors(&err_ctx))) return 1; /* a source failed, already reported */
+    } else {
+        Source src;
+        if (UNLIKELY(source_open(&src, paths[0]) != 0)) {
+            error_push(&err_ctx, ERR_FILE_OPEN, SEVERITY_FATAL, 0, 0, NULL,
+                       "could not open file '%s'", paths[0]);
+            return 1;
         }
 
-        if (UNLIKELY(asm_ctx.in_data_section)) continue;
+        if (LIKELY(!input_args.silent))
+            printf("Assembling %s...\n", strcmp(paths[0], "-") == 0 ? "standard input" : paths[0]);
 
-        parse_instruction(&asm_ctx, &err_ctx, line, 2);
+        assemble(&asm_ctx, &err_ctx, &src);
+        link_labels(&asm_ctx, &err_ctx);
+
+        /* errors keep their own copy of the line, the source is not needed any more */
+        source_close(&src);
+        asm_ctx.current_source = NULL;
     }
+    free(paths);
 
-    fclose(input);
+    if (input_args.optimize && LIKELY(!error_has_errors(&err_ctx)))
+        optimize(&asm_ctx, &err_ctx, input_args.profile, input_args.dense, input_args.silent);
 
     /* disassemble mode (-v): skip writing binary */
     if (input_args.disass) {
         disass_vasm(&asm_ctx);
+        free_labels(&asm_ctx);
         return 0;
     }
 
@@ -136,33 +198,41 @@ HOT_REGION int main(int argc, char *argv[]) {
         error_dump(&err_ctx);
 
     /* write output */
-    FILE *output = fopen(argv[2], "wb");
-    if (UNLIKELY(!output)) {
+    FILE *file = fopen(output, "wb");
+    if (UNLIKELY(!file)) {
         error_push(&err_ctx, ERR_FILE_OPEN, SEVERITY_FATAL, 0, 0, NULL,
-                   "could not create file '%s'", argv[2]);
+                   "could not create file '%s'", output);
         return 1;
     }
 
-    size_t bytes_written = fwrite(asm_ctx.bytecode, 1, asm_ctx.bytecode_pos, output);
-    if (LIKELY(asm_ctx.data_pos > 0))
-        bytes_written += fwrite(asm_ctx.data_section, 1, asm_ctx.data_pos, output);
-    fclose(output);
+    size_t bytes_written;
+    int total_bytes;
+    if (UNLIKELY(input_args.raw)) {
+        bytes_written = fwrite(asm_ctx.bytecode, 1, asm_ctx.bytecode_pos, file);
+        if (LIKELY(asm_ctx.data_pos > 0))
+            bytes_written += fwrite(asm_ctx.data_section, 1, asm_ctx.data_pos, file);
+        total_bytes = asm_ctx.bytecode_pos + asm_ctx.data_pos;
+    } else {
+        total_bytes = write_vbin(&asm_ctx, file, &bytes_written);
+    }
+    fclose(file);
 
-    int total_bytes = asm_ctx.bytecode_pos + asm_ctx.data_pos;
     if (UNLIKELY(bytes_written != (size_t)total_bytes)) {
         error_push(&err_ctx, ERR_FILE_WRITE, SEVERITY_FATAL, 0, 0, NULL,
                    "incomplete write to '%s' (%zu of %d bytes written)",
-                   argv[2], bytes_written, total_bytes);
+                   output, bytes_written, total_bytes);
         return 1;
     }
 
     if (LIKELY(!input_args.silent))
-        printf(COLOR_GREEN "OK" COLOR_RESET " - %d bytes code, %d bytes data -> %s\n",
-               asm_ctx.bytecode_pos, asm_ctx.data_pos, argv[2]);
+        printf(COLOR_GREEN "OK" COLOR_RESET " - %d bytes code, %d bytes data, %d bytes bss -> %s (%s)\n",
+               asm_ctx.bytecode_pos, asm_ctx.data_pos, asm_ctx.bss_size, output,
+               input_args.raw ? "raw" : "VBIN");
 
     if (UNLIKELY(input_args.dump_labels)) dump_labels(&asm_ctx);
     if (UNLIKELY(input_args.debug_mode)) debug_hex(&asm_ctx);
     if (UNLIKELY(input_args.dump_data)) dump_data_section(&asm_ctx);
 
+    free_labels(&asm_ctx);
     return 0;
 }
\ No newline at end of file
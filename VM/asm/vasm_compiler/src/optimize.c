@@ -0,0 +1,1101 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "../include/common.h"
+#include "../include/types.h"
+#include "../include/opcodes.h"
+#include "../include/error.h"
+#include "../include/assembler.h"
+#include "../include/optimize.h"
+
+/*
+ * -O: rewrites the instructions recorded while assembling (asm_ctx->ir), then lays
+ * the code out again. Operands that came from a label keep pointing at that
+ * label, so code and data labels move with the code.
+ *
+ * Passes, repeated until nothing changes:
+ *   leaf inlining       CALL f of a short routine without calls -> its body
+ *                       (once, before the passes)
+ *   jump threading      Jxx a ... a: JMP b           -> Jxx b
+ *   jump to next        JMP/Jxx to the next instruction is dropped
+ *   unreachable code    what no path from the entry point reaches
+ *   constant folding    LOAD R1, 5 / ADDI R1, R1, 3  -> LOAD R1, 0, 8
+ *   dead stores         instructions whose registers and flags are never read
+ *
+ * Then CMP or CMPI and the flag jump right after it become one
+ * compare-and-branch (CMP R1, R2 / JL a -> BLT R1, R2, a) where nothing reads
+ * the flags afterwards. Last, an instruction whose flags are overwritten
+ * before any jump, call, DBG or HALT reads them gets its flagless opcode
+ * (OP_ADD -> OP_ADD_NF).
+ *
+ * Liveness covers R0-R31 and the flags as one unit: every flag-setting
+ * instruction writes all four flags. CALL, RET, SPAWN, DBG and HALT are
+ * treated as reading everything (an embedder reads the registers and flags
+ * of a halted VM), and so are JMP Rn, CALL Rn and SWITCH, whose targets
+ * are not known here: any code label used as data or listed in a .table.
+ *
+ * With a profile (-P) the basic blocks are then chained hottest successor
+ * first, so the common path falls through; branches are inverted or a JMP
+ * added where a successor no longer follows, and blocks that never ran go
+ * to the end.
+ *
+ * With -z the result is written in the dense forms before the layout:
+ * Rd and Rs of R0-R15 packed in one byte (ADD R1, R2, R3 -> ADD.PK 0x12, R3),
+ * LOAD of a value below 256 with an 8-bit immediate, and jumps whose target
+ * is within a signed byte with a short target. Jumps start short and the
+ * ones out of reach are widened again until the layout no longer moves.
+ */
+
+#define REG_MASK   0xFFFFFFFFull
+#define FLAGS      0x100000000ull
+#define EVERYTHING (REG_MASK | FLAGS)
+#define MAX_PASSES 16
+#define MAX_HOPS   8
+#define INLINE_MAX_BYTES 48     /* largest routine body copied to a call site */
+#define INLINE_BUDGET    256    /* bytes all copies together may add */
+
+typedef uint64_t RegSet; /* bit per register, FLAGS above them */
+#define KEEP       (~(RegSet)0)
+
+typedef struct {
+    int first, last;    /* live instructions */
+    int fall;           /* block reached by falling through, -1 for none */
+    int jump;           /* block the jump at the end goes to, -1 for none */
+    int label;          /* code label at first, -1 until one is needed */
+    uint32_t count;     /* executions, from the profile */
+    int placed;
+} Block;
+
+typedef struct {
+    int *pos;                           /* instruction a code label points to, ir_count = end of code */
+    int next[MAX_BYTECODE + 1];         /* next live instruction at or after i */
+    uint8_t target[MAX_BYTECODE + 1];   /* a code label or the entry point lands here */
+    RegSet live_in[MAX_BYTECODE + 1];
+    RegSet live_out[MAX_BYTECODE + 1];
+    int entry;
+    int work[MAX_BYTECODE + 1];         /* reachability worklist */
+    uint8_t reached[MAX_BYTECODE + 1];
+    uint32_t count[MAX_BYTECODE + 1];   /* executions per instruction, from the profile */
+    int profiled;
+    Instr out[MAX_BYTECODE];            /* rewritten instruction list */
+    uint32_t out_count[MAX_BYTECODE + 1];
+    int new_index[MAX_BYTECODE + 1];    /* instruction -> index in out */
+    int copies;                         /* inlined call sites, numbers the copied labels */
+    int block_of[MAX_BYTECODE + 1];
+    Block blocks[MAX_BYTECODE];
+    int block_count;
+    uint8_t far[MAX_BYTECODE + 1];      /* -z: jump out of reach of its short form */
+} OptState;
+
+/* -------- INSTRUCTION PROPERTIES -------- */
+
+/* conditional jumps on the flags */
+static FORCE_INLINE int is_cond_jump(uint8_t op) {
+    return op == OP_JE || op == OP_JNE || op == OP_JNZ || op == OP_JG ||
+           op == OP_JGE || op == OP_JL || op == OP_JLE;
+}
+
+/* conditional jumps on registers: DJNZ and compare-and-branch */
+static FORCE_INLINE int is_branch(uint8_t op) {
+    return op >= OP_DJNZ && op <= OP_BGEI;
+}
+
+static FORCE_INLINE int is_jump(uint8_t op) {
+    return op == OP_JMP || is_cond_jump(op) || is_branch(op);
+}
+
+static FORCE_INLINE uint8_t jump_condition(uint8_t op) {
+    return op == OP_JNZ ? OP_JNE : op; /* same test in the VM */
+}
+
+/* loads from memory, which may leave Rd alone */
+static FORCE_INLINE int is_load(uint8_t op) {
+    return op == OP_LDB || (op >= OP_LDBX && op <= OP_LDWP);
+}
+
+static FORCE_INLINE RegSet reg_bit(uint8_t reg) {
+    return reg < MAX_REGISTERS ? (RegSet)1 << reg : 0;
+}
+
+/* the 32-bit immediate of a wide form, high byte first from ops[at] */
+static FORCE_INLINE uint32_t wide_imm(const Instr *in, int at) {
+    return (uint32_t)in->ops[at] << 24 | (uint32_t)in->ops[at + 1] << 16 | in->ops[at + 2] << 8 | in->ops[at + 3];
+}
+
+/* registers and flags an instruction reads */
+static RegSet ins_use(const Instr *in) {
+    switch (in->opcode) {
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV:
+        case OP_AND: case OP_OR: case OP_XOR: case OP_SHL: case OP_SHR:
+            return reg_bit(in->ops[1]) | reg_bit(in->ops[2]);
+        case OP_ADDI: case OP_XORI: case OP_ORI: case OP_SHLI: case OP_SHRI:
+        case OP_ADDIW: case OP_XORIW: case OP_ORIW: case OP_MOV: case OP_LDB:
+        case OP_LDBD: case OP_LDBP: case OP_LDWD: case OP_LDWP: case OP_ALLOC:
+            return reg_bit(in->ops[1]);
+        case OP_LDBX: case OP_LDWX:
+            return reg_bit(in->ops[1]) | reg_bit(in->ops[2]);
+        case OP_STBD: case OP_STBP: case OP_STORED: case OP_STOREP:
+            return reg_bit(in->ops[0]) | reg_bit(in->ops[1]);
+        case OP_CMP:
+            return reg_bit(in->ops[0]) | reg_bit(in->ops[1]);
+        case OP_CMPI: case OP_CMPIW: case OP_PUSH: case OP_PRINT: case OP_PRINTC: case OP_PRINTS:
+        case OP_STOREI: case OP_JOIN: case OP_FREE:
+            return reg_bit(in->ops[0]);
+        case OP_STORE: case OP_STBX:
+            return reg_bit(in->ops[0]) | reg_bit(in->ops[1]) | reg_bit(in->ops[2]);
+        case OP_DJNZ: case OP_BEQI: case OP_BNEI: case OP_BLTI: case OP_BLEI: case OP_BGTI: case OP_BGEI:
+            return reg_bit(in->ops[0]);
+        case OP_BEQ: case OP_BNE: case OP_BLT: case OP_BLE: case OP_BGT: case OP_BGE:
+            return reg_bit(in->ops[0]) | reg_bit(in->ops[1]);
+        case OP_NCALL:
+            return REG_MASK;
+        case OP_CALL: case OP_RET: case OP_SPAWN: case OP_DBG: case OP_HALT:
+        case OP_JMPR: case OP_CALLR: case OP_SWITCH:
+            return EVERYTHING; /* callee, caller, new thread, the dump or the host after HALT may read anything */
+        default:
+            return is_cond_jump(in->opcode) ? FLAGS : 0;
+    }
+}
+
+/* registers and flags an instruction always overwrites */
+static RegSet ins_def(const Instr *in) {
+    switch (in->opcode) {
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV:
+        case OP_AND: case OP_OR: case OP_XOR: case OP_SHL: case OP_SHR:
+        case OP_ADDI: case OP_XORI: case OP_ORI: case OP_SHLI: case OP_SHRI:
+        case OP_ADDIW: case OP_XORIW: case OP_ORIW:
+        case OP_MOV: case OP_LOAD: case OP_LOADW: case OP_POP:
+            return reg_bit(in->ops[0]) | FLAGS;
+        case OP_CMP: case OP_CMPI: case OP_CMPIW:
+            return FLAGS;
+        case OP_READ: case OP_READC: case OP_SPAWN: case OP_DJNZ: case OP_ALLOC:
+            return reg_bit(in->ops[0]);
+        case OP_LDBP: case OP_LDWP: case OP_STBP: case OP_STOREP:
+            return reg_bit(in->ops[1]); /* [Ra]+ moves Ra on, Rd as below */
+        default:
+            return 0; /* loads leave Rd alone for an address outside memory */
+    }
+}
+
+/* what an instruction without side effects changes, KEEP if it must stay */
+static RegSet ins_effect(const Instr *in) {
+    uint8_t rd = in->ops[0], rs = in->ops[1];
+    switch (in->opcode) {
+        case OP_NOP:
+            return 0;
+        case OP_MOV:
+            return rd == rs ? FLAGS : reg_bit(rd) | FLAGS;
+        case OP_ADDI: case OP_XORI: case OP_ORI:
+            return rd == rs && in->ops[2] == 0 ? FLAGS : reg_bit(rd) | FLAGS;
+        case OP_ADDIW: case OP_XORIW: case OP_ORIW:
+            return rd == rs && wide_imm(in, 2) == 0 ? FLAGS : reg_bit(rd) | FLAGS;
+        case OP_SHLI: case OP_SHRI:
+            return rd == rs && (in->ops[2] & 0x1F) == 0 ? FLAGS : reg_bit(rd) | FLAGS;
+        case OP_AND: case OP_OR:
+            return rd == rs && rd == in->ops[2] ? FLAGS : reg_bit(rd) | FLAGS;
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_XOR: case OP_SHL: case OP_SHR:
+        case OP_LOAD: case OP_LOADW: case OP_LDB: case OP_LDBX: case OP_LDBD: case OP_LDWX: case OP_LDWD:
+            return reg_bit(rd) | FLAGS;
+        case OP_LDBP: case OP_LDWP:
+            return reg_bit(rd) | reg_bit(rs) | FLAGS;
+        case OP_CMP: case OP_CMPI: case OP_CMPIW:
+            return FLAGS;
+        default:
+            return KEEP; /* DIV can fault, everything else touches memory, stack, io or control flow */
+    }
+}
+
+/* -------- CONTROL FLOW -------- */
+
+static void update_layout(Assembler *a, OptState *st) {
+    st->next[a->ir_count] = a->ir_count;
+    for (int i = a->ir_count - 1; i >= 0; i--)
+        st->next[i] = a->ir[i].dead ? st->next[i + 1] : i;
+
+    memset(st->target, 0, sizeof(st->target));
+    for (int l = 0; l < a->label_count; l++) {
+        if (a->labels[l].is_data == LABEL_CODE) st->target[st->next[st->pos[l]]] = 1;
+    }
+    st->target[st->next[st->entry]] = 1;
+}
+
+static FORCE_INLINE int jump_target(const Assembler *a, const OptState *st, int i) {
+    return st->next[st->pos[a->ir[i].label]];
+}
+
+static void compute_liveness(Assembler *a, OptState *st) {
+    int n = a->ir_count;
+    memset(st->live_in, 0, sizeof(st->live_in));
+    memset(st->live_out, 0, sizeof(st->live_out));
+    st->live_in[n] = EVERYTHING; /* running off the end of the code halts on the zeros or data after it */
+
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int i = n - 1; i >= 0; i--) {
+            Instr *in = &a->ir[i];
+            if (in->dead) continue;
+
+            RegSet out = 0;
+            if (in->opcode == OP_JMP) out = st->live_in[jump_target(a, st, i)];
+            else if (is_jump(in->opcode)) out = st->live_in[jump_target(a, st, i)] | st->live_in[st->next[i + 1]];
+            else if (in->opcode != OP_RET && in->opcode != OP_HALT && in->opcode != OP_JMPR) out = st->live_in[st->next[i + 1]];
+
+            RegSet live = ins_use(in) | (out & ~ins_def(in));
+            if (live != st->live_in[i] || out != st->live_out[i]) changed = 1;
+            st->live_in[i] = live;
+            st->live_out[i] = out;
+        }
+    }
+}
+
+/* -------- PASSES -------- */
+
+static int thread_jumps(Assembler *a, OptState *st) {
+    int changed = 0;
+    for (int i = 0; i < a->ir_count; i++) {
+        Instr *in = &a->ir[i];
+        if (in->dead || (!is_jump(in->opcode) && in->opcode != OP_CALL)) continue;
+
+        for (int hop = 0; hop < MAX_HOPS; hop++) {
+            int t = jump_target(a, st, i);
+            if (t >= a->ir_count || t == i) break;
+            const Instr *to = &a->ir[t];
+            int follow = to->opcode == OP_JMP ||
+                         (is_cond_jump(in->opcode) && jump_condition(to->opcode) == jump_condition(in->opcode));
+            if (!follow || to->label == in->label) break;
+            in->label = to->label;
+            changed++;
+        }
+    }
+    return changed;
+}
+
+static int remove_jumps_to_next(Assembler *a, OptState *st) {
+    int changed = 0;
+    for (int i = 0; i < a->ir_count; i++) {
+        Instr *in = &a->ir[i];
+        if (in->dead || !is_jump(in->opcode) || in->opcode == OP_DJNZ) continue; /* DJNZ still counts down */
+        if (jump_target(a, st, i) == st->next[i + 1]) {
+            in->dead = 1;
+            update_layout(a, st);
+            changed++;
+        }
+    }
+    return changed;
+}
+
+static FORCE_INLINE void reach(const Assembler *a, OptState *st, int *n, int i) {
+    if (i < a->ir_count && !st->reached[i]) {
+        st->reached[i] = 1;
+        st->work[(*n)++] = i;
+    }
+}
+
+/* from the entry point along jumps, calls and threads; a code label used as data or in a .table may be
+   reached any time */
+static int remove_unreachable(Assembler *a, OptState *st) {
+    int n = 0, changed = 0;
+    memset(st->reached, 0, sizeof(st->reached));
+    reach(a, st, &n, st->next[st->entry]);
+    for (int i = 0; i < a->ir_count; i++) {
+        const Instr *in = &a->ir[i];
+        if (!in->dead && in->label >= 0 && !is_jump(in->opcode) && in->opcode != OP_CALL &&
+            in->opcode != OP_SPAWN && a->labels[in->label].is_data == LABEL_CODE)
+            reach(a, st, &n, st->next[st->pos[in->label]]);
+    }
+    for (int k = 0; k < a->fixup_count; k++) {
+        if (a->fixups[k].kind == FIX_TABLE) reach(a, st, &n, st->next[st->pos[a->fixups[k].label]]);
+    }
+
+    while (n > 0) {
+        int i = st->work[--n];
+        uint8_t op = a->ir[i].opcode;
+        if (is_jump(op) || op == OP_CALL || op == OP_SPAWN) reach(a, st, &n, jump_target(a, st, i));
+        if (op != OP_JMP && op != OP_JMPR && op != OP_RET && op != OP_HALT) reach(a, st, &n, st->next[i + 1]);
+    }
+
+    for (int i = 0; i < a->ir_count; i++) {
+        if (!a->ir[i].dead && !st->reached[i]) {
+            a->ir[i].dead = 1;
+            changed++;
+        }
+    }
+    if (changed) update_layout(a, st);
+    return changed;
+}
+
+/* result of an arithmetic instruction on known operands; 0 if it does not fold into a LOAD of
+   no more bytes (a LOAD holds 16 bits, a wide LOAD 32 bits but two bytes more) */
+static int fold(const Instr *in, uint32_t x, uint32_t y, uint32_t *result) {
+    uint32_t r;
+    switch (in->opcode) {
+        case OP_ADD: case OP_ADDI: case OP_ADDIW: r = x + y; break;
+        case OP_SUB:  r = x - y; break;
+        case OP_MUL:  r = x * y; break;
+        case OP_AND:  r = x & y; break;
+        case OP_OR:   case OP_ORI:  case OP_ORIW:  r = x | y; break;
+        case OP_XOR:  case OP_XORI: case OP_XORIW: r = x ^ y; break;
+        case OP_SHL:  case OP_SHLI: r = x << (y & 0x1F); break;
+        case OP_SHR:  case OP_SHRI: r = x >> (y & 0x1F); break;
+        default: return 0;
+    }
+    *result = r;
+    return r <= 0xFFFF || in->len >= 6;
+}
+
+/* tracks LOADed constants through each basic block */
+static int fold_constants(Assembler *a, OptState *st) {
+    int changed = 0;
+    RegSet known = 0;
+    uint32_t value[MAX_REGISTERS] = {0};
+
+    for (int i = st->next[0]; i < a->ir_count; i = st->next[i + 1]) {
+        Instr *in = &a->ir[i];
+        uint8_t rd = in->ops[0], rs = in->ops[1], rt = in->ops[2];
+        int flags_dead = !(st->live_out[i] & FLAGS);
+        if (st->target[i]) known = 0;
+
+        if ((in->opcode == OP_LOAD && in->label < 0) || in->opcode == OP_LOADW) {
+            uint32_t v = in->opcode == OP_LOADW ? wide_imm(in, 1) : (uint32_t)(rs << 8 | rt);
+            if ((known & reg_bit(rd)) && value[rd] == v && flags_dead) { /* already there */
+                in->dead = 1;
+                changed++;
+                continue;
+            }
+            known |= reg_bit(rd);
+            value[rd] = v;
+            continue;
+        }
+        if (in->opcode == OP_MOV && (known & reg_bit(rs))) {
+            known |= reg_bit(rd);
+            value[rd] = value[rs];
+            continue;
+        }
+
+        int wide = in->opcode == OP_ADDIW || in->opcode == OP_XORIW || in->opcode == OP_ORIW;
+        int imm = wide || in->opcode == OP_ADDI || in->opcode == OP_XORI || in->opcode == OP_ORI ||
+                  in->opcode == OP_SHLI || in->opcode == OP_SHRI;
+        int srcs_known = (known & reg_bit(rs)) && (imm || (known & reg_bit(rt)));
+        uint32_t r;
+        if (srcs_known && flags_dead && fold(in, value[rs], wide ? wide_imm(in, 2) : imm ? rt : value[rt], &r)) {
+            /* no bigger than before, the LOADs feeding it may die */
+            if (r <= 0xFFFF) {
+                in->opcode = OP_LOAD;
+                in->ops[1] = (r >> 8) & 0xFF;
+                in->ops[2] = r & 0xFF;
+                in->len = 4;
+            } else {
+                in->opcode = OP_LOADW;
+                for (int k = 0; k < 4; k++) in->ops[1 + k] = (r >> (24 - 8 * k)) & 0xFF;
+                in->len = 6;
+            }
+            known |= reg_bit(rd);
+            value[rd] = r;
+            changed++;
+            continue;
+        }
+
+        if (in->opcode == OP_CALL || in->opcode == OP_CALLR || in->opcode == OP_NCALL) known = 0;
+        else known &= ~(ins_def(in) | (is_load(in->opcode) ? reg_bit(rd) : 0));
+    }
+    return changed;
+}
+
+static int remove_dead_stores(Assembler *a, OptState *st) {
+    int changed = 0;
+    for (int i = 0; i < a->ir_count; i++) {
+        Instr *in = &a->ir[i];
+        if (in->dead) continue;
+        RegSet effect = ins_effect(in);
+        if (effect != KEEP && !(effect & st->live_out[i])) {
+            in->dead = 1;
+            changed++;
+        }
+    }
+    if (changed) update_layout(a, st);
+    return changed;
+}
+
+/* -------- FLAGS -------- */
+
+static FORCE_INLINE int has_flagless(uint8_t op) {
+    switch (op) {
+        case OP_ADD: case OP_ADDI: case OP_SUB: case OP_MUL: case OP_DIV: case OP_MOV:
+        case OP_POP: case OP_LOAD: case OP_XOR: case OP_XORI: case OP_SHL: case OP_SHLI:
+        case OP_SHR: case OP_SHRI: case OP_LDB: case OP_AND: case OP_OR: case OP_ORI:
+        case OP_ADDIW: case OP_XORIW: case OP_ORIW: case OP_LOADW:
+        case OP_LDBX: case OP_LDBD: case OP_LDBP: case OP_LDWX: case OP_LDWD: case OP_LDWP:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/* after the passes, which only know the flag-setting opcodes; instructions changed */
+static int drop_dead_flags(Assembler *a, OptState *st) {
+    int changed = 0;
+    compute_liveness(a, st);
+    for (int i = 0; i < a->ir_count; i++) {
+        Instr *in = &a->ir[i];
+        if (!in->dead && has_flagless(in->opcode) && !(st->live_out[i] & FLAGS)) {
+            in->opcode |= OP_FLAGLESS;
+            changed++;
+        }
+    }
+    return changed;
+}
+
+/* -------- COMPARE AND BRANCH -------- */
+
+/* the compare-and-branch doing CMP or CMPI and then the flag jump */
+static uint8_t fused_branch(uint8_t cmp, uint8_t jump) {
+    uint8_t group = cmp == OP_CMPI ? OP_BEQI : OP_BEQ;
+    switch (jump) {
+        case OP_JE:  return group;
+        case OP_JNE:
+        case OP_JNZ: return group + 1;
+        case OP_JL:  return group + 2;
+        case OP_JLE: return group + 3;
+        case OP_JG:  return group + 4;
+        default:     return group + 5; /* OP_JGE */
+    }
+}
+
+/* after the passes; pairs fused where no other path reaches the jump and its flags are dead */
+static int fuse_branches(Assembler *a, OptState *st) {
+    int changed = 0;
+    compute_liveness(a, st);
+    for (int i = st->next[0]; i < a->ir_count; i = st->next[i + 1]) {
+        Instr *in = &a->ir[i];
+        int j = st->next[i + 1];
+        if ((in->opcode != OP_CMP && in->opcode != OP_CMPI) || in->label >= 0 || j >= a->ir_count) continue;
+        Instr *jump = &a->ir[j];
+        if (!is_cond_jump(jump->opcode) || st->target[j] || (st->live_out[j] & FLAGS)) continue;
+
+        in->opcode = fused_branch(in->opcode, jump->opcode);
+        in->label = jump->label;
+        in->len = 5;
+        jump->dead = 1;
+        changed++;
+    }
+    if (changed) update_layout(a, st);
+    return changed;
+}
+
+/* -------- DENSE FORMS -------- */
+
+/* jumps written with a signed 8-bit target (-z) */
+static FORCE_INLINE int is_short_jump(uint8_t op) {
+    return op >= OP_JMP_S && op <= OP_BGEI_S;
+}
+
+/* packed form of an instruction, the flagless bit kept; 0 if it has none or its registers do not fit */
+static uint8_t packed_form(const Instr *in) {
+    uint8_t op = in->opcode & ~OP_FLAGLESS, nf = in->opcode & OP_FLAGLESS;
+    if (in->label >= 0) return 0;
+    switch (op) {
+        case OP_LOAD:  return in->ops[1] == 0 ? OP_LOADB | nf : 0;
+        case OP_CMP:   return in->ops[0] < 16 && in->ops[1] < 16 ? OP_CMP_PK : 0;
+        default:       break;
+    }
+    if (in->ops[0] >= 16 || in->ops[1] >= 16) return 0;
+    switch (op) {
+        case OP_ADD:  return OP_ADD_PK | nf;
+        case OP_SUB:  return OP_SUB_PK | nf;
+        case OP_MUL:  return OP_MUL_PK | nf;
+        case OP_DIV:  return OP_DIV_PK | nf;
+        case OP_AND:  return OP_AND_PK | nf;
+        case OP_OR:   return OP_OR_PK | nf;
+        case OP_XOR:  return OP_XOR_PK | nf;
+        case OP_SHL:  return OP_SHL_PK | nf;
+        case OP_SHR:  return OP_SHR_PK | nf;
+        case OP_ADDI: return OP_ADDI_PK | nf;
+        case OP_XORI: return OP_XORI_PK | nf;
+        case OP_ORI:  return OP_ORI_PK | nf;
+        case OP_SHLI: return OP_SHLI_PK | nf;
+        case OP_SHRI: return OP_SHRI_PK | nf;
+        case OP_MOV:  return OP_MOV_PK | nf;
+        case OP_LDB:  return OP_LDB_PK | nf;
+        default:      return 0;
+    }
+}
+
+/* short form of a jump to a code label, 0 if it has none */
+static uint8_t short_form(const Assembler *a, const Instr *in) {
+    if (in->label < 0 || a->labels[in->label].is_data != LABEL_CODE) return 0;
+    switch (in->opcode) {
+        case OP_JMP: return OP_JMP_S;
+        case OP_JE:  return OP_JE_S;
+        case OP_JNE:
+        case OP_JNZ: return OP_JNE_S;
+        case OP_JG:  return OP_JG_S;
+        case OP_JGE: return OP_JGE_S;
+        case OP_JL:  return OP_JL_S;
+        case OP_JLE: return OP_JLE_S;
+        default:     break;
+    }
+    if (!is_branch(in->opcode)) return 0;
+    if (in->opcode >= OP_BEQ && in->opcode <= OP_BGE && (in->ops[0] >= 16 || in->ops[1] >= 16)) return 0;
+    return in->opcode + (OP_DJNZ_S - OP_DJNZ); /* DJNZ, Bcc and BccI keep their order */
+}
+
+/* length of the short form: the target byte after the registers and immediate it keeps */
+static int short_len(uint8_t op) {
+    if (op <= OP_JLE_S) return 2;
+    return op >= OP_BEQI_S ? 4 : 3;
+}
+
+/* rewrites ops and len in the short form; the target byte is set by relayout() */
+static void make_short(Instr *in, uint8_t op) {
+    if (op >= OP_BEQ_S && op <= OP_BGE_S) in->ops[0] = in->ops[0] << 4 | in->ops[1]; /* BccI keeps Rs and imm */
+    in->opcode = op;
+    in->len = short_len(op);
+}
+
+/* after drop_dead_flags(); instructions changed */
+static int densify(Assembler *a, OptState *st, int *jumps) {
+    uint16_t addr[MAX_BYTECODE + 1];
+    int packed = 0;
+
+    for (int i = 0; i < a->ir_count; i++) {
+        Instr *in = &a->ir[i];
+        uint8_t op = in->dead ? 0 : packed_form(in);
+        if (!op) continue;
+        if (op == OP_LOADB || op == OP_LOADB_NF) {
+            in->ops[1] = in->ops[2];
+            in->len = 3;
+        } else if (op == OP_CMP_PK || op == OP_MOV_PK || op == OP_MOV_PK_NF || op == OP_LDB_PK || op == OP_LDB_PK_NF) {
+            in->ops[0] = in->ops[0] << 4 | in->ops[1];
+            in->len = 2;
+        } else {
+            in->ops[0] = in->ops[0] << 4 | in->ops[1];
+            in->ops[1] = in->ops[2];
+            in->len = 3;
+        }
+        in->opcode = op;
+        packed++;
+    }
+
+    /* every jump short at first, then the ones out of reach widened until nothing moves */
+    memset(st->far, 0, sizeof(st->far));
+    for (int changed = 1; changed;) {
+        changed = 0;
+        int pos = 0;
+        for (int i = 0; i < a->ir_count; i++) {
+            const Instr *in = &a->ir[i];
+            uint8_t op = in->dead ? 0 : short_form(a, in);
+            addr[i] = pos;
+            if (!in->dead) pos += op && !st->far[i] ? short_len(op) : in->len;
+        }
+        addr[a->ir_count] = pos;
+
+        for (int i = 0; i < a->ir_count; i++) {
+            const Instr *in = &a->ir[i];
+            uint8_t op = in->dead || st->far[i] ? 0 : short_form(a, in);
+            if (!op) continue;
+            int rel = addr[jump_target(a, st, i)] - (addr[i] + short_len(op));
+            if (rel < -128 || rel > 127) {
+                st->far[i] = 1;
+                changed = 1;
+            }
+        }
+    }
+
+    *jumps = 0;
+    for (int i = 0; i < a->ir_count; i++) {
+        Instr *in = &a->ir[i];
+        uint8_t op = in->dead || st->far[i] ? 0 : short_form(a, in);
+        if (!op) continue;
+        make_short(in, op);
+        (*jumps)++;
+    }
+    return packed + *jumps;
+}
+
+/* -------- LAYOUT -------- */
+
+static void relayout(Assembler *a, OptState *st) {
+    uint16_t new_addr[MAX_BYTECODE + 1];
+    int pos = 0, line_count = 0;
+
+    for (int i = 0; i < a->ir_count; i++) {
+        new_addr[i] = pos;
+        if (!a->ir[i].dead) pos += a->ir[i].len;
+    }
+    new_addr[a->ir_count] = pos;
+
+    int shrink = a->bytecode_pos - pos;
+    for (int l = 0; l < a->label_count; l++) {
+        Label *lbl = &a->labels[l];
+        if (lbl->is_data == LABEL_CODE) lbl->address = new_addr[st->next[st->pos[l]]];
+        else lbl->address -= shrink;
+    }
+    a->data_start_addr -= shrink;
+    a->bss_start_addr -= shrink;
+    a->entry = new_addr[st->next[st->entry]];
+    for (int k = 0; k < a->fixup_count; k++) { /* .table entries are code addresses in .data */
+        const Fixup *f = &a->fixups[k];
+        if (f->kind != FIX_TABLE) continue;
+        a->data_section[f->at] = a->labels[f->label].address >> 8;
+        a->data_section[f->at + 1] = a->labels[f->label].address & 0xFF;
+    }
+
+    /* emit again, label operands patched with the new addresses */
+    int n = 0;
+    for (int i = 0; i < a->ir_count; i++) {
+        Instr in = a->ir[i];
+        if (in.dead) continue;
+        if (in.label >= 0) {
+            uint16_t addr = a->labels[in.label].address;
+            switch (in.opcode) {
+                case OP_SPAWN:
+                case OP_DJNZ:  in.ops[1] = addr >> 8; in.ops[2] = addr & 0xFF; break;
+                case OP_LOAD:
+                case OP_LOAD_NF:
+                case OP_SWITCH: in.ops[1] = addr >> 8; in.ops[2] = addr & 0xFF; break;
+                case OP_CMPI:
+                case OP_STOREI: in.ops[1] = addr & 0xFF; break;
+                default:
+                    if (is_short_jump(in.opcode)) in.ops[in.len - 2] = (uint8_t)(addr - (new_addr[i] + in.len));
+                    else if (is_branch(in.opcode)) { in.ops[2] = addr >> 8; in.ops[3] = addr & 0xFF; }
+                    else { in.ops[0] = addr >> 8; in.ops[1] = addr & 0xFF; }
+                    break;
+            }
+        }
+        in.address = new_addr[i];
+        a->bytecode[in.address] = in.opcode;
+        memcpy(&a->bytecode[in.address + 1], in.ops, in.len - 1);
+        a->lines[line_count].address = in.address;
+        a->lines[line_count++].line = in.line;
+        a->ir[n++] = in;
+    }
+    a->ir_count = n;
+    a->line_count = line_count;
+    a->bytecode_pos = pos;
+}
+
+/* -------- PROFILE -------- */
+
+/* first instruction at or after addr (the ir is sorted by address), ir_count past the code */
+static int first_at(const Assembler *a, int addr) {
+    int lo = 0, hi = a->ir_count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (a->ir[mid].address < addr) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/* "address opcode line count" lines of vm --profile into st->count; entries matched, -1 if unreadable */
+static COLD_REGION int load_profile(const Assembler *a, OptState *st, const char *path, int *ignored) {
+    FILE *file = fopen(path, "r");
+    char line[128];
+    int matched = 0;
+
+    *ignored = 0;
+    memset(st->count, 0, sizeof(st->count));
+    if (UNLIKELY(!file)) return -1;
+    while (fgets(line, sizeof(line), file)) {
+        unsigned addr, opcode, count;
+        int src_line;
+        if (line[0] == '#' || sscanf(line, "%x %x %d %u", &addr, &opcode, &src_line, &count) != 4) continue;
+
+        /* the profiled build must have had the same instruction there */
+        int i = first_at(a, addr);
+        if (i < a->ir_count && a->ir[i].address == addr && a->ir[i].opcode == opcode &&
+            (src_line == 0 || a->ir[i].line == src_line)) {
+            st->count[i] = count;
+            matched++;
+        } else {
+            (*ignored)++;
+        }
+    }
+    fclose(file);
+    return matched;
+}
+
+/* -------- REWRITING -------- */
+
+/* a new code label at instruction i (an index of the list being replaced), -1 if out of memory */
+static int add_code_label(Assembler *a, OptState *st, const char *name, int i) {
+    int *pos = realloc(st->pos, (a->label_count + 2) * sizeof(int));
+    if (UNLIKELY(!pos)) return -1;
+    st->pos = pos;
+
+    Label lbl = {0};
+    snprintf(lbl.name, sizeof(lbl.name), "%s", name);
+    lbl.is_data = LABEL_CODE;
+    lbl.defined = 1;
+    int l = append_label(a, &lbl);
+    if (LIKELY(l >= 0)) st->pos[l] = i;
+    return l;
+}
+
+/* st->out[0..m) becomes the instruction list; the first label_count labels and the entry move through new_index */
+static void replace_code(Assembler *a, OptState *st, int m, int label_count) {
+    st->new_index[a->ir_count] = m;
+    for (int l = 0; l < label_count; l++) st->pos[l] = st->new_index[st->next[st->pos[l]]];
+    st->entry = st->new_index[st->next[st->entry]];
+    memcpy(a->ir, st->out, m * sizeof(Instr));
+    a->ir_count = m;
+    update_layout(a, st);
+}
+
+/* -------- INLINING -------- */
+
+/* size of the leaf routine from instruction s up to the RET that ends it (*last), -1 if it can't be
+   copied: no calls, jumps only inside it, and the stack as it was on entry at every RET */
+static int leaf_size(const Assembler *a, const OptState *st, int s, int *last) {
+    int size = 0, depth = 0, stack_ops = 0, jumps = 0, reach = s;
+    for (int i = s; i < a->ir_count; i = st->next[i + 1]) {
+        const Instr *in = &a->ir[i];
+        switch (in->opcode) {
+            case OP_CALL: case OP_SPAWN: case OP_JMPR: case OP_CALLR: case OP_SWITCH:
+                return -1;
+            case OP_PUSH:
+                depth++;
+                stack_ops = 1;
+                break;
+            case OP_POP:
+                if (--depth < 0) return -1; /* would take the return address */
+                stack_ops = 1;
+                break;
+            case OP_RET:
+                if (depth != 0) return -1;
+                if (reach <= i) {
+                    *last = i;
+                    return jumps && stack_ops ? -1 : size;
+                }
+                break;
+            default:
+                if (is_jump(in->opcode)) {
+                    int t = jump_target(a, st, i);
+                    if (t < s) return -1;
+                    if (t > reach) reach = t;
+                    jumps = 1;
+                }
+        }
+        size += in->opcode == OP_RET ? 3 : in->len; /* a RET before the last one becomes a JMP */
+        if (size > INLINE_MAX_BYTES) return -1;
+    }
+    return -1;
+}
+
+/* copies the routine s..last in place of the CALL at i; m is where the copy starts, returns where it ends */
+static int copy_routine(Assembler *a, OptState *st, int i, int s, int last, int m) {
+    static int copy_of[MAX_BYTECODE + 1];   /* routine instruction -> index of its copy */
+    static int from[MAX_BYTECODE];          /* copy -> routine instruction, -1 for a RET turned JMP */
+    int first = m, copy = ++st->copies;
+    char routine[64], name[64]; /* new labels may move a->labels */
+    snprintf(routine, sizeof(routine), "%s", a->labels[a->ir[i].label].name);
+
+    for (int j = s; ; j = st->next[j + 1]) {
+        copy_of[j] = m;
+        if (j == last) break; /* the last RET: the copy falls through to what followed the CALL */
+        if (a->ir[j].opcode == OP_RET) {
+            st->out[m] = (Instr){ .opcode = OP_JMP, .len = 3, .label = -1, .line = a->ir[j].line };
+            from[m] = -1;
+        } else {
+            st->out[m] = a->ir[j];
+            from[m] = j;
+        }
+        st->out_count[m++] = st->count[i];
+    }
+
+    /* jumps inside the copy get labels of their own: <label>.<copy> */
+    int ret_label = -1;
+    for (int k = first; k < m; k++) {
+        Instr *in = &st->out[k];
+        if (from[k] < 0) {
+            if (ret_label < 0) {
+                snprintf(name, sizeof(name), "%.40s.%d.ret", routine, copy);
+                ret_label = add_code_label(a, st, name, m);
+            }
+            in->label = ret_label;
+        } else if (is_jump(in->opcode)) {
+            int t = copy_of[jump_target(a, st, from[k])], l = -1;
+            for (int p = first; p < k && l < 0; p++) {
+                if (from[p] >= 0 && is_jump(st->out[p].opcode) && st->pos[st->out[p].label] == t) l = st->out[p].label;
+            }
+            if (l < 0) {
+                snprintf(name, sizeof(name), "%.40s.%d", a->labels[in->label].name, copy);
+                l = add_code_label(a, st, name, t);
+            }
+            in->label = l;
+        }
+        if (UNLIKELY(in->label < 0 && is_jump(in->opcode))) return -1;
+    }
+    return m;
+}
+
+/* replaces calls of short leaf routines by a copy of their body (with a profile: only calls that ran) */
+static int inline_leaves(Assembler *a, OptState *st) {
+    int m = 0, inlined = 0, size = 0, growth = 0, label_count = a->label_count;
+
+    for (int i = st->next[0]; i < a->ir_count; i = st->next[i + 1]) size += a->ir[i].len;
+    for (int i = st->next[0]; i < a->ir_count; i = st->next[i + 1]) {
+        const Instr *in = &a->ir[i];
+        int s = -1, last = -1, body = -1;
+        st->new_index[i] = m;
+        if (in->opcode == OP_CALL && (!st->profiled || st->count[i] > 0)) {
+            s = jump_target(a, st, i);
+            body = leaf_size(a, st, s, &last);
+        }
+
+        if (body >= 0 && growth + body - in->len <= INLINE_BUDGET && size + growth + body - in->len <= MAX_BYTECODE) {
+            m = copy_routine(a, st, i, s, last, m);
+            if (UNLIKELY(m < 0)) { /* out of labels: keep the code, the new labels point past it */
+                for (int l = label_count; l < a->label_count; l++) st->pos[l] = a->ir_count;
+                return 0;
+            }
+            growth += body - in->len;
+            inlined++;
+            continue;
+        }
+        st->out[m] = *in;
+        st->out_count[m++] = st->count[i];
+    }
+
+    if (inlined) {
+        replace_code(a, st, m, label_count);
+        memcpy(st->count, st->out_count, m * sizeof(uint32_t));
+        st->count[m] = 0;
+    }
+    return inlined;
+}
+
+/* -------- BLOCK LAYOUT -------- */
+
+static FORCE_INLINE int ends_block(uint8_t op) {
+    return is_jump(op) || op == OP_JMPR || op == OP_SWITCH || op == OP_RET || op == OP_HALT;
+}
+
+/* the jump taken exactly when op is not, 0 for DJNZ */
+static uint8_t inverse_jump(uint8_t op) {
+    switch (op) {
+        case OP_JE:  return OP_JNE;
+        case OP_JNE:
+        case OP_JNZ: return OP_JE;
+        case OP_JG:  return OP_JLE;
+        case OP_JLE: return OP_JG;
+        case OP_JGE: return OP_JL;
+        case OP_JL:  return OP_JGE;
+        case OP_DJNZ: return 0;
+        default: { /* compare and branch: EQ/NE, LT/GE, LE/GT are paired within each group of six */
+            static const uint8_t pair[6] = { 1, 0, 5, 4, 3, 2 };
+            uint8_t group = op >= OP_BEQI ? OP_BEQI : OP_BEQ;
+            return group + pair[op - group];
+        }
+    }
+}
+
+/* splits the live code into basic blocks, -1 if the last one runs off the end of the code */
+static int find_blocks(Assembler *a, OptState *st) {
+    int n = 0, prev = -1;
+    for (int i = st->next[0]; i < a->ir_count; i = st->next[i + 1]) {
+        if (prev < 0 || st->target[i] || ends_block(a->ir[prev].opcode)) {
+            Block *b = &st->blocks[n++];
+            b->first = i;
+            b->count = 0;
+            b->label = -1;
+            b->placed = 0;
+        }
+        Block *b = &st->blocks[n - 1];
+        b->last = i;
+        if (st->count[i] > b->count) b->count = st->count[i];
+        st->block_of[i] = n - 1;
+        prev = i;
+    }
+    st->block_of[a->ir_count] = -1;
+    st->block_count = n;
+
+    for (int k = 0; k < n; k++) {
+        Block *b = &st->blocks[k];
+        uint8_t op = a->ir[b->last].opcode;
+        b->jump = is_jump(op) ? st->block_of[jump_target(a, st, b->last)] : -1;
+        b->fall = op == OP_JMP || op == OP_JMPR || op == OP_RET || op == OP_HALT ? -1 : k + 1;
+        if (b->fall == n) return -1;
+    }
+    for (int l = 0; l < a->label_count; l++) {
+        if (a->labels[l].is_data != LABEL_CODE) continue;
+        int k = st->block_of[st->next[st->pos[l]]];
+        if (k >= 0 && st->blocks[k].label < 0) st->blocks[k].label = l;
+    }
+    return n;
+}
+
+/* the hotter unplaced successor, fall-through on a tie; a block that never ran does not follow one that did */
+static int next_in_chain(const OptState *st, const Block *b) {
+    int succ[2] = { b->fall, b->jump };
+    int best = -1;
+    for (int s = 0; s < 2; s++) {
+        int k = succ[s];
+        if (k < 0 || st->blocks[k].placed || (st->blocks[k].count == 0 && b->count > 0)) continue;
+        if (best < 0 || st->blocks[k].count > st->blocks[best].count) best = k;
+    }
+    return best;
+}
+
+/* chains from the entry block; every later chain starts at the hottest block left, so cold code ends up last */
+static void order_blocks(OptState *st, int *order) {
+    int n = st->block_count;
+    int k = st->block_of[st->next[st->entry]];
+
+    for (int placed = 0; placed < n; placed++) {
+        if (k < 0) {
+            for (int j = 0; j < n; j++) {
+                if (!st->blocks[j].placed && (k < 0 || st->blocks[j].count > st->blocks[k].count)) k = j;
+            }
+        }
+        st->blocks[k].placed = 1;
+        order[placed] = k;
+        k = next_in_chain(st, &st->blocks[k]);
+    }
+}
+
+/* code label at the start of block k, a new .L label if the source has none */
+static int block_label(Assembler *a, OptState *st, int k) {
+    Block *b = &st->blocks[k];
+    if (b->label < 0) {
+        char name[32];
+        snprintf(name, sizeof(name), ".L%d", k);
+        b->label = add_code_label(a, st, name, b->first);
+    }
+    return b->label;
+}
+
+/* reorders the live code by block chains; blocks laid out, -1 if the code was left as it was */
+static int layout_blocks(Assembler *a, OptState *st) {
+    static int order[MAX_BYTECODE];
+    Instr *out = st->out;
+    int n = find_blocks(a, st);
+    if (n <= 0) return -1;
+    order_blocks(st, order);
+
+    int m = 0, size = 0;
+    for (int k = 0; k < n; k++) {
+        Block *b = &st->blocks[order[k]];
+        int next = k + 1 < n ? order[k + 1] : -1;
+        uint8_t op = a->ir[b->last].opcode;
+
+        for (int i = b->first; i <= b->last; i = st->next[i + 1]) {
+            st->new_index[i] = m;
+            if (i == b->last && op == OP_JMP && b->jump == next) break; /* falls into its target now */
+            if (UNLIKELY(m >= MAX_BYTECODE)) return -1;
+            out[m] = a->ir[i];
+            size += out[m++].len;
+        }
+        if (b->fall < 0 || b->fall == next) continue;
+
+        int l = block_label(a, st, b->fall);
+        if (UNLIKELY(l < 0)) return -1;
+        if (is_jump(op) && op != OP_JMP && inverse_jump(op) && b->jump == next) { /* taken side follows: branch to the other one */
+            out[m - 1].opcode = inverse_jump(op);
+            out[m - 1].label = l;
+            continue;
+        }
+        if (UNLIKELY(m >= MAX_BYTECODE)) return -1;
+        out[m] = (Instr){ .opcode = OP_JMP, .len = 3, .label = l, .line = a->ir[b->last].line };
+        size += out[m++].len;
+    }
+    if (UNLIKELY(size > MAX_BYTECODE)) return -1;
+
+    replace_code(a, st, m, a->label_count);
+    return n;
+}
+
+/* -------- DRIVER -------- */
+
+static void run_passes(Assembler *a, OptState *st) {
+    for (int pass = 0; pass < MAX_PASSES; pass++) {
+        int changed = thread_jumps(a, st);
+        changed += remove_jumps_to_next(a, st);
+        changed += remove_unreachable(a, st);
+        compute_liveness(a, st);
+        if (fold_constants(a, st)) {
+            changed++;
+            update_layout(a, st);
+            compute_liveness(a, st);
+        }
+        changed += remove_dead_stores(a, st);
+        if (!changed) break;
+    }
+}
+
+COLD_REGION int optimize(Assembler *a, ErrorContext *err_ctx, const char *profile, int dense, int silent) {
+    static OptState st;
+    int old_count = a->ir_count, old_size = a->bytecode_pos;
+
+    for (int i = 0; i < a->ir_count; i++) {
+        Instr *in = &a->ir[i];
+        int end = i + 1 < a->ir_count ? a->ir[i + 1].address : a->bytecode_pos;
+        in->len = end - in->address;
+        in->dead = 0;
+        memset(in->ops, 0, sizeof(in->ops));
+        memcpy(in->ops, &a->bytecode[in->address + 1], in->len - 1);
+
+        /* a numeric jump target could land anywhere once code moves */
+        if (UNLIKELY((is_jump(in->opcode) || in->opcode == OP_CALL || in->opcode == OP_SPAWN) && in->label < 0)) {
+            error_push(err_ctx, WARN_OPTIMIZE_SKIPPED, SEVERITY_WARNING, in->line, 0, NULL,
+                       "jump to a numeric address - code not optimized");
+            return 0;
+        }
+    }
+
+    /* instruction index of every code label and of the entry point */
+    st.pos = malloc((a->label_count + 1) * sizeof(int));
+    if (UNLIKELY(!st.pos)) return 0;
+    for (int l = 0; l < a->label_count; l++)
+        st.pos[l] = a->labels[l].is_data == LABEL_CODE ? first_at(a, a->labels[l].address) : a->ir_count;
+    st.entry = first_at(a, a->entry);
+    update_layout(a, &st);
+
+    /* counts are read while instruction indices still match the profiled build */
+    int profiled = 0, blocks = -1;
+    memset(st.count, 0, sizeof(st.count));
+    st.profiled = profile != NULL;
+    st.copies = 0;
+    if (profile) {
+        int ignored;
+        profiled = load_profile(a, &st, profile, &ignored);
+        if (UNLIKELY(profiled < 0)) {
+            error_push(err_ctx, ERR_FILE_OPEN, SEVERITY_ERROR, 0, 0, NULL, "could not read profile '%s'", profile);
+            free(st.pos);
+            return 0;
+        }
+        if (UNLIKELY(ignored > 0))
+            error_push(err_ctx, WARN_PROFILE_MISMATCH, SEVERITY_WARNING, 0, 0, NULL,
+                       "%d profile entries do not match this code - profile a build made without -O or -P", ignored);
+    }
+
+    int inlined = inline_leaves(a, &st);
+    run_passes(a, &st);
+    if (profile) {
+        blocks = layout_blocks(a, &st);
+        if (LIKELY(blocks >= 0)) run_passes(a, &st);
+        else error_push(err_ctx, WARN_PROFILE_MISMATCH, SEVERITY_WARNING, 0, 0, NULL,
+                        "code runs off its end or would grow too large - blocks not laid out");
+    }
+
+    int fused = fuse_branches(a, &st);
+    int flagless = drop_dead_flags(a, &st);
+    int short_jumps = 0, densified = dense ? densify(a, &st, &short_jumps) : 0;
+    relayout(a, &st);
+    free(st.pos);
+    if (LIKELY(!silent)) {
+        printf("Optimized: %d -> %d instructions, %d -> %d bytes\n",
+               old_count, a->ir_count, old_size, a->bytecode_pos);
+        if (fused > 0) printf("Fused: %d compare-and-branch%s\n", fused, fused == 1 ? "" : "es");
+        if (flagless > 0) printf("Flagless: %d instruction%s\n", flagless, flagless == 1 ? "" : "s");
+        if (densified > 0)
+            printf("Dense: %d instruction%s packed, %d short jump%s\n", densified - short_jumps,
+                   densified - short_jumps == 1 ? "" : "s", short_jumps, short_jumps == 1 ? "" : "s");
+        if (inlined > 0) printf("Inlined: %d call%s to leaf routines\n", inlined, inlined == 1 ? "" : "s");
+        if (blocks >= 0) printf("Profile: %d instructions counted, %d blocks laid out\n", profiled, blocks);
+    }
+    return old_size - a->bytecode_pos;
+}
@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/common.h"
+#include "../include/types.h"
+#include "../include/vbin.h"
+
+/*
+ * header   "VBIN", u16 version, u16 section count, u16 entry, u16 flags, u32 checksum
+ * section  u8 type, u8 log2 alignment, u16 load address, u32 file offset, u32 size
+ * little-endian, checksum = FNV-1a over everything after the header
+ */
+
+#define MAX_SECTIONS 5
+#define MAX_VBIN_SIZE (VBIN_HEADER_SIZE + MAX_SECTIONS * VBIN_SECTION_SIZE + MAX_BYTECODE + \
+                       MAX_DATA_SECTION + MAX_BYTECODE * 4) /* without the symbols */
+
+static void put16(uint8_t *p, uint32_t v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    put16(p, v & 0xFFFF);
+    put16(p + 2, v >> 16);
+}
+
+static int add_section(uint8_t *image, int *count, int type, int addr, int offset, int size) {
+    uint8_t *s = image + VBIN_HEADER_SIZE + *count * VBIN_SECTION_SIZE;
+    s[0] = type;
+    s[1] = 0; /* byte aligned, the VM has no alignment requirements yet */
+    put16(s + 2, addr);
+    put32(s + 4, offset);
+    put32(s + 8, size);
+    (*count)++;
+    return offset + (type == VBIN_BSS ? 0 : size);
+}
+
+/* writes the container, returns its size; *bytes_written tells how much reached the file */
+COLD_REGION int write_vbin(Assembler *asm_ctx, FILE *output, size_t *bytes_written) {
+    *bytes_written = 0;
+    size_t symbols_size = 0;
+    for (int i = 0; i < asm_ctx->label_count; i++)
+        symbols_size += 4 + strlen(asm_ctx->labels[i].name);
+
+    uint8_t *image = calloc(1, MAX_VBIN_SIZE + symbols_size);
+    if (UNLIKELY(!image)) return -1;
+
+    /* section contents follow the table, built as we go */
+    int count = 0;
+    int sections = 2 + (asm_ctx->data_pos > 0) + (asm_ctx->bss_size > 0) + (asm_ctx->line_count > 0);
+    int pos = VBIN_HEADER_SIZE + sections * VBIN_SECTION_SIZE;
+
+    memcpy(image + pos, asm_ctx->bytecode, asm_ctx->bytecode_pos);
+    pos = add_section(image, &count, VBIN_CODE, 0, pos, asm_ctx->bytecode_pos);
+
+    if (asm_ctx->data_pos > 0) {
+        memcpy(image + pos, asm_ctx->data_section, asm_ctx->data_pos);
+        pos = add_section(image, &count, VBIN_DATA, asm_ctx->data_start_addr, pos, asm_ctx->data_pos);
+    }
+    if (asm_ctx->bss_size > 0)
+        add_section(image, &count, VBIN_BSS, asm_ctx->bss_start_addr, 0, asm_ctx->bss_size);
+
+    int start = pos;
+    for (int i = 0; i < asm_ctx->label_count; i++) {
+        Label *lbl = &asm_ctx->labels[i];
+        int len = strlen(lbl->name);
+        put16(image + pos, lbl->address);
+        image[pos + 2] = lbl->is_data == LABEL_BSS ? VBIN_BSS : lbl->is_data ? VBIN_DATA : VBIN_CODE;
+        image[pos + 3] = len;
+        memcpy(image + pos + 4, lbl->name, len);
+        pos += 4 + len;
+    }
+    pos = add_section(image, &count, VBIN_SYMBOLS, 0, start, pos - start);
+
+    if (asm_ctx->line_count > 0) {
+        start = pos;
+        for (int i = 0; i < asm_ctx->line_count; i++) {
+            put16(image + pos, asm_ctx->lines[i].address);
+            put16(image + pos + 2, asm_ctx->lines[i].line);
+            pos += 4;
+        }
+        pos = add_section(image, &count, VBIN_LINES, 0, start, pos - start);
+    }
+
+    uint32_t checksum = 0x811C9DC5;
+    for (int i = VBIN_HEADER_SIZE; i < pos; i++) {
+        checksum ^= image[i];
+        checksum *= 0x01000193;
+    }
+
+    memcpy(image, VBIN_MAGIC, 4);
+    put16(image + 4, VBIN_VERSION);
+    put16(image + 6, count);
+    put16(image + 8, asm_ctx->entry);
+    put16(image + 10, 0);
+    put32(image + 12, checksum);
+
+    *bytes_written = fwrite(image, 1, pos, output);
+    free(image);
+    return pos;
+}
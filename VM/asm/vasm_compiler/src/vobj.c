@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/common.h"
+#include "../include/types.h"
+#include "../include/vobj.h"
+
+/*
+ * header  "VOBJ", u16 version, u16 flags, u16 entry, u16 code size, u16 data size,
+ *         u16 bss size, u32 label count, u32 fixup count, u32 instruction count, u32 checksum
+ * body    code, data, labels, fixups, instructions
+ * little-endian, checksum = FNV-1a over the body
+ *
+ * Label addresses are offsets into their own section. Fixups are the label
+ * operands link_labels() patches once the objects are placed; instructions
+ * keep their line and label so the linked program has a line table and -O
+ * can still run on it.
+ */
+
+static void put16(uint8_t *p, uint32_t v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    put16(p, v & 0xFFFF);
+    put16(p + 2, v >> 16);
+}
+
+uint16_t vobj_get16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+uint32_t vobj_get32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t fnv32(const uint8_t *p, size_t len) {
+    uint32_t h = 0x811C9DC5;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 0x01000193;
+    }
+    return h;
+}
+
+/* -------- WRITER -------- */
+
+/* writes the object, returns its size; *bytes_written tells how much reached the file */
+COLD_REGION int write_object(Assembler *asm_ctx, FILE *output, size_t *bytes_written) {
+    *bytes_written = 0;
+    size_t size = VOBJ_HEADER_SIZE + asm_ctx->bytecode_pos + asm_ctx->data_pos +
+                  (size_t)asm_ctx->fixup_count * VOBJ_FIXUP_SIZE + (size_t)asm_ctx->ir_count * VOBJ_INSTR_SIZE;
+    for (int i = 0; i < asm_ctx->label_count; i++)
+        size += 6 + strlen(asm_ctx->labels[i].name);
+
+    uint8_t *image = calloc(1, size);
+    if (UNLIKELY(!image)) return -1;
+
+    int pos = VOBJ_HEADER_SIZE;
+    memcpy(image + pos, asm_ctx->bytecode, asm_ctx->bytecode_pos);
+    pos += asm_ctx->bytecode_pos;
+    memcpy(image + pos, asm_ctx->data_section, asm_ctx->data_pos);
+    pos += asm_ctx->data_pos;
+
+    for (int i = 0; i < asm_ctx->label_count; i++) {
+        const Label *lbl = &asm_ctx->labels[i];
+        int len = strlen(lbl->name);
+        put16(image + pos, lbl->address);
+        image[pos + 2] = lbl->is_data;
+        image[pos + 3] = lbl->scope;
+        image[pos + 4] = lbl->defined;
+        image[pos + 5] = len;
+        memcpy(image + pos + 6, lbl->name, len);
+        pos += 6 + len;
+    }
+
+    int has_entry_label = 0;
+    for (int i = 0; i < asm_ctx->fixup_count; i++, pos += VOBJ_FIXUP_SIZE) {
+        const Fixup *f = &asm_ctx->fixups[i];
+        put32(image + pos, f->label);
+        put16(image + pos + 4, f->at);
+        image[pos + 6] = f->kind;
+        put16(image + pos + 7, f->line);
+        put16(image + pos + 9, f->col);
+        has_entry_label |= f->kind == FIX_ENTRY;
+    }
+
+    for (int i = 0; i < asm_ctx->ir_count; i++, pos += VOBJ_INSTR_SIZE) {
+        const Instr *in = &asm_ctx->ir[i];
+        image[pos] = in->opcode;
+        put16(image + pos + 1, in->address);
+        put16(image + pos + 3, in->line);
+        put32(image + pos + 5, in->label < 0 ? VOBJ_NO_LABEL : (uint32_t)in->label);
+    }
+
+    memcpy(image, VOBJ_MAGIC, 4);
+    put16(image + 4, VOBJ_VERSION);
+    put16(image + 6, asm_ctx->entry_set ? VOBJ_HAS_ENTRY : 0);
+    put16(image + 8, has_entry_label ? 0 : asm_ctx->entry);
+    put16(image + 10, asm_ctx->bytecode_pos);
+    put16(image + 12, asm_ctx->data_pos);
+    put16(image + 14, asm_ctx->bss_size);
+    put32(image + 16, asm_ctx->label_count);
+    put32(image + 20, asm_ctx->fixup_count);
+    put32(image + 24, asm_ctx->ir_count);
+    put32(image + 28, fnv32(image + VOBJ_HEADER_SIZE, pos - VOBJ_HEADER_SIZE));
+
+    *bytes_written = fwrite(image, 1, pos, output);
+    free(image);
+    return pos;
+}
+
+/* -------- READER -------- */
+
+/* every count, offset and index is checked, so the linker can use the object as it is */
+static int check_object_layout(Object *obj) {
+    const uint8_t *file = obj->file;
+    size_t pos = VOBJ_HEADER_SIZE;
+
+    if (obj->code_size > MAX_BYTECODE || obj->data_size > MAX_DATA_SECTION || obj->bss_size > MAX_BYTECODE ||
+        obj->instr_count > obj->code_size || obj->size - pos < (size_t)obj->code_size + obj->data_size)
+        return -1;
+    obj->code = file + pos;
+    pos += obj->code_size;
+    obj->data = file + pos;
+    pos += obj->data_size;
+
+    obj->labels = file + pos;
+    for (uint32_t i = 0; i < obj->label_count; i++) {
+        if (obj->size - pos < 6) return -1;
+        const uint8_t *l = file + pos;
+        uint16_t limit = l[2] == LABEL_CODE ? obj->code_size : l[2] == LABEL_DATA ? obj->data_size : obj->bss_size;
+        if (l[2] > LABEL_BSS || l[3] > SCOPE_EXTERN || l[4] > 1 || l[5] == 0 || l[5] >= sizeof(((Label *)0)->name) ||
+            obj->size - pos - 6 < l[5] || vobj_get16(l) > limit)
+            return -1;
+        pos += 6 + l[5];
+    }
+
+    if ((obj->size - pos) / VOBJ_FIXUP_SIZE < obj->fixup_count) return -1;
+    obj->fixups = file + pos;
+    for (uint32_t i = 0; i < obj->fixup_count; i++, pos += VOBJ_FIXUP_SIZE) {
+        const uint8_t *f = file + pos;
+        int width = f[6] == FIX_BYTE ? 1 : f[6] == FIX_ENTRY ? 0 : 2;
+        int section = f[6] == FIX_TABLE ? obj->data_size : obj->code_size;
+        if (vobj_get32(f) >= obj->label_count || f[6] > FIX_TABLE || vobj_get16(f + 4) + width > section)
+            return -1;
+    }
+
+    if (obj->size - pos != (size_t)obj->instr_count * VOBJ_INSTR_SIZE) return -1;
+    obj->instrs = file + pos;
+    for (uint32_t i = 0; i < obj->instr_count; i++, pos += VOBJ_INSTR_SIZE) {
+        uint32_t label = vobj_get32(file + pos + 5);
+        if (vobj_get16(file + pos + 1) >= obj->code_size || (label != VOBJ_NO_LABEL && label >= obj->label_count))
+            return -1;
+    }
+    return 0;
+}
+
+/* 0 on success, -1 if the file cannot be read, -2 if it is not a valid object */
+COLD_REGION int read_object(Object *obj, const char *path) {
+    memset(obj, 0, sizeof(*obj));
+    obj->path = path;
+
+    FILE *file = fopen(path, "rb");
+    if (!file) return -1;
+    long size = fseek(file, 0, SEEK_END) == 0 ? ftell(file) : -1;
+    if (size < 0 || fseek(file, 0, SEEK_SET) != 0) {
+        fclose(file);
+        return -1;
+    }
+    obj->file = malloc(size + 1);
+    obj->size = obj->file ? fread(obj->file, 1, size, file) : 0;
+    fclose(file);
+    if (!obj->file || obj->size != (size_t)size) {
+        free_object(obj);
+        return -1;
+    }
+
+    const uint8_t *p = obj->file;
+    if (obj->size < VOBJ_HEADER_SIZE || memcmp(p, VOBJ_MAGIC, 4) != 0 || vobj_get16(p + 4) != VOBJ_VERSION ||
+        fnv32(p + VOBJ_HEADER_SIZE, obj->size - VOBJ_HEADER_SIZE) != vobj_get32(p + 28))
+        return -2;
+
+    obj->flags = vobj_get16(p + 6);
+    obj->entry = vobj_get16(p + 8);
+    obj->code_size = vobj_get16(p + 10);
+    obj->data_size = vobj_get16(p + 12);
+    obj->bss_size = vobj_get16(p + 14);
+    obj->label_count = vobj_get32(p + 16);
+    obj->fixup_count = vobj_get32(p + 20);
+    obj->instr_count = vobj_get32(p + 24);
+    return check_object_layout(obj) == 0 ? 0 : -2;
+}
+
+void free_object(Object *obj) {
+    free(obj->file);
+    obj->file = NULL;
+    obj->size = 0;
+}
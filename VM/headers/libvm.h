@@ -0,0 +1,97 @@
+#ifndef LIBVM_H
+#define LIBVM_H
+
+/*
+ * Public API of libvm. The VM is opaque here, everything goes through
+ * these functions so programs built against the library keep working
+ * when struct VM changes. vm_run() and the callbacks it invokes do no
+ * heap allocation; only vm_create() and vm_host_create() allocate.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct VM VM;
+typedef struct vm_host vm_host_t;
+
+enum VmStatus { // result of vm_run()
+    VM_STATUS_HALTED = 0,
+    VM_STATUS_IO_WAIT, // an input opcode found no data, pc points at it
+    VM_STATUS_BUDGET, // step budget used up
+    VM_STATUS_ERROR, // stopped by a fault, see vm_get_error()
+    VM_STATUS_BREAK, // hit a breakpoint, pc points at it and the next vm_run() executes it
+    VM_STATUS_WATCH // a watched range changed, pc is after the instruction that wrote it
+};
+
+enum VmError {
+    VM_ERR_NONE = 0,
+    VM_ERR_PC, // pc left memory
+    VM_ERR_OPCODE, // unknown opcode
+    VM_ERR_DIV_ZERO,
+    VM_ERR_STACK, // stack overflow or underflow
+    VM_ERR_NATIVE, // NCALL to an empty slot or the native failed
+    VM_ERR_DEADLOCK, // every thread waits in JOIN
+    VM_ERR_LOAD, // program does not fit into memory
+    VM_ERR_OPERAND, // analysis: register or native index out of range
+    VM_ERR_FORMAT, // broken VBIN container
+    VM_ERR_HEAP // FREE of an address that is not a live ALLOC block
+};
+
+#define VM_FLAG_ZERO     0x01
+#define VM_FLAG_CARRY    0x02
+#define VM_FLAG_SIGN     0x04
+#define VM_FLAG_OVERFLOW 0x08
+
+#define VM_MEM_HUGE 0x01 // vm_create_sized(): try huge pages for dense images
+
+#define VM_IO_AGAIN (-1) // vm_read_fn: no data yet, try again later
+
+typedef int (*vm_read_fn)(void *user, uint8_t *buf, int cap); // bytes read, 0 = end of input
+typedef void (*vm_write_fn)(void *user, const uint8_t *buf, int len);
+
+/*
+ * Native (host) function called by OP_NCALL.
+ * Arguments and results go through R0-R7, buffers are addresses into VM memory.
+ * A non-zero return value stops the VM with VM_ERR_NATIVE.
+ */
+typedef int (*vm_native_fn)(VM *vm);
+
+/* lifetime */
+VM *vm_create(void);
+VM *vm_create_sized(uint32_t memory_size, int mem_flags); // up to 64K, pages are zero-filled on first touch
+void vm_destroy(VM *vm);
+int vm_load_prog(VM *vm, const uint8_t *prog, size_t prog_size); // VBIN container or raw image at 0
+
+/* execution */
+int vm_run(VM *vm, uint32_t budget);
+void vm_set_io(VM *vm, vm_read_fn read, vm_write_fn write, void *user);
+int vm_register_native(VM *vm, uint8_t index, vm_native_fn fn);
+
+/* state */
+uint32_t vm_get_register(const VM *vm, int reg);
+void vm_set_register(VM *vm, int reg, uint32_t value);
+uint16_t vm_get_pc(const VM *vm);
+uint8_t vm_get_flags(const VM *vm);
+uint8_t *vm_memory(VM *vm, size_t *size);
+uint32_t vm_get_steps(const VM *vm);
+int vm_get_error(const VM *vm);
+const char *vm_error_string(int error);
+
+/* breakpoints, patched into the image: no cost until one is hit */
+int vm_break_set(VM *vm, uint16_t addr);
+int vm_break_clear(VM *vm, uint16_t addr);
+
+/* watchpoints, write-protected pages: only writes to those pages cost anything (Unix) */
+int vm_watch_set(VM *vm, uint16_t addr, uint16_t len);
+int vm_watch_clear(VM *vm, uint16_t addr);
+
+/* event loop host (Linux) */
+vm_host_t *vm_host_create(int capacity);
+int vm_host_add(vm_host_t *host, VM *vm, int in_fd, int out_fd);
+int vm_host_run(vm_host_t *host, uint32_t slice);
+void vm_host_destroy(vm_host_t *host);
+
+/* socket server (Unix) */
+int vm_server_run(const char *path, int workers);
+
+#endif
@@ -2,10 +2,30 @@
 #define VM_H
 
 #include <stdint.h>
+#include "libvm.h"
 
-#define MEMORY_SIZE 1024 // 1024 bytes of memory from 0x00 to 0x3FF
-#define REG_COUNT 8 // 8 register
+#define VM_VERSION 10 // bytecode decoding revision, cached analysis of another version is rebuilt
+#define MEMORY_SIZE 1024 // default memory, 1024 bytes from 0x00 to 0x3FF
+#define MEMORY_MAX 0x10000 // pc and addresses are 16-bit
+#define MEMORY_SLACK 16 // zero bytes past the end for operand fetches at the last addresses
+#define REG_COUNT 32 // R0-R31, a register operand is one byte
 #define STACK_SIZE 64 // stack size of 64 integers
+#define NATIVE_COUNT 32 // native function slots reachable through OP_NCALL
+#define THREAD_COUNT 8 // guest threads per VM, thread 0 is the main program
+#define THREAD_QUANTUM 64 // steps a thread runs before the scheduler switches
+#define INPUT_BUFFER_SIZE 256 // bytes of pending input per VM
+#define HOST_SLICE 1024 // steps an instance runs per event loop turn
+#define SERVER_WORKERS 4 // default worker threads in server mode
+#define SERVER_QUEUE 64 // accepted connections waiting for a worker
+#define SERVER_CACHE_SIZE 256 // cached programs, by hash
+#define SERVER_MAX_INPUT 65536 // input bytes per request
+#define SERVER_OUT_BUFFER 4096 // output collected before a frame is sent
+#define BREAKPOINT_COUNT 32 // breakpoints per VM, patched into memory as OP_BRK
+#define WATCHPOINT_COUNT 8 // watched ranges per VM, their pages are write-protected
+#define HEAP_GRAIN 8 // smallest ALLOC block, blocks are a power of two of grains
+#define HEAP_CLASSES 13 // block sizes 8 bytes to 32K
+#define HEAP_USED 0x80 // heap state of a block start, the low bits are its size class
+#define HEAP_FREE 0x40
 
 enum Opcodes {
     OP_HALT = 0x00,
@@ -48,8 +68,140 @@ enum Opcodes {
     OP_AND = 0x25,
     OP_OR = 0x26,
     OP_ORI = 0x27,
+    OP_NCALL = 0x28,
+    OP_SPAWN = 0x29,
+    OP_YIELD = 0x2A,
+    OP_JOIN = 0x2B,
+    OP_ADDIW = 0x2C, // 32-bit immediate forms, picked by vasm when the value needs them
+    OP_XORIW = 0x2D,
+    OP_ORIW = 0x2E,
+    OP_CMPIW = 0x2F,
+    OP_LOADW = 0x30,
+    OP_LDBX = 0x31, // addressing modes of LDB, LDW, STB and STORE: [Ra+Rb] (X), [Ra+disp] (D), [Ra]+ (P)
+    OP_LDBD = 0x32,
+    OP_LDBP = 0x33,
+    OP_LDWX = 0x34,
+    OP_LDWD = 0x35,
+    OP_LDWP = 0x36,
+    OP_STBX = 0x37,
+    OP_STBD = 0x38,
+    OP_STBP = 0x39,
+    OP_STORED = 0x3A, // STORE Rs, [Ra+Rb] is OP_STORE
+    OP_STOREP = 0x3B,
+    OP_DJNZ = 0x3C, // Rn - 1, jump unless zero
+    OP_BEQ = 0x3D,  // compare and jump, signed: Bcc Rs, Rt, addr / BccI Rs, imm, addr
+    OP_BNE = 0x3E,
+    OP_BLT = 0x3F,
+    OP_BLE = 0x40,
+    OP_BGT = 0x41,
+    OP_BGE = 0x42,
+    OP_BEQI = 0x43,
+    OP_BNEI = 0x44,
+    OP_BLTI = 0x45,
+    OP_BLEI = 0x46,
+    OP_BGTI = 0x47,
+    OP_BGEI = 0x48,
+    OP_JMPR = 0x49, // JMP Rn
+    OP_CALLR = 0x4A, // CALL Rn
+    OP_SWITCH = 0x4B, // SWITCH Rn, table: u16 count, then count code addresses, hi lo
+
+    /* dense forms written by vasm -z: the jump target as a signed byte from the end of the instruction */
+    OP_JMP_S = 0x4C,
+    OP_JE_S = 0x4D,
+    OP_JNE_S = 0x4E, // JNZ too
+    OP_JG_S = 0x4F,
+    OP_JGE_S = 0x50,
+    OP_JL_S = 0x51,
+    OP_JLE_S = 0x52,
+    OP_DJNZ_S = 0x53,
+    OP_BEQ_S = 0x54, // Rs and Rt in one byte, Rs in the high nibble
+    OP_BNE_S = 0x55,
+    OP_BLT_S = 0x56,
+    OP_BLE_S = 0x57,
+    OP_BGT_S = 0x58,
+    OP_BGE_S = 0x59,
+    OP_BEQI_S = 0x5A,
+    OP_BNEI_S = 0x5B,
+    OP_BLTI_S = 0x5C,
+    OP_BLEI_S = 0x5D,
+    OP_BGTI_S = 0x5E,
+    OP_BGEI_S = 0x5F,
 
     OP_NOP  = 0x60, /*Special*/
+
+    /* dense forms written by vasm -z: Rd and Rs of R0-R15 packed in one byte, Rd in the high nibble */
+    OP_ADD_PK = 0x61, // Rd:Rs, Rt
+    OP_SUB_PK = 0x62,
+    OP_MUL_PK = 0x63,
+    OP_DIV_PK = 0x64,
+    OP_AND_PK = 0x65,
+    OP_OR_PK = 0x66,
+    OP_XOR_PK = 0x67,
+    OP_SHL_PK = 0x68,
+    OP_SHR_PK = 0x69,
+    OP_ADDI_PK = 0x6A, // Rd:Rs, imm8
+    OP_XORI_PK = 0x6B,
+    OP_ORI_PK = 0x6C,
+    OP_SHLI_PK = 0x6D,
+    OP_SHRI_PK = 0x6E,
+    OP_MOV_PK = 0x6F, // Rd:Rs
+    OP_LDB_PK = 0x70, // Rd:Ra
+    OP_CMP_PK = 0x71, // Rs:Rt
+    OP_LOADB = 0x72, // LOAD Rd, imm8
+    OP_ALLOC = 0x73, // ALLOC Rd, Rs: zeroed block of Rs bytes from the heap, 0 if it is full
+    OP_FREE = 0x74, // FREE Rn: block back to its size class, Rn = 0 does nothing
+    OP_RESET = 0x75, // every block of the heap freed at once
+
+    /* the same instruction without the flag update, emitted by vasm -O where no
+       jump, DBG or call can read the flags it would set: base opcode | OP_FLAGLESS */
+    OP_FLAGLESS = 0x80,
+    OP_ADD_NF = 0x81,
+    OP_ADDI_NF = 0x82,
+    OP_SUB_NF = 0x83,
+    OP_MUL_NF = 0x84,
+    OP_DIV_NF = 0x85,
+    OP_MOV_NF = 0x86,
+    OP_POP_NF = 0x8D,
+    OP_LOAD_NF = 0x8E,
+    OP_XOR_NF = 0x8F,
+    OP_XORI_NF = 0x90,
+    OP_SHL_NF = 0x91,
+    OP_SHLI_NF = 0x92,
+    OP_SHR_NF = 0x93,
+    OP_SHRI_NF = 0x94,
+    OP_LDB_NF = 0xA2,
+    OP_AND_NF = 0xA5,
+    OP_OR_NF = 0xA6,
+    OP_ORI_NF = 0xA7,
+    OP_ADDIW_NF = 0xAC,
+    OP_XORIW_NF = 0xAD,
+    OP_ORIW_NF = 0xAE,
+    OP_LOADW_NF = 0xB0,
+    OP_LDBX_NF = 0xB1,
+    OP_LDBD_NF = 0xB2,
+    OP_LDBP_NF = 0xB3,
+    OP_LDWX_NF = 0xB4,
+    OP_LDWD_NF = 0xB5,
+    OP_LDWP_NF = 0xB6,
+    OP_ADD_PK_NF = 0xE1,
+    OP_SUB_PK_NF = 0xE2,
+    OP_MUL_PK_NF = 0xE3,
+    OP_DIV_PK_NF = 0xE4,
+    OP_AND_PK_NF = 0xE5,
+    OP_OR_PK_NF = 0xE6,
+    OP_XOR_PK_NF = 0xE7,
+    OP_SHL_PK_NF = 0xE8,
+    OP_SHR_PK_NF = 0xE9,
+    OP_ADDI_PK_NF = 0xEA,
+    OP_XORI_PK_NF = 0xEB,
+    OP_ORI_PK_NF = 0xEC,
+    OP_SHLI_PK_NF = 0xED,
+    OP_SHRI_PK_NF = 0xEE,
+    OP_MOV_PK_NF = 0xEF,
+    OP_LDB_PK_NF = 0xF0,
+    OP_LOADB_NF = 0xF2,
+
+    OP_BRK  = 0xFE, /*debugger trap*/
     OP_DBG  = 0xFF  /*opcodes*/
 };
 
@@ -60,22 +212,201 @@ typedef struct {
     uint8_t overflow_flag;
 } flags_t;
 
-typedef struct { // main vm struct
+enum ThreadState {
+    THREAD_FREE = 0,
+    THREAD_READY,
+    THREAD_BLOCKED_IO, // parked in OP_READ* until input arrives
+    THREAD_JOINING // waiting for thread join_id to finish
+};
+
+typedef struct { // saved context of a thread that is not running
+    uint16_t pc;
+    int8_t sp;
+    uint8_t state;
+    uint8_t join_id; // slot
+    uint8_t gen; // bumped by every SPAWN into the slot, the high byte of the thread id
     flags_t flags;
-    uint8_t memory[MEMORY_SIZE];
+    uint32_t registers[REG_COUNT];
+    int32_t stack[STACK_SIZE];
+} vm_thread_t;
+
+typedef struct {
+    vm_read_fn read;
+    vm_write_fn write;
+    void *user;
+    uint8_t buffer[INPUT_BUFFER_SIZE]; // input read but not consumed yet
+    uint16_t head;
+    uint16_t tail;
+    uint8_t eof;
+    uint8_t wait; // set when the VM suspended for input
+} vm_io_t;
+
+enum Natives { // builtin natives, indices are shared with vasm
+    NATIVE_MEMCPY = 0x00, // R0 = dst, R1 = src, R2 = len
+    NATIVE_MEMSET = 0x01, // R0 = dst, R1 = byte, R2 = len
+    NATIVE_STRLEN = 0x02, // R0 = addr -> R0 = length
+    NATIVE_SORT   = 0x03, // R0 = addr, R1 = len, sorts bytes ascending
+    NATIVE_HASH   = 0x04, // R0 = addr, R1 = len -> R0 = FNV-1a hash
+    NATIVE_CRC32  = 0x05, // R0 = addr, R1 = len -> R0 = CRC-32
+    NATIVE_ITOA   = 0x06, // R0 = value, R1 = dst -> R0 = length
+    NATIVE_ATOI   = 0x07, // R0 = addr -> R0 = value
+
+    NATIVE_BUILTIN_COUNT
+};
+
+#define VBIN_MAGIC "VBIN" // container written by vasm, see vm_loader.c
+#define VBIN_VERSION 1
+#define VBIN_HEADER_SIZE 16
+#define VBIN_SECTION_SIZE 12
+#define LOAD_MAX_FILE (1024 * 1024) // largest program file vm_load_prog_input() reads
+
+enum VbinSection {
+    VBIN_CODE = 1,
+    VBIN_DATA,
+    VBIN_BSS, // zero-filled, no bytes in the file
+    VBIN_SYMBOLS, // u16 address, u8 kind (section type), u8 length, name
+    VBIN_LINES // u16 address, u16 source line per instruction
+};
+
+typedef struct {
+    uint16_t address;
+    uint8_t kind; // VBIN_CODE, VBIN_DATA or VBIN_BSS
+    const char *name;
+} vm_symbol_t;
+
+typedef struct {
+    uint16_t address;
+    uint16_t line;
+} vm_line_t;
+
+typedef struct {
+    uint16_t addr;
+    uint8_t saved; // opcode byte under the OP_BRK
+} vm_breakpoint_t;
+
+typedef struct {
+    uint16_t addr;
+    uint16_t len;
+    uint8_t *value; // len bytes as last seen, then len bytes from before the last change
+} vm_watchpoint_t;
+
+typedef struct { // ALLOC/FREE bookkeeping, the blocks themselves live in guest memory
+    uint8_t *state; // per grain: HEAP_USED or HEAP_FREE | size class where a block starts, 0 otherwise
+    uint16_t *link; // free block: next one of its class (grain, 0 ends the list); used: bytes asked for
+    uint16_t free_head[HEAP_CLASSES];
+    uint16_t free_count[HEAP_CLASSES];
+    uint16_t used_count[HEAP_CLASSES];
+    uint32_t start; // first heap address, after code, data and bss
+    uint32_t top; // blocks are carved from here up to memory_size, 0 until the first ALLOC after a reset
+    uint32_t peak; // highest top so far, RESET does not lower it
+    uint32_t requested; // bytes asked for by the live blocks
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t failed; // ALLOC that returned 0
+    uint32_t resets;
+} vm_heap_t;
+
+typedef struct { // result of vm_analyze(), stored as is in the cache directory
+    uint8_t verified; // every reachable instruction decodes and every target is an instruction start
+    uint8_t fault; // VmError of the first problem found
+    uint16_t fault_pc;
+    uint32_t code_size; // end of the last reachable instruction
+    uint32_t instruction_count;
+    uint8_t starts[MEMORY_MAX / 8]; // bit per address, set where a reachable instruction begins
+} vm_analysis_t;
+
+struct VM { // main vm struct
+    flags_t flags;
+    uint8_t *memory; // paged in on first touch, see vm_memory.c
+    uint32_t memory_size;
+    uint32_t memory_map_size; // mapped bytes, slack and page rounding included
+    uint32_t image_size; // end of the loaded code and data
+    uint16_t entry; // pc after loading
+    uint32_t heap_base; // end of code, data and bss: ALLOC hands out memory from here
+    vm_heap_t heap; // its grain tables are allocated by vm_init(), so ALLOC never allocates
+    vm_symbol_t *symbols; // from the container, NULL for raw images
+    uint32_t symbol_count;
+    vm_line_t *lines;
+    uint32_t line_count;
+    const vm_analysis_t *analysis; // NULL until vm_analysis_get()
+    void *analysis_map; // cache file mapping behind analysis, NULL if it was malloc'd
+    size_t analysis_map_size;
     int8_t sp; // stack pointer
     uint8_t running;
+    uint8_t error; // VmError that stopped the VM
     uint16_t pc; // program count, current opcode
     uint32_t registers[REG_COUNT];
     int32_t stack[STACK_SIZE];
-} VM;
+    vm_native_fn natives[NATIVE_COUNT]; // OP_NCALL targets, NULL = free slot
+    vm_thread_t threads[THREAD_COUNT]; // the running thread lives in pc/sp/flags/registers/stack above
+    uint8_t current_thread;
+    uint8_t thread_count; // live threads
+    uint16_t slice; // steps since the last thread switch
+    uint32_t steps; // steps executed by vm_run()
+    vm_io_t io;
+    vm_breakpoint_t breakpoints[BREAKPOINT_COUNT];
+    uint8_t breakpoint_count;
+    uint8_t break_hit; // OP_BRK stopped the run loop
+    uint8_t break_skip; // next vm_run() starts by executing the instruction under the breakpoint at pc
+    vm_watchpoint_t watchpoints[WATCHPOINT_COUNT];
+    uint8_t watchpoint_count;
+    volatile uint8_t watch_hit; // set by the fault handler on a write to a watched page
+    uint8_t watch_running; // running before the handler cleared it
+    int8_t watch_index; // watchpoint that changed, -1 for none
+    uint16_t watch_pc; // pc when the write faulted, inside or just after the writing instruction
+    uint32_t *profile; // executions per address while profiling, NULL otherwise
+};
 
-void vm_init(VM *vm);
-//void vm_load_prog(VM *vm, uint8_t *prog, size_t prog_size);
-void vm_load_prog_input(VM *vm, const char *filename);
+int vm_init(VM *vm, uint32_t memory_size, uint8_t mem_flags);
+void vm_free(VM *vm);
+void vm_reset(VM *vm);
+void vm_unload(VM *vm);
+int vm_load_prog_input(VM *vm, const char *filename);
 void vm_step(VM *vm);
-void vm_run_with_limit(VM *vm, int step_limit);
+void vm_fault(VM *vm, uint8_t error);
 void set_flags_after_operation(VM *vm, int32_t result, uint32_t a, uint32_t b, uint8_t operation);
 void vm_dbg(VM *vm);
+void vm_natives_init(VM *vm);
+int vm_mem_alloc(VM *vm, uint32_t size, uint8_t flags);
+void vm_mem_clear(VM *vm);
+void vm_mem_free(VM *vm);
+int vm_instruction_length(uint8_t opcode);
+const char *vm_operand_format(uint8_t opcode);
+int vm_analyze(const uint8_t *code, uint32_t size, uint16_t entry, vm_analysis_t *a);
+const vm_analysis_t *vm_analysis_get(VM *vm, const char *cache_dir);
+void vm_analysis_release(VM *vm);
+int vm_is_vbin(const uint8_t *file, size_t size);
+int vm_load_vbin(VM *vm, const uint8_t *file, size_t size);
+void vm_debug_info_release(VM *vm);
+const vm_symbol_t *vm_symbol_at(const VM *vm, uint16_t addr);
+int vm_line_at(const VM *vm, uint16_t addr);
+void vm_break_step(VM *vm);
+uint8_t vm_break_peek(const VM *vm, uint16_t addr);
+int vm_debugger_run(VM *vm);
+void vm_watch_clear_all(VM *vm);
+int vm_profile_start(VM *vm);
+void vm_profile_release(VM *vm);
+int vm_profile_write(const VM *vm, const char *path);
+int vm_heap_init(VM *vm);
+void vm_heap_clear(VM *vm);
+uint32_t vm_heap_alloc(VM *vm, uint32_t size);
+int vm_heap_free(VM *vm, uint32_t addr);
+void vm_heap_reset(VM *vm);
+void vm_heap_release(VM *vm);
+void vm_heap_report(VM *vm);
+int vm_watch_check(VM *vm);
+void vm_threads_init(VM *vm);
+int vm_thread_spawn(VM *vm, uint16_t addr);
+void vm_thread_switch(VM *vm);
+void vm_thread_join(VM *vm, uint32_t tid);
+void vm_thread_exit(VM *vm);
+void vm_thread_block_io(VM *vm);
+void vm_io_init(VM *vm);
+void vm_io_write(VM *vm, const void *buf, int len);
+int vm_io_read_int(VM *vm, uint32_t *value);
+int vm_io_read_char(VM *vm, int *ch);
+int vm_io_read_line(VM *vm, char *out, int max_len);
+int vm_input_ready(void);
+void vm_input_wait(void);
 
 #endif
\ No newline at end of file
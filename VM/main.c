@@ -1,28 +1,106 @@
-#include "F:\PY\VM\headers\vm.h"
+#include "vm.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STEP_LIMIT 1000
+
+static int load(VM *vm, const char *filename) {
+    int bytes = vm_load_prog_input(vm, filename);
+    if (bytes < 0 && vm->error != VM_ERR_NONE) {
+        printf("Error: %s: %s\n", filename, vm_error_string(vm->error));
+        return 0;
+    }
+    if (bytes < 0) {
+        printf("Error: Cannot open file %s\n", filename);
+        return 0;
+    }
+    printf("Loaded %d bytes from %s\n", bytes, filename);
+
+    // VM_CACHE_DIR keeps the analysis between runs of the same program
+    const vm_analysis_t *analysis = vm_analysis_get(vm, getenv("VM_CACHE_DIR"));
+    if (analysis && !analysis->verified) {
+        printf("Warning: %s at %04X\n", vm_error_string(analysis->fault), analysis->fault_pc);
+    }
+    return 1;
+}
 
 int main(int argc, char *argv[]) {
     VM vm;
-    vm_init(&vm);
+    if (vm_init(&vm, MEMORY_SIZE, 0) != 0) {
+        printf("Error: cannot allocate VM memory.\n");
+        return 1;
+    }
+
+    if (argc > 2 && strcmp(argv[1], "--serve") == 0) { // run requests from a Unix socket
+        int workers = argc > 3 ? atoi(argv[3]) : SERVER_WORKERS;
+        printf("Serving on %s with %d workers\n", argv[2], workers);
+        fflush(stdout);
+        vm_server_run(argv[2], workers);
+        printf("Error: server mode is not available.\n");
+        vm_free(&vm);
+        return 1;
+    }
+
+    if (argc > 2 && strcmp(argv[1], "--host") == 0) { // run through the event loop
+        if (!load(&vm, argv[2])) return 1;
+        fflush(stdout);
+
+        vm_host_t *host = vm_host_create(1);
+        if (!host || vm_host_add(host, &vm, 0, 1) != 0) {
+            printf("Error: host mode is not available.\n");
+            return 1;
+        }
+        vm_host_run(host, HOST_SLICE);
+        vm_host_destroy(host);
+        int failed = vm.error != VM_ERR_NONE;
+        if (failed) printf("\nerror: %s at %04X\n", vm_error_string(vm.error), vm.pc);
+        else printf("\nprogram completed in %u steps.\n", vm.steps);
+        vm_free(&vm);
+        return failed;
+    }
+
+    if (argc > 2 && strcmp(argv[1], "--debug") == 0) { // interactive debugger on stdin
+        if (!load(&vm, argv[2])) return 1;
+        vm_debugger_run(&vm);
+        vm_free(&vm);
+        return 0;
+    }
+
+    const char *profile = NULL; // vm --profile out.prof program.bin
+    if (argc > 3 && strcmp(argv[1], "--profile") == 0) {
+        profile = argv[2];
+        argv += 2;
+        argc -= 2;
+    }
 
     if (argc > 1) {
-        vm_load_prog_input(&vm, argv[1]);
+        if (!load(&vm, argv[1])) return 1;
+        if (profile && vm_profile_start(&vm) != 0) {
+            printf("Error: cannot allocate the profile.\n");
+            return 1;
+        }
     } else {
         printf("No args were specified.");
         return 1;
     }
     
-    int step_count = 0;
-    while (vm.running) {
-        vm_step(&vm);
-        step_count++;
-        
-        if (step_count > 1000) {
-            printf("\ninfinite loop.\n");
-            break;
-        }
+    int status;
+    while ((status = vm_run(&vm, STEP_LIMIT - vm.steps)) == VM_STATUS_IO_WAIT) {
+        fflush(stdout);
+        vm_input_wait();
     }
-    
-    printf("\nprogram completed in %d steps.\n", step_count);
-    return 0;
-}
\ No newline at end of file
+    if (status == VM_STATUS_BUDGET) {
+        printf("\ninfinite loop.\n");
+    }
+    int failed = status == VM_STATUS_ERROR || vm.error != VM_ERR_NONE; // a fault is not a completed program
+    if (failed) printf("\nerror: %s at %04X\n", vm_error_string(vm.error), vm.pc);
+    else printf("\nprogram completed in %u steps.\n", vm.steps);
+    if (vm.heap.top) vm_heap_report(&vm);
+    if (profile) {
+        if (vm_profile_write(&vm, profile) == 0) printf("profile written to %s\n", profile);
+        else printf("Error: cannot write %s\n", profile);
+    }
+    vm_free(&vm);
+    return failed;
+}
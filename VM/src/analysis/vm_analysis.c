@@ -0,0 +1,302 @@
+#define _POSIX_C_SOURCE 200809L
+#include "vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Load-time analysis: walks every instruction reachable from the entry point and
+ * from SPAWN targets, marks where instructions start and checks opcodes,
+ * operands and jump targets. The result does not depend on anything but the
+ * image and VM_VERSION, so it is kept in a cache directory and mapped back
+ * on the next run of the same program.
+ */
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define VM_CACHE_FILES
+#endif
+
+#define CACHE_MAGIC 0x31434D56 // "VMC1"
+
+/*
+ * Operand layout per opcode, one character per byte:
+ * r register, b raw byte, w 16-bit immediate (2 chars), i 32-bit immediate
+ * (4 chars, high byte first), n native index, A 16-bit jump target (2 chars, hi lo),
+ * T 16-bit address of a jump table (2 chars, hi lo), p two registers of R0-R15 in one
+ * byte, S jump target as a signed byte from the end of the instruction.
+ */
+static const char *const op_format[256] = {
+    [OP_HALT] = "",     [OP_ADD] = "rrr",  [OP_ADDI] = "rrb", [OP_SUB] = "rrr",
+    [OP_MUL] = "rrr",   [OP_DIV] = "rrr",  [OP_MOV] = "rr",   [OP_CMP] = "rr",
+    [OP_JMP] = "AA",    [OP_JE] = "AA",    [OP_JG] = "AA",    [OP_JNZ] = "AA",
+    [OP_PUSH] = "r",    [OP_POP] = "r",    [OP_LOAD] = "rww", [OP_XOR] = "rrr",
+    [OP_XORI] = "rrb",  [OP_SHL] = "rrr",  [OP_SHLI] = "rrb", [OP_SHR] = "rrr",
+    [OP_SHRI] = "rrb",  [OP_STORE] = "rrr", [OP_CALL] = "AA", [OP_RET] = "",
+    [OP_STOREI] = "rb", [OP_PRINT] = "r",  [OP_PRINTC] = "r", [OP_READ] = "r",
+    [OP_READC] = "r",   [OP_READS] = "bb", [OP_JL] = "AA",    [OP_JLE] = "AA",
+    [OP_JGE] = "AA",    [OP_JNE] = "AA",   [OP_LDB] = "rr",   [OP_PRINTS] = "r",
+    [OP_CMPI] = "rb",   [OP_AND] = "rrr",  [OP_OR] = "rrr",   [OP_ORI] = "rrb",
+    [OP_NCALL] = "n",   [OP_SPAWN] = "rAA", [OP_YIELD] = "",  [OP_JOIN] = "r",
+    [OP_ADDIW] = "rriiii", [OP_XORIW] = "rriiii", [OP_ORIW] = "rriiii", [OP_CMPIW] = "riiii",
+    [OP_LOADW] = "riiii",
+    [OP_LDBX] = "rrr",  [OP_LDBD] = "rrb", [OP_LDBP] = "rr",  [OP_LDWX] = "rrr",
+    [OP_LDWD] = "rrb",  [OP_LDWP] = "rr",  [OP_STBX] = "rrr", [OP_STBD] = "rrb",
+    [OP_STBP] = "rr",   [OP_STORED] = "rrb", [OP_STOREP] = "rr",
+    [OP_DJNZ] = "rAA",  [OP_BEQ] = "rrAA", [OP_BNE] = "rrAA", [OP_BLT] = "rrAA",
+    [OP_BLE] = "rrAA",  [OP_BGT] = "rrAA", [OP_BGE] = "rrAA", [OP_BEQI] = "rbAA",
+    [OP_BNEI] = "rbAA", [OP_BLTI] = "rbAA", [OP_BLEI] = "rbAA", [OP_BGTI] = "rbAA",
+    [OP_BGEI] = "rbAA", [OP_JMPR] = "r",   [OP_CALLR] = "r",  [OP_SWITCH] = "rTT",
+    [OP_NOP] = "",      [OP_BRK] = "",     [OP_DBG] = "",
+    [OP_ADD_NF] = "rrr", [OP_ADDI_NF] = "rrb", [OP_SUB_NF] = "rrr", [OP_MUL_NF] = "rrr",
+    [OP_DIV_NF] = "rrr", [OP_MOV_NF] = "rr",   [OP_POP_NF] = "r",   [OP_LOAD_NF] = "rww",
+    [OP_XOR_NF] = "rrr", [OP_XORI_NF] = "rrb", [OP_SHL_NF] = "rrr", [OP_SHLI_NF] = "rrb",
+    [OP_SHR_NF] = "rrr", [OP_SHRI_NF] = "rrb", [OP_LDB_NF] = "rr",  [OP_AND_NF] = "rrr",
+    [OP_OR_NF] = "rrr",  [OP_ORI_NF] = "rrb",
+    [OP_ADDIW_NF] = "rriiii", [OP_XORIW_NF] = "rriiii", [OP_ORIW_NF] = "rriiii", [OP_LOADW_NF] = "riiii",
+    [OP_LDBX_NF] = "rrr", [OP_LDBD_NF] = "rrb", [OP_LDBP_NF] = "rr", [OP_LDWX_NF] = "rrr",
+    [OP_LDWD_NF] = "rrb", [OP_LDWP_NF] = "rr",
+    [OP_JMP_S] = "S",     [OP_JE_S] = "S",   [OP_JNE_S] = "S",  [OP_JG_S] = "S",
+    [OP_JGE_S] = "S",     [OP_JL_S] = "S",   [OP_JLE_S] = "S",  [OP_DJNZ_S] = "rS",
+    [OP_BEQ_S] = "pS",    [OP_BNE_S] = "pS", [OP_BLT_S] = "pS", [OP_BLE_S] = "pS",
+    [OP_BGT_S] = "pS",    [OP_BGE_S] = "pS", [OP_BEQI_S] = "rbS", [OP_BNEI_S] = "rbS",
+    [OP_BLTI_S] = "rbS",  [OP_BLEI_S] = "rbS", [OP_BGTI_S] = "rbS", [OP_BGEI_S] = "rbS",
+    [OP_ADD_PK] = "pr",   [OP_SUB_PK] = "pr", [OP_MUL_PK] = "pr", [OP_DIV_PK] = "pr",
+    [OP_AND_PK] = "pr",   [OP_OR_PK] = "pr",  [OP_XOR_PK] = "pr", [OP_SHL_PK] = "pr",
+    [OP_SHR_PK] = "pr",   [OP_ADDI_PK] = "pb", [OP_XORI_PK] = "pb", [OP_ORI_PK] = "pb",
+    [OP_SHLI_PK] = "pb",  [OP_SHRI_PK] = "pb", [OP_MOV_PK] = "p", [OP_LDB_PK] = "p",
+    [OP_CMP_PK] = "p",    [OP_LOADB] = "rb", [OP_ALLOC] = "rr", [OP_FREE] = "r",
+    [OP_RESET] = "",
+    [OP_ADD_PK_NF] = "pr", [OP_SUB_PK_NF] = "pr", [OP_MUL_PK_NF] = "pr", [OP_DIV_PK_NF] = "pr",
+    [OP_AND_PK_NF] = "pr", [OP_OR_PK_NF] = "pr",  [OP_XOR_PK_NF] = "pr", [OP_SHL_PK_NF] = "pr",
+    [OP_SHR_PK_NF] = "pr", [OP_ADDI_PK_NF] = "pb", [OP_XORI_PK_NF] = "pb", [OP_ORI_PK_NF] = "pb",
+    [OP_SHLI_PK_NF] = "pb", [OP_SHRI_PK_NF] = "pb", [OP_MOV_PK_NF] = "p", [OP_LDB_PK_NF] = "p",
+    [OP_LOADB_NF] = "rb"
+};
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version; // VM_VERSION that wrote the entry
+    uint64_t image_hash;
+    uint32_t image_size;
+    uint32_t checksum; // FNV-1a of the vm_analysis_t that follows
+} cache_header_t;
+
+static uint32_t fnv32(const void *data, size_t len) {
+    const uint8_t *p = data;
+    uint32_t h = 0x811C9DC5;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 0x01000193;
+    }
+    return h;
+}
+
+static uint64_t image_key(const uint8_t *image, uint32_t size, uint16_t entry) { // FNV-1a 64 over version, entry and image
+    uint64_t h = 0xCBF29CE484222325ull;
+    uint32_t prefix = VM_VERSION | (uint32_t)entry << 16;
+    for (int i = 0; i < 4; i++) {
+        h ^= (uint8_t)(prefix >> (8 * i));
+        h *= 0x100000001B3ull;
+    }
+    for (uint32_t i = 0; i < size; i++) {
+        h ^= image[i];
+        h *= 0x100000001B3ull;
+    }
+    return h;
+}
+
+#define BIT_SET(map, i) ((map)[(i) >> 3] |= (uint8_t)(1u << ((i) & 7)))
+#define BIT_GET(map, i) (((map)[(i) >> 3] >> ((i) & 7)) & 1)
+
+// length of the instruction at addr including the opcode, 0 for an unknown opcode
+int vm_instruction_length(uint8_t opcode) {
+    return op_format[opcode] ? 1 + (int)strlen(op_format[opcode]) : 0;
+}
+
+// operand layout as above, NULL for an unknown opcode
+const char *vm_operand_format(uint8_t opcode) {
+    return op_format[opcode];
+}
+
+static void fail(vm_analysis_t *a, uint8_t error, uint32_t pc) {
+    if (!a->verified) return; // keep the first problem
+    a->verified = 0;
+    a->fault = error;
+    a->fault_pc = (uint16_t)pc;
+}
+
+int vm_analyze(const uint8_t *code, uint32_t size, uint16_t entry, vm_analysis_t *a) {
+    memset(a, 0, sizeof(*a));
+    a->verified = 1;
+    if (size == 0) return 0;
+
+    uint8_t *operand = calloc(MEMORY_MAX / 8, 1); // bytes that belong to an instruction's operands
+    uint16_t *work = malloc(MEMORY_MAX * sizeof(uint16_t));
+    if (!operand || !work) {
+        free(operand);
+        free(work);
+        return -1;
+    }
+
+    int top = 0;
+    work[top++] = entry;
+    while (top > 0) {
+        uint32_t pc = work[--top];
+        for (;;) {
+            if (pc >= size) {
+                fail(a, VM_ERR_PC, pc);
+                break;
+            }
+            if (BIT_GET(a->starts, pc)) break; // already walked from here
+            if (BIT_GET(operand, pc)) { // jump into the middle of an instruction
+                fail(a, VM_ERR_PC, pc);
+                break;
+            }
+
+            uint8_t opcode = code[pc];
+            const char *format = op_format[opcode];
+            if (!format) {
+                fail(a, VM_ERR_OPCODE, pc);
+                break;
+            }
+            uint32_t len = 1 + (uint32_t)strlen(format);
+            if (pc + len > size) {
+                fail(a, VM_ERR_PC, pc);
+                break;
+            }
+
+            BIT_SET(a->starts, pc);
+            a->instruction_count++;
+            if (pc + len > a->code_size) a->code_size = pc + len;
+
+            int target = -1, table = -1;
+            for (uint32_t i = 0; format[i]; i++) {
+                uint32_t at = pc + 1 + i;
+                if (BIT_GET(a->starts, at)) fail(a, VM_ERR_PC, at);
+                BIT_SET(operand, at);
+                switch (format[i]) {
+                    case 'r': if (code[at] >= REG_COUNT) fail(a, VM_ERR_OPERAND, pc); break;
+                    case 'n': if (code[at] >= NATIVE_COUNT) fail(a, VM_ERR_OPERAND, pc); break;
+                    case 'A': if (format[i + 1] == 'A') target = (code[at] << 8) | code[at + 1]; break;
+                    case 'T': if (format[i + 1] == 'T') table = (code[at] << 8) | code[at + 1]; break;
+                    case 'S': {
+                        target = (int)(pc + len) + (int8_t)code[at];
+                        if (target < 0) fail(a, VM_ERR_PC, pc); // before address 0
+                        break;
+                    }
+                    default: break;
+                }
+            }
+
+            if (target >= 0 && top < MEMORY_MAX) work[top++] = (uint16_t)target;
+            if (table >= 0 && (uint32_t)table + 2 <= size) { // SWITCH: the entries of its table, as far as the image holds them
+                uint32_t count = (uint32_t)(code[table] << 8 | code[table + 1]);
+                for (uint32_t k = 0, at = (uint32_t)table + 2; k < count && at + 2 <= size && top < MEMORY_MAX; k++, at += 2)
+                    work[top++] = (uint16_t)(code[at] << 8 | code[at + 1]);
+            }
+            if (opcode == OP_JMP || opcode == OP_JMP_S || opcode == OP_JMPR || opcode == OP_RET || opcode == OP_HALT) break; // JMP Rn: not known here
+            pc += len;
+        }
+    }
+
+    free(operand);
+    free(work);
+    return 0;
+}
+
+void vm_analysis_release(VM *vm) {
+    if (!vm->analysis) return;
+#ifdef VM_CACHE_FILES
+    if (vm->analysis_map) {
+        munmap(vm->analysis_map, vm->analysis_map_size);
+    } else {
+        free((void *)vm->analysis);
+    }
+#else
+    free((void *)vm->analysis);
+#endif
+    vm->analysis = NULL;
+    vm->analysis_map = NULL;
+    vm->analysis_map_size = 0;
+}
+
+#ifdef VM_CACHE_FILES
+
+// maps a cache entry, NULL if it is missing, stale or corrupt
+static void *map_entry(const char *path, uint64_t key, uint32_t image_size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    size_t len = sizeof(cache_header_t) + sizeof(vm_analysis_t);
+    void *map = NULL;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size == len) {
+        map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) map = NULL;
+    }
+    close(fd);
+    if (!map) return NULL;
+
+    const cache_header_t *h = map;
+    if (h->magic != CACHE_MAGIC || h->version != VM_VERSION || h->image_hash != key
+        || h->image_size != image_size || h->checksum != fnv32(h + 1, sizeof(vm_analysis_t))) {
+        munmap(map, len);
+        return NULL;
+    }
+    return map;
+}
+
+// written next to the entry and renamed, a reader never sees half a file
+static void write_entry(const char *path, uint64_t key, uint32_t image_size, const vm_analysis_t *a) {
+    char tmp[1024];
+    snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", path, (long)getpid());
+
+    cache_header_t h = { CACHE_MAGIC, VM_VERSION, key, image_size, fnv32(a, sizeof(*a)) };
+    FILE *file = fopen(tmp, "wb");
+    if (!file) return;
+    int ok = fwrite(&h, sizeof(h), 1, file) == 1 && fwrite(a, sizeof(*a), 1, file) == 1;
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(tmp, path) != 0) remove(tmp);
+}
+
+#endif
+
+// analysis of the loaded image, from cache_dir when it has a valid entry; NULL cache_dir = no cache
+const vm_analysis_t *vm_analysis_get(VM *vm, const char *cache_dir) {
+    if (vm->analysis) return vm->analysis;
+
+#ifdef VM_CACHE_FILES
+    char path[1024];
+    uint64_t key = image_key(vm->memory, vm->image_size, vm->entry);
+    if (cache_dir) {
+        snprintf(path, sizeof(path), "%s/%016llx.vmc", cache_dir, (unsigned long long)key);
+        uint8_t *map = map_entry(path, key, vm->image_size);
+        if (map) {
+            vm->analysis_map = map;
+            vm->analysis_map_size = sizeof(cache_header_t) + sizeof(vm_analysis_t);
+            vm->analysis = (const vm_analysis_t *)(map + sizeof(cache_header_t));
+            return vm->analysis;
+        }
+    }
+#else
+    (void)cache_dir;
+    (void)image_key;
+    (void)fnv32;
+#endif
+
+    vm_analysis_t *a = malloc(sizeof(vm_analysis_t));
+    if (!a || vm_analyze(vm->memory, vm->image_size, vm->entry, a) != 0) {
+        free(a);
+        return NULL;
+    }
+    vm->analysis = a;
+
+#ifdef VM_CACHE_FILES
+    if (cache_dir) write_entry(path, key, vm->image_size, a);
+#endif
+    return a;
+}
@@ -0,0 +1,72 @@
+#include "vm.h"
+#include <stdlib.h>
+
+/* accessors behind libvm.h, the only code outside the core that needs struct VM */
+
+VM *vm_create(void) {
+    return vm_create_sized(MEMORY_SIZE, 0);
+}
+
+VM *vm_create_sized(uint32_t memory_size, int mem_flags) {
+    VM *vm = malloc(sizeof(VM));
+    if (vm && vm_init(vm, memory_size, (uint8_t)mem_flags) != 0) {
+        free(vm);
+        return NULL;
+    }
+    return vm;
+}
+
+void vm_destroy(VM *vm) {
+    if (!vm) return;
+    vm_free(vm);
+    free(vm);
+}
+
+uint32_t vm_get_register(const VM *vm, int reg) {
+    return reg >= 0 && reg < REG_COUNT ? vm->registers[reg] : 0;
+}
+
+void vm_set_register(VM *vm, int reg, uint32_t value) {
+    if (reg >= 0 && reg < REG_COUNT) vm->registers[reg] = value;
+}
+
+uint16_t vm_get_pc(const VM *vm) {
+    return vm->pc;
+}
+
+uint8_t vm_get_flags(const VM *vm) {
+    return (vm->flags.zero_flag ? VM_FLAG_ZERO : 0)
+         | (vm->flags.carry_flag ? VM_FLAG_CARRY : 0)
+         | (vm->flags.sign_flag ? VM_FLAG_SIGN : 0)
+         | (vm->flags.overflow_flag ? VM_FLAG_OVERFLOW : 0);
+}
+
+uint8_t *vm_memory(VM *vm, size_t *size) {
+    if (size) *size = vm->memory_size;
+    return vm->memory;
+}
+
+uint32_t vm_get_steps(const VM *vm) {
+    return vm->steps;
+}
+
+int vm_get_error(const VM *vm) {
+    return vm->error;
+}
+
+const char *vm_error_string(int error) {
+    switch (error) {
+        case VM_ERR_NONE:     return "no error";
+        case VM_ERR_PC:       return "pc out of bounds";
+        case VM_ERR_OPCODE:   return "unknown opcode";
+        case VM_ERR_DIV_ZERO: return "division by zero";
+        case VM_ERR_STACK:    return "stack overflow or underflow";
+        case VM_ERR_NATIVE:   return "native call failed";
+        case VM_ERR_DEADLOCK: return "all threads are blocked (deadlock)";
+        case VM_ERR_LOAD:     return "program does not fit into memory";
+        case VM_ERR_OPERAND:  return "operand out of range";
+        case VM_ERR_FORMAT:   return "invalid program container";
+        case VM_ERR_HEAP:     return "FREE of an address that ALLOC did not return";
+        default:              return "unknown error";
+    }
+}
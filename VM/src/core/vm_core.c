@@ -1,58 +1,151 @@
-#include "F:\PY\VM\headers\vm.h"
+#include "vm.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-void vm_init(VM *vm) {
-    for (int i = 0; i < REG_COUNT; i++) { vm->registers[i] = 0; }
-    for (int i = 0; i < MEMORY_SIZE; i++) { vm->memory[i] = 0; }
-    for (int i = 0; i < STACK_SIZE; i++) { vm->stack[i] = 0; }
-    
+// memory_size bytes of guest memory, zeroed lazily; -1 if it can't be mapped
+int vm_init(VM *vm, uint32_t memory_size, uint8_t mem_flags) {
+    if (vm_mem_alloc(vm, memory_size, mem_flags) != 0) return -1;
+    if (vm_heap_init(vm) != 0) {
+        vm_mem_free(vm);
+        return -1;
+    }
+    vm->image_size = 0;
+    vm->entry = 0;
+    vm->analysis = NULL;
+    vm->analysis_map = NULL;
+    vm->symbols = NULL;
+    vm->symbol_count = 0;
+    vm->lines = NULL;
+    vm->line_count = 0;
+    vm->breakpoint_count = 0;
+    vm->watchpoint_count = 0;
+    vm->watch_hit = 0;
+    vm->watch_index = -1;
+    vm->profile = NULL;
+    vm->heap_base = 0;
+    vm_natives_init(vm);
+    vm_io_init(vm);
+    vm_reset(vm);
+    return 0;
+}
+
+void vm_free(VM *vm) {
+    vm_watch_clear_all(vm);
+    vm_analysis_release(vm);
+    vm_debug_info_release(vm);
+    vm_profile_release(vm);
+    vm_heap_release(vm);
+    vm_mem_free(vm);
+}
+
+// cpu, threads, heap and pending input back to the initial state; memory, natives and io callbacks stay
+void vm_reset(VM *vm) {
+    memset(vm->registers, 0, sizeof(vm->registers));
+    memset(vm->stack, 0, sizeof(vm->stack));
+
     vm->sp = -1;
     vm->pc = 0;
     vm->running = 1;
+    vm->error = VM_ERR_NONE;
     vm->flags.zero_flag = 0;
     vm->flags.carry_flag = 0;
     vm->flags.sign_flag = 0;
     vm->flags.overflow_flag = 0;
+    vm->steps = 0;
+    vm_threads_init(vm);
+    vm_heap_clear(vm);
+    vm->io.head = 0;
+    vm->io.tail = 0;
+    vm->io.eof = 0;
+    vm->io.wait = 0;
+    vm->break_hit = 0;
+    vm->break_skip = 0;
+}
+
+void vm_fault(VM *vm, uint8_t error) {
+    vm->error = error;
+    vm->running = 0;
+}
+
+// runs until the program halts, waits for input, hits a breakpoint or watchpoint or has used up budget steps
+int vm_run(VM *vm, uint32_t budget) {
+    vm->io.wait = 0;
+    uint32_t steps = 0;
+    int watch = 0;
+    if (vm->watch_hit) vm_watch_check(vm); // the host wrote to a watched page between runs
+    if (vm->break_skip && vm->running && budget > 0) { // resuming on a breakpoint
+        vm->break_skip = 0;
+        vm_break_step(vm);
+        if (vm->io.wait) vm->break_skip = 1;
+        steps++;
+    }
+    do {
+        while (vm->running && !vm->io.wait && steps < budget) {
+            vm_step(vm);
+            steps++;
+        }
+    } while (vm->watch_hit && !(watch = vm_watch_check(vm))); // a write to a watched page, the range itself may be unchanged
+    if (vm->io.wait) steps--; // the suspended opcode runs again on resume
+    if (vm->break_hit) { // OP_BRK is not a step, the instruction under it runs on resume
+        vm->break_hit = 0;
+        vm->break_skip = 1;
+        vm->running = 1;
+        vm->steps += steps - 1;
+        return VM_STATUS_BREAK;
+    }
+    vm->steps += steps;
+
+    if (vm->error != VM_ERR_NONE) return VM_STATUS_ERROR;
+    if (watch) return VM_STATUS_WATCH;
+    if (!vm->running) return VM_STATUS_HALTED;
+    if (vm->io.wait) return VM_STATUS_IO_WAIT;
+    return VM_STATUS_BUDGET;
 }
 
-void vm_load_prog_input(VM *vm, const char *filename) {
+// drops the previous program: cpu state, analysis, debug info and memory
+void vm_unload(VM *vm) {
+    vm_watch_clear_all(vm);
+    vm_reset(vm);
+    vm_analysis_release(vm);
+    vm_debug_info_release(vm);
+    vm_mem_clear(vm);
+    vm->image_size = 0;
+    vm->heap_base = 0;
+    vm->entry = 0;
+    vm->breakpoint_count = 0;
+    if (vm->profile) vm_profile_start(vm); // the counts belonged to the old program
+}
+
+int vm_load_prog(VM *vm, const uint8_t *prog, size_t prog_size) {
+    if (vm_is_vbin(prog, prog_size)) {
+        return vm_load_vbin(vm, prog, prog_size);
+    }
+
+    // raw image: code and data loaded at 0, execution starts at 0
+    if (prog_size > vm->memory_size) {
+        vm_fault(vm, VM_ERR_LOAD);
+        return -1;
+    }
+    vm_unload(vm);
+    memcpy(vm->memory, prog, prog_size);
+    vm->image_size = (uint32_t)prog_size;
+    vm->heap_base = (uint32_t)prog_size;
+    return 0;
+}
+
+// returns the size of the file, -1 if it can't be opened or loaded (vm->error tells which)
+int vm_load_prog_input(VM *vm, const char *filename) {
     FILE *file = fopen(filename, "rb");
     if (!file) {
-        printf("Error: Cannot open file %s\n", filename);
-        return;
+        return -1;
     }
-    
-    memset(vm->memory, 0, MEMORY_SIZE);
-    
-    size_t bytes_read = fread(vm->memory, 1, MEMORY_SIZE, file);
+
+    uint8_t *buffer = malloc(LOAD_MAX_FILE);
+    size_t bytes_read = buffer ? fread(buffer, 1, LOAD_MAX_FILE, file) : 0;
     fclose(file);
-    
-    printf("Loaded %zu bytes from %s\n", bytes_read, filename);
-    vm->pc = 0;
-    vm->running = 1;
-}
 
-// void vm_load_prog(VM *vm, uint8_t *prog, size_t prog_size) {
-//     for (size_t i = 0; i < MEMORY_SIZE; i++) {
-//         vm->memory[i] = 0;
-//     }
-//     if (prog_size < MEMORY_SIZE) {
-//         for (size_t i = 0; i < prog_size; i++) {
-//             vm->memory[i] = prog[i];
-//         }
-//     }
-// }
-
-// void vm_run_with_limit(VM *vm, int step_limit) {
-//     int steps = 0;
-//     while (vm->running && steps < step_limit) {
-//         vm_step(vm);
-//         steps++;
-//     }
-//     if (steps >= step_limit) {
-//         printf("Step limit of %d reached. Halting VM.\n", step_limit);
-//         vm->running = 0;
-//     }
-// }
\ No newline at end of file
+    int result = buffer ? vm_load_prog(vm, buffer, bytes_read) : -1;
+    free(buffer);
+    return result == 0 ? (int)bytes_read : -1;
+}
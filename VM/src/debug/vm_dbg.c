@@ -1,33 +1,82 @@
-#include "F:\PY\VM\headers\vm.h"
+#include "vm.h"
+#include <stdarg.h>
 #include <stdio.h>
 
+// goes through the io callbacks so an embedder sees the dump where it sees program output
+static void dbg_print(VM *vm, const char *fmt, ...) {
+    char text[96];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(text, sizeof(text), fmt, args);
+    va_end(args);
+    if (len > (int)sizeof(text) - 1) len = sizeof(text) - 1;
+    if (len > 0) vm_io_write(vm, text, len);
+}
+
 void vm_dbg(VM *vm) {
-    printf("\n");
-    printf("PC: %02X  SP: %d\n", vm->pc, vm->sp);
-    printf("Flags: Z=%d S=%d C=%d O=%d\n", 
+    dbg_print(vm, "\n");
+    dbg_print(vm, "PC: %02X  SP: %d\n", vm->pc, vm->sp);
+    if (vm->thread_count > 1) {
+        dbg_print(vm, "Thread: %d (%d live)\n", vm->current_thread, vm->thread_count);
+    }
+    dbg_print(vm, "Flags: Z=%d S=%d C=%d O=%d\n", 
            vm->flags.zero_flag, vm->flags.sign_flag,
            vm->flags.carry_flag, vm->flags.overflow_flag);
     
-    printf("\nRegisters:\n");
+    dbg_print(vm, "\nRegisters:\n");
     for(int i = 0; i < REG_COUNT; i++) {
-        printf("R%d: %08X (%d)\n", i, vm->registers[i], (int32_t)vm->registers[i]);
+        if (i >= 8 && vm->registers[i] == 0) continue; // R8-R31 only when in use
+        dbg_print(vm, "R%d: %08X (%d)\n", i, vm->registers[i], (int32_t)vm->registers[i]);
     }
     
     if (vm->sp < 0) {
-        printf("\nStack: empty\n");
+        dbg_print(vm, "\nStack: empty\n");
     } else {
-        printf("\nStack:\n");
+        dbg_print(vm, "\nStack:\n");
         for(int i = vm->sp, j = 0; i >= 0 && j < 8; i--, j++) {
-            printf("[%d] %d\n", i, vm->stack[i]);
+            dbg_print(vm, "[%d] %d\n", i, vm->stack[i]);
         }
     }
 
-    printf("\nMemory (PC):\n");
-    for(int i = vm->pc - 4; i < vm->pc + 8 && i < MEMORY_SIZE; i++) {
+    if (vm->heap.top) {
+        uint32_t live = 0;
+        for (int c = 0; c < HEAP_CLASSES; c++) live += vm->heap.used_count[c];
+        dbg_print(vm, "\nHeap: %u live blocks, %u bytes asked for, top %04X\n", live, vm->heap.requested, vm->heap.top);
+    }
+
+    dbg_print(vm, "\nMemory (PC):\n");
+    for(int i = vm->pc - 4; i < vm->pc + 8 && i < (int)vm->memory_size; i++) {
         if(i >= 0) {
-            printf("%02X ", vm->memory[i]);
+            dbg_print(vm, "%02X ", vm_break_peek(vm, (uint16_t)i));
+        }
+    }
+    dbg_print(vm, "\n");
+    dbg_print(vm, "\n");
+}
+
+// live blocks against the bytes asked for (internal waste) and free-list blocks against the carved heap (external)
+void vm_heap_report(VM *vm) {
+    const vm_heap_t *h = &vm->heap;
+    uint32_t live = 0, live_bytes = 0, free_blocks = 0, free_bytes = 0;
+    for (int c = 0; c < HEAP_CLASSES; c++) {
+        live += h->used_count[c];
+        live_bytes += h->used_count[c] * ((uint32_t)HEAP_GRAIN << c);
+        free_blocks += h->free_count[c];
+        free_bytes += h->free_count[c] * ((uint32_t)HEAP_GRAIN << c);
+    }
+    uint32_t carved = h->top - h->start;
+
+    dbg_print(vm, "\nHeap: %04X-%04X, top %04X, peak %04X\n", h->start, vm->memory_size - 1, h->top, h->peak);
+    dbg_print(vm, "Live: %u blocks, %u bytes for %u asked (%u%% internal waste)\n", live, live_bytes, h->requested,
+              live_bytes ? (live_bytes - h->requested) * 100 / live_bytes : 0);
+    dbg_print(vm, "Free: %u blocks, %u bytes (%u%% of the carved heap)\n", free_blocks, free_bytes,
+              carved ? free_bytes * 100 / carved : 0);
+    dbg_print(vm, "ALLOC %u (%u failed), FREE %u, RESET %u\n", h->allocs, h->failed, h->frees, h->resets);
+    if (live + free_blocks == 0) return;
+    dbg_print(vm, "Block   Live   Free\n");
+    for (int c = 0; c < HEAP_CLASSES; c++) {
+        if (h->used_count[c] || h->free_count[c]) {
+            dbg_print(vm, "%5u  %5u  %5u\n", (uint32_t)HEAP_GRAIN << c, h->used_count[c], h->free_count[c]);
         }
     }
-    printf("\n");
-    printf("\n");
-}
\ No newline at end of file
+}
@@ -0,0 +1,370 @@
+#define _POSIX_C_SOURCE 200809L
+#include "vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+/*
+ * Breakpoints replace the opcode at their address with OP_BRK and keep the
+ * original byte. The run loop has no breakpoint check at all: OP_BRK stops
+ * it like any other opcode, and the next vm_run() executes the saved
+ * instruction once (vm_break_step) before running at full speed again.
+ */
+
+static vm_breakpoint_t *find_breakpoint(VM *vm, uint16_t addr) {
+    for (int i = 0; i < vm->breakpoint_count; i++) {
+        if (vm->breakpoints[i].addr == addr) return &vm->breakpoints[i];
+    }
+    return NULL;
+}
+
+// patches OP_BRK over the instruction at addr; -1 if addr is not an instruction start or the table is full
+int vm_break_set(VM *vm, uint16_t addr) {
+    if (addr >= vm->memory_size) return -1;
+    if (find_breakpoint(vm, addr)) return 0;
+
+    const vm_analysis_t *a = vm_analysis_get(vm, NULL); // before the first patch changes the image
+    if (a && !((a->starts[addr >> 3] >> (addr & 7)) & 1)) return -1;
+    if (vm->breakpoint_count == BREAKPOINT_COUNT) return -1;
+
+    vm_breakpoint_t *bp = &vm->breakpoints[vm->breakpoint_count++];
+    bp->addr = addr;
+    bp->saved = vm->memory[addr];
+    vm->memory[addr] = OP_BRK;
+    return 0;
+}
+
+int vm_break_clear(VM *vm, uint16_t addr) {
+    vm_breakpoint_t *bp = find_breakpoint(vm, addr);
+    if (!bp) return -1;
+    vm->memory[addr] = bp->saved;
+    *bp = vm->breakpoints[--vm->breakpoint_count];
+    return 0;
+}
+
+// executes the instruction at pc with its original opcode in place
+void vm_break_step(VM *vm) {
+    vm_breakpoint_t *bp = find_breakpoint(vm, vm->pc);
+    if (!bp) {
+        if (vm->pc < vm->memory_size && vm->memory[vm->pc] == OP_BRK) {
+            vm->pc++; // assembled into the program, nothing to restore
+        } else {
+            vm_step(vm);
+        }
+        return;
+    }
+    vm->memory[bp->addr] = bp->saved;
+    vm_step(vm);
+    vm->memory[bp->addr] = OP_BRK;
+}
+
+// memory as the program was loaded, breakpoints hidden
+uint8_t vm_break_peek(const VM *vm, uint16_t addr) {
+    for (int i = 0; i < vm->breakpoint_count; i++) {
+        if (vm->breakpoints[i].addr == addr) return vm->breakpoints[i].saved;
+    }
+    return addr < vm->memory_size ? vm->memory[addr] : 0;
+}
+
+/* interactive front end, vm --debug program.bin */
+
+static const char *const op_name[256] = {
+    [OP_HALT] = "HALT",   [OP_ADD] = "ADD",     [OP_ADDI] = "ADDI",   [OP_SUB] = "SUB",
+    [OP_MUL] = "MUL",     [OP_DIV] = "DIV",     [OP_MOV] = "MOV",     [OP_CMP] = "CMP",
+    [OP_JMP] = "JMP",     [OP_JE] = "JE",       [OP_JG] = "JG",       [OP_JNZ] = "JNZ",
+    [OP_PUSH] = "PUSH",   [OP_POP] = "POP",     [OP_LOAD] = "LOAD",   [OP_XOR] = "XOR",
+    [OP_XORI] = "XORI",   [OP_SHL] = "SHL",     [OP_SHLI] = "SHLI",   [OP_SHR] = "SHR",
+    [OP_SHRI] = "SHRI",   [OP_STORE] = "STORE", [OP_CALL] = "CALL",   [OP_RET] = "RET",
+    [OP_STOREI] = "STOREI", [OP_PRINT] = "PRINT", [OP_PRINTC] = "PRINTC", [OP_READ] = "READ",
+    [OP_READC] = "READC", [OP_READS] = "READS", [OP_JL] = "JL",       [OP_JLE] = "JLE",
+    [OP_JGE] = "JGE",     [OP_JNE] = "JNE",     [OP_LDB] = "LDB",     [OP_PRINTS] = "PRINTS",
+    [OP_CMPI] = "CMPI",   [OP_AND] = "AND",     [OP_OR] = "OR",       [OP_ORI] = "ORI",
+    [OP_NCALL] = "NCALL", [OP_SPAWN] = "SPAWN", [OP_YIELD] = "YIELD", [OP_JOIN] = "JOIN",
+    [OP_NOP] = "NOP",     [OP_BRK] = "BRK",     [OP_DBG] = "DBG",
+    [OP_ADDIW] = "ADDI",  [OP_XORIW] = "XORI",  [OP_ORIW] = "ORI",    [OP_CMPIW] = "CMPI",
+    [OP_LOADW] = "LOAD",
+    [OP_LDBX] = "LDBX",   [OP_LDBD] = "LDBD",   [OP_LDBP] = "LDBP",   [OP_LDWX] = "LDWX",
+    [OP_LDWD] = "LDWD",   [OP_LDWP] = "LDWP",   [OP_STBX] = "STBX",   [OP_STBD] = "STBD",
+    [OP_STBP] = "STBP",   [OP_STORED] = "STORED", [OP_STOREP] = "STOREP",
+    [OP_DJNZ] = "DJNZ",   [OP_BEQ] = "BEQ",     [OP_BNE] = "BNE",     [OP_BLT] = "BLT",
+    [OP_BLE] = "BLE",     [OP_BGT] = "BGT",     [OP_BGE] = "BGE",     [OP_BEQI] = "BEQI",
+    [OP_BNEI] = "BNEI",   [OP_BLTI] = "BLTI",   [OP_BLEI] = "BLEI",   [OP_BGTI] = "BGTI",
+    [OP_BGEI] = "BGEI",   [OP_JMPR] = "JMP",    [OP_CALLR] = "CALL",  [OP_SWITCH] = "SWITCH",
+    [OP_ADD_NF] = "ADD.NF",   [OP_ADDI_NF] = "ADDI.NF", [OP_SUB_NF] = "SUB.NF",   [OP_MUL_NF] = "MUL.NF",
+    [OP_DIV_NF] = "DIV.NF",   [OP_MOV_NF] = "MOV.NF",   [OP_POP_NF] = "POP.NF",   [OP_LOAD_NF] = "LOAD.NF",
+    [OP_XOR_NF] = "XOR.NF",   [OP_XORI_NF] = "XORI.NF", [OP_SHL_NF] = "SHL.NF",   [OP_SHLI_NF] = "SHLI.NF",
+    [OP_SHR_NF] = "SHR.NF",   [OP_SHRI_NF] = "SHRI.NF", [OP_LDB_NF] = "LDB.NF",   [OP_AND_NF] = "AND.NF",
+    [OP_OR_NF] = "OR.NF",     [OP_ORI_NF] = "ORI.NF",
+    [OP_ADDIW_NF] = "ADDI.NF", [OP_XORIW_NF] = "XORI.NF", [OP_ORIW_NF] = "ORI.NF", [OP_LOADW_NF] = "LOAD.NF",
+    [OP_LDBX_NF] = "LDBX.NF", [OP_LDBD_NF] = "LDBD.NF", [OP_LDBP_NF] = "LDBP.NF", [OP_LDWX_NF] = "LDWX.NF",
+    [OP_LDWD_NF] = "LDWD.NF", [OP_LDWP_NF] = "LDWP.NF",
+    [OP_JMP_S] = "JMP.S",     [OP_JE_S] = "JE.S",       [OP_JNE_S] = "JNE.S",     [OP_JG_S] = "JG.S",
+    [OP_JGE_S] = "JGE.S",     [OP_JL_S] = "JL.S",       [OP_JLE_S] = "JLE.S",     [OP_DJNZ_S] = "DJNZ.S",
+    [OP_BEQ_S] = "BEQ.S",     [OP_BNE_S] = "BNE.S",     [OP_BLT_S] = "BLT.S",     [OP_BLE_S] = "BLE.S",
+    [OP_BGT_S] = "BGT.S",     [OP_BGE_S] = "BGE.S",     [OP_BEQI_S] = "BEQI.S",   [OP_BNEI_S] = "BNEI.S",
+    [OP_BLTI_S] = "BLTI.S",   [OP_BLEI_S] = "BLEI.S",   [OP_BGTI_S] = "BGTI.S",   [OP_BGEI_S] = "BGEI.S",
+    [OP_ADD_PK] = "ADD",      [OP_SUB_PK] = "SUB",      [OP_MUL_PK] = "MUL",      [OP_DIV_PK] = "DIV",
+    [OP_AND_PK] = "AND",      [OP_OR_PK] = "OR",        [OP_XOR_PK] = "XOR",      [OP_SHL_PK] = "SHL",
+    [OP_SHR_PK] = "SHR",      [OP_ADDI_PK] = "ADDI",    [OP_XORI_PK] = "XORI",    [OP_ORI_PK] = "ORI",
+    [OP_SHLI_PK] = "SHLI",    [OP_SHRI_PK] = "SHRI",    [OP_MOV_PK] = "MOV",      [OP_LDB_PK] = "LDB",
+    [OP_CMP_PK] = "CMP",      [OP_LOADB] = "LOAD",      [OP_ALLOC] = "ALLOC",     [OP_FREE] = "FREE",
+    [OP_RESET] = "RESET",
+    [OP_ADD_PK_NF] = "ADD.NF", [OP_SUB_PK_NF] = "SUB.NF", [OP_MUL_PK_NF] = "MUL.NF", [OP_DIV_PK_NF] = "DIV.NF",
+    [OP_AND_PK_NF] = "AND.NF", [OP_OR_PK_NF] = "OR.NF",   [OP_XOR_PK_NF] = "XOR.NF", [OP_SHL_PK_NF] = "SHL.NF",
+    [OP_SHR_PK_NF] = "SHR.NF", [OP_ADDI_PK_NF] = "ADDI.NF", [OP_XORI_PK_NF] = "XORI.NF", [OP_ORI_PK_NF] = "ORI.NF",
+    [OP_SHLI_PK_NF] = "SHLI.NF", [OP_SHRI_PK_NF] = "SHRI.NF", [OP_MOV_PK_NF] = "MOV.NF", [OP_LDB_PK_NF] = "LDB.NF",
+    [OP_LOADB_NF] = "LOAD.NF"
+};
+
+// "label+off" for addr, or the bare address without symbols
+static void print_location(const VM *vm, uint16_t addr) {
+    const vm_symbol_t *s = vm_symbol_at(vm, addr);
+    printf("%04X", addr);
+    if (s && s->address == addr) printf(" <%s>", s->name);
+    else if (s) printf(" <%s+%d>", s->name, addr - s->address);
+}
+
+// one instruction at addr, returns its length (1 for an unknown opcode)
+static int print_instruction(const VM *vm, uint16_t addr) {
+    uint8_t opcode = vm_break_peek(vm, addr);
+    const char *format = vm_operand_format(opcode);
+    print_location(vm, addr);
+    int line = vm_line_at(vm, addr);
+    if (line > 0) printf(" line %d", line);
+
+    if (!format || !op_name[opcode]) {
+        printf(": db 0x%02X\n", opcode);
+        return 1;
+    }
+    printf(": %s", op_name[opcode]);
+    for (int i = 0; format[i]; i++) {
+        uint8_t b = vm_break_peek(vm, (uint16_t)(addr + 1 + i));
+        printf(i == 0 ? " " : ", ");
+        switch (format[i]) {
+            case 'r': printf("R%d", b); break;
+            case 'p': printf("R%d, R%d", b >> 4, b & 0x0F); break;
+            case 'n': printf("#%d", b); break;
+            case 'S': print_location(vm, (uint16_t)(addr + 1 + (int)strlen(format) + (int8_t)b)); break;
+            case 'i': {
+                uint32_t value = (uint32_t)b << 24;
+                for (int k = 1; k < 4; k++) value |= (uint32_t)vm_break_peek(vm, (uint16_t)(addr + 1 + i + k)) << (24 - 8 * k);
+                printf("%d", (int32_t)value);
+                i += 3;
+                break;
+            }
+            case 'w':
+            case 'A':
+            case 'T': {
+                uint16_t value = (uint16_t)(b << 8 | vm_break_peek(vm, (uint16_t)(addr + 2 + i)));
+                if (format[i] != 'w') print_location(vm, value);
+                else printf("%d", value);
+                i++;
+                break;
+            }
+            default: printf("%d", b); break;
+        }
+    }
+    printf("\n");
+    return 1 + (int)strlen(format);
+}
+
+// hex address, label or :line; -1 if it names nothing
+static int parse_location(const VM *vm, const char *text) {
+    if (!text) return -1;
+    if (text[0] == ':') {
+        int line = atoi(text + 1);
+        for (uint32_t i = 0; i < vm->line_count; i++) {
+            if (vm->lines[i].line == line) return vm->lines[i].address;
+        }
+        return -1;
+    }
+    for (uint32_t i = 0; i < vm->symbol_count; i++) {
+        if (strcmp(vm->symbols[i].name, text) == 0) return vm->symbols[i].address;
+    }
+    char *end;
+    unsigned long addr = strtoul(text, &end, 16);
+    return *end == '\0' && end != text && addr < vm->memory_size ? (int)addr : -1;
+}
+
+// a command line, read unbuffered so program input behind it stays in stdin
+static int read_command(char *line, int cap) {
+    int len = 0;
+    for (;;) {
+        char ch;
+#ifdef _WIN32
+        int n = _read(0, &ch, 1);
+#else
+        int n = (int)read(STDIN_FILENO, &ch, 1);
+#endif
+        if (n <= 0 && len == 0) return 0;
+        if (n <= 0 || ch == '\n') break;
+        if (len < cap - 1) line[len++] = ch;
+    }
+    line[len] = '\0';
+    return 1;
+}
+
+static int run(VM *vm, uint32_t budget) {
+    int status;
+    while ((status = vm_run(vm, budget)) == VM_STATUS_IO_WAIT) {
+        fflush(stdout);
+        vm_input_wait();
+    }
+    return status;
+}
+
+// start of the instruction that wrote a watched range, from the pc the fault handler saw
+static uint16_t watch_writer(VM *vm) {
+    const vm_analysis_t *a = vm_analysis_get(vm, NULL);
+    for (int addr = vm->watch_pc - 1; a && addr >= 0; addr--) {
+        if ((a->starts[addr >> 3] >> (addr & 7)) & 1) return (uint16_t)addr;
+    }
+    return vm->watch_pc;
+}
+
+static void print_watch(VM *vm) {
+    const vm_watchpoint_t *w = &vm->watchpoints[vm->watch_index];
+    printf("watch ");
+    print_location(vm, w->addr);
+    printf(":");
+    for (int i = 0; i < w->len && i < 8; i++) printf(" %02X", w->value[w->len + i]);
+    printf(" ->");
+    for (int i = 0; i < w->len && i < 8; i++) printf(" %02X", w->value[i]);
+    printf("%s\nwritten by ", w->len > 8 ? " ..." : "");
+    print_instruction(vm, watch_writer(vm));
+}
+
+// prints why the program stopped, 0 once it can't continue
+static int report(VM *vm, int status) {
+    switch (status) {
+        case VM_STATUS_HALTED:
+            printf("\nprogram halted after %u steps\n", vm->steps);
+            return 0;
+        case VM_STATUS_ERROR:
+            printf("\nerror: %s at ", vm_error_string(vm->error));
+            print_instruction(vm, vm->pc);
+            return 0;
+        case VM_STATUS_BREAK:
+            printf("break at ");
+            break;
+        case VM_STATUS_WATCH:
+            if (vm->watch_index >= 0) print_watch(vm);
+            break;
+        default:
+            break;
+    }
+    print_instruction(vm, vm->pc);
+    return 1;
+}
+
+static void print_help(void) {
+    printf("b <loc>      set a breakpoint (loc: hex address, label or :line)\n");
+    printf("d <loc>      delete a breakpoint\n");
+    printf("w <loc> [n]  stop when n bytes (default 4) at loc change\n");
+    printf("dw <loc>     delete a watchpoint\n");
+    printf("l            list breakpoints and watchpoints\n");
+    printf("c            continue\n");
+    printf("s [n]        step n instructions\n");
+    printf("r            registers, flags and stack\n");
+    printf("x <loc> [n]  dump n bytes of memory\n");
+    printf("u [loc] [n]  disassemble n instructions\n");
+    printf("heap         ALLOC blocks, free lists and fragmentation\n");
+    printf("q            quit\n");
+}
+
+// command loop on stdin, returns when the program ended or on q
+int vm_debugger_run(VM *vm) {
+    char line[128];
+    int alive = 1;
+    print_instruction(vm, vm->pc);
+
+    for (;;) {
+        printf("(vdb) ");
+        fflush(stdout);
+        if (!read_command(line, sizeof(line))) break;
+
+        char *cmd = strtok(line, " \t");
+        char *arg = strtok(NULL, " \t");
+        char *count = strtok(NULL, " \t");
+        if (!cmd) continue;
+
+        if (strcmp(cmd, "q") == 0) break;
+        if (strcmp(cmd, "h") == 0 || strcmp(cmd, "help") == 0) {
+            print_help();
+        } else if (strcmp(cmd, "b") == 0 || strcmp(cmd, "d") == 0) {
+            int addr = parse_location(vm, arg);
+            int ok = addr >= 0 && (cmd[0] == 'b' ? vm_break_set(vm, addr) : vm_break_clear(vm, addr)) == 0;
+            if (!ok) {
+                printf("no instruction at %s\n", arg ? arg : "?");
+            } else if (cmd[0] == 'b') {
+                printf("breakpoint at ");
+                print_instruction(vm, addr);
+            }
+        } else if (strcmp(cmd, "w") == 0 || strcmp(cmd, "dw") == 0) {
+            int addr = parse_location(vm, arg);
+            int len = count ? atoi(count) : 4;
+            int ok = addr >= 0 && (cmd[0] == 'w' ? vm_watch_set(vm, addr, (uint16_t)len) : vm_watch_clear(vm, addr)) == 0;
+            if (!ok) printf("cannot watch %s\n", arg ? arg : "?");
+        } else if (strcmp(cmd, "l") == 0) {
+            for (int i = 0; i < vm->breakpoint_count; i++) {
+                print_instruction(vm, vm->breakpoints[i].addr);
+            }
+            for (int i = 0; i < vm->watchpoint_count; i++) {
+                printf("watch ");
+                print_location(vm, vm->watchpoints[i].addr);
+                printf(", %d bytes\n", vm->watchpoints[i].len);
+            }
+        } else if (strcmp(cmd, "c") == 0 || strcmp(cmd, "s") == 0) {
+            if (!alive) {
+                printf("program is not running\n");
+                continue;
+            }
+            int status = VM_STATUS_BUDGET;
+            if (cmd[0] == 'c') {
+                while ((status = run(vm, 0xFFFFFFFFu)) == VM_STATUS_BUDGET) {}
+            } else {
+                for (int n = arg ? atoi(arg) : 1; n > 0 && status == VM_STATUS_BUDGET; n--) {
+                    status = run(vm, 1);
+                }
+            }
+            fflush(stdout);
+            alive = report(vm, status);
+        } else if (strcmp(cmd, "r") == 0) {
+            vm_dbg(vm);
+        } else if (strcmp(cmd, "heap") == 0) {
+            if (vm->heap.top) vm_heap_report(vm);
+            else printf("no ALLOC yet\n");
+        } else if (strcmp(cmd, "x") == 0) {
+            int addr = parse_location(vm, arg);
+            int n = count ? atoi(count) : 16;
+            if (addr < 0) {
+                printf("bad address\n");
+                continue;
+            }
+            for (int i = 0; i < n && addr + i < (int)vm->memory_size; i++) {
+                if (i % 16 == 0) {
+                    if (i > 0) printf("\n");
+                    print_location(vm, (uint16_t)(addr + i));
+                    printf(":");
+                }
+                printf(" %02X", vm_break_peek(vm, (uint16_t)(addr + i)));
+            }
+            printf("\n");
+        } else if (strcmp(cmd, "u") == 0) {
+            int addr = arg ? parse_location(vm, arg) : vm->pc;
+            int n = count ? atoi(count) : 8;
+            for (; addr >= 0 && addr < (int)vm->image_size && n > 0; n--) {
+                addr += print_instruction(vm, (uint16_t)addr);
+            }
+        } else {
+            printf("unknown command, h for help\n");
+        }
+    }
+    return alive;
+}
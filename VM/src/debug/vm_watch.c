@@ -0,0 +1,165 @@
+#define _DEFAULT_SOURCE
+#include "vm.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Watchpoints: the host pages behind a watched range are made read-only.
+ * Nothing in the run loop or the store opcodes checks anything; the first
+ * write to such a page faults, the signal handler opens the page again and
+ * clears vm->running, so the instruction completes and the loop stops after
+ * it. vm_run() then compares the watched bytes with their last value and
+ * either reports VM_STATUS_WATCH or protects the pages and carries on.
+ * Only writes to watched pages cost anything.
+ */
+
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(_WIN32)
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#define VM_WATCH_PAGES
+#endif
+
+#define WATCH_VMS 16 // VMs with watchpoints at the same time, the handler searches them
+
+#ifdef VM_WATCH_PAGES
+
+static VM *volatile watched[WATCH_VMS];
+static struct sigaction old_segv, old_bus;
+static volatile sig_atomic_t installed; // cleared when the handler hands the signals back
+static uintptr_t page_size;
+
+static void watch_fault(int sig, siginfo_t *info, void *context) {
+    (void)context;
+    uint8_t *addr = info->si_addr;
+    for (int i = 0; i < WATCH_VMS; i++) {
+        VM *vm = watched[i];
+        if (!vm || addr < vm->memory || addr >= vm->memory + vm->memory_map_size) continue;
+
+        mprotect((void *)((uintptr_t)addr & ~(page_size - 1)), page_size, PROT_READ | PROT_WRITE);
+        if (!vm->watch_hit) {
+            vm->watch_running = vm->running;
+            vm->watch_pc = vm->pc; // somewhere after the writing instruction's opcode
+            vm->watch_hit = 1;
+        }
+        vm->running = 0; // the write is retried and completes, the run loop stops after it
+        return;
+    }
+    // not a guest page: let the previous handlers (or the default action) see the fault again.
+    // Both go back, so the next watchpoint installs them afresh instead of saving this handler as the old one
+    (void)sig;
+    sigaction(SIGSEGV, &old_segv, NULL);
+    sigaction(SIGBUS, &old_bus, NULL);
+    installed = 0;
+}
+
+static int install_handler(void) {
+    if (installed) return 0;
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = watch_fault;
+    sa.sa_flags = SA_SIGINFO;
+    sigemptyset(&sa.sa_mask);
+    page_size = (uintptr_t)sysconf(_SC_PAGESIZE);
+    if (sigaction(SIGSEGV, &sa, &old_segv) != 0 || sigaction(SIGBUS, &sa, &old_bus) != 0) return -1;
+    installed = 1;
+    return 0;
+}
+
+static void protect(VM *vm, int prot) {
+    for (int i = 0; i < vm->watchpoint_count; i++) {
+        const vm_watchpoint_t *w = &vm->watchpoints[i];
+        uintptr_t start = (uintptr_t)(vm->memory + w->addr) & ~(page_size - 1);
+        uintptr_t end = (uintptr_t)(vm->memory + w->addr + w->len - 1) & ~(page_size - 1);
+        mprotect((void *)start, end - start + page_size, prot);
+    }
+}
+
+static int registry_add(VM *vm) {
+    int free_slot = -1;
+    for (int i = 0; i < WATCH_VMS; i++) {
+        if (watched[i] == vm) return 0;
+        if (!watched[i] && free_slot < 0) free_slot = i;
+    }
+    if (free_slot < 0) return -1;
+    watched[free_slot] = vm;
+    return 0;
+}
+
+static void registry_remove(VM *vm) {
+    for (int i = 0; i < WATCH_VMS; i++) {
+        if (watched[i] == vm) watched[i] = NULL;
+    }
+}
+
+#endif
+
+// stops vm_run() with VM_STATUS_WATCH when a byte of [addr, addr + len) changes; -1 if not available
+int vm_watch_set(VM *vm, uint16_t addr, uint16_t len) {
+#ifdef VM_WATCH_PAGES
+    if (len == 0 || addr >= vm->memory_size || len > vm->memory_size - addr) return -1;
+    if (vm->watchpoint_count == WATCHPOINT_COUNT || install_handler() != 0 || registry_add(vm) != 0) return -1;
+
+    uint8_t *value = malloc(2 * (size_t)len); // current value, then the one before the last change
+    if (!value) return -1;
+    protect(vm, PROT_READ | PROT_WRITE);
+    memcpy(value, vm->memory + addr, len);
+    memcpy(value + len, vm->memory + addr, len);
+
+    vm_watchpoint_t *w = &vm->watchpoints[vm->watchpoint_count++];
+    w->addr = addr;
+    w->len = len;
+    w->value = value;
+    protect(vm, PROT_READ);
+    return 0;
+#else
+    (void)vm; (void)addr; (void)len;
+    return -1;
+#endif
+}
+
+int vm_watch_clear(VM *vm, uint16_t addr) {
+#ifdef VM_WATCH_PAGES
+    for (int i = 0; i < vm->watchpoint_count; i++) {
+        if (vm->watchpoints[i].addr != addr) continue;
+        protect(vm, PROT_READ | PROT_WRITE);
+        free(vm->watchpoints[i].value);
+        vm->watchpoints[i] = vm->watchpoints[--vm->watchpoint_count];
+        if (vm->watchpoint_count > 0) protect(vm, PROT_READ);
+        else registry_remove(vm);
+        return 0;
+    }
+#else
+    (void)vm; (void)addr;
+#endif
+    return -1;
+}
+
+// before memory is reloaded or unmapped
+void vm_watch_clear_all(VM *vm) {
+    while (vm->watchpoint_count > 0) {
+        vm_watch_clear(vm, vm->watchpoints[0].addr);
+    }
+    vm->watch_hit = 0;
+}
+
+// after a write faulted: restores running, protects the pages again; 1 if a watched range changed
+int vm_watch_check(VM *vm) {
+    int changed = 0;
+    vm->watch_hit = 0;
+    vm->running = vm->error == VM_ERR_NONE ? vm->watch_running : 0;
+    vm->watch_index = -1;
+
+    for (int i = 0; i < vm->watchpoint_count; i++) {
+        vm_watchpoint_t *w = &vm->watchpoints[i];
+        if (memcmp(w->value, vm->memory + w->addr, w->len) == 0) continue;
+        memcpy(w->value + w->len, w->value, w->len);
+        memcpy(w->value, vm->memory + w->addr, w->len);
+        if (!changed) vm->watch_index = (int8_t)i;
+        changed = 1;
+    }
+#ifdef VM_WATCH_PAGES
+    protect(vm, PROT_READ);
+#endif
+    return changed;
+}
@@ -1,4 +1,4 @@
-#include "F:\PY\VM\headers\vm.h"
+#include "vm.h"
 
 /*
  *   OP_FLAG_ADD  = 0
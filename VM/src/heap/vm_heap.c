@@ -0,0 +1,145 @@
+#include "vm.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Heap behind ALLOC, FREE and RESET: the guest memory between the end of
+ * code, data and bss and the end of memory. Blocks are a power of two of
+ * HEAP_GRAIN bytes, one free list per size class. ALLOC takes a block of
+ * its class from the free list, else from the untouched part above top,
+ * else halves a larger free block down to the size; FREE puts it back on
+ * its list, halves are never merged again. RESET drops every block at once.
+ *
+ * The bookkeeping is outside guest memory, a state byte and a link per
+ * grain, so a program that writes past its block can't break the lists,
+ * and FREE of anything that is not a live block is caught. The grain
+ * tables are allocated with the VM; the heap itself opens on the first
+ * ALLOC after a reset, once the loader has said where the program ends.
+ */
+
+static uint32_t block_size(int c) {
+    return (uint32_t)HEAP_GRAIN << c;
+}
+
+// grain tables for the whole memory; -1 if they can't be allocated
+int vm_heap_init(VM *vm) {
+    uint32_t grains = (vm->memory_size + HEAP_GRAIN - 1) / HEAP_GRAIN;
+    memset(&vm->heap, 0, sizeof(vm->heap));
+    vm->heap.link = calloc(grains, sizeof(uint16_t) + sizeof(uint8_t));
+    if (!vm->heap.link) return -1;
+    vm->heap.state = (uint8_t *)(vm->heap.link + grains); // one allocation, the states after the links
+    return 0;
+}
+
+static void heap_open(VM *vm) {
+    vm_heap_t *h = &vm->heap;
+    uint32_t start = (vm->heap_base + HEAP_GRAIN - 1) & ~(uint32_t)(HEAP_GRAIN - 1);
+    h->start = start < HEAP_GRAIN ? HEAP_GRAIN : start; // 0 stays the failed ALLOC
+    h->top = h->start;
+    h->peak = h->start;
+}
+
+static void push_free(vm_heap_t *h, uint32_t addr, int c) {
+    uint32_t g = addr / HEAP_GRAIN;
+    h->state[g] = HEAP_FREE | c;
+    h->link[g] = h->free_head[c];
+    h->free_head[c] = (uint16_t)g;
+    h->free_count[c]++;
+}
+
+static uint32_t pop_free(vm_heap_t *h, int c) {
+    uint32_t g = h->free_head[c];
+    h->free_head[c] = h->link[g];
+    h->free_count[c]--;
+    return g * HEAP_GRAIN;
+}
+
+// address of a zeroed block of at least size bytes, 0 if there is none
+uint32_t vm_heap_alloc(VM *vm, uint32_t size) {
+    vm_heap_t *h = &vm->heap;
+    if (!h->top) heap_open(vm);
+    uint32_t end = vm->memory_size < MEMORY_MAX ? vm->memory_size : MEMORY_MAX;
+
+    int c = 0;
+    while (c < HEAP_CLASSES && block_size(c) < size) c++;
+    if (size == 0 || c == HEAP_CLASSES) {
+        h->failed++;
+        return 0;
+    }
+
+    uint32_t addr;
+    if (h->free_head[c]) {
+        addr = pop_free(h, c);
+    } else if (h->top <= end && block_size(c) <= end - h->top) {
+        addr = h->top;
+        h->top += block_size(c);
+        if (h->top > h->peak) h->peak = h->top;
+    } else {
+        int k = c + 1;
+        while (k < HEAP_CLASSES && !h->free_head[k]) k++;
+        if (k == HEAP_CLASSES) {
+            h->failed++;
+            return 0;
+        }
+        addr = pop_free(h, k);
+        while (k > c) { // the upper half of each split stays free
+            k--;
+            push_free(h, addr + block_size(k), k);
+        }
+    }
+
+    uint32_t g = addr / HEAP_GRAIN;
+    h->state[g] = HEAP_USED | c;
+    h->link[g] = (uint16_t)size;
+    h->used_count[c]++;
+    h->requested += size;
+    h->allocs++;
+    memset(vm->memory + addr, 0, block_size(c));
+    return addr;
+}
+
+// 0 when addr is a live block or 0, -1 for anything else
+int vm_heap_free(VM *vm, uint32_t addr) {
+    if (addr == 0) return 0;
+    vm_heap_t *h = &vm->heap;
+    if (!h->top || addr < h->start || addr >= h->top || addr % HEAP_GRAIN != 0) return -1;
+
+    uint32_t g = addr / HEAP_GRAIN;
+    if (!(h->state[g] & HEAP_USED)) return -1;
+    int c = h->state[g] & ~HEAP_USED;
+    h->requested -= h->link[g];
+    h->used_count[c]--;
+    h->frees++;
+    push_free(h, addr, c);
+    return 0;
+}
+
+static void drop_blocks(vm_heap_t *h) {
+    if (h->top) memset(h->state + h->start / HEAP_GRAIN, 0, (h->top - h->start) / HEAP_GRAIN);
+    memset(h->free_head, 0, sizeof(h->free_head));
+    memset(h->free_count, 0, sizeof(h->free_count));
+    memset(h->used_count, 0, sizeof(h->used_count));
+    h->requested = 0;
+}
+
+// RESET: every block freed at once; the counters go on
+void vm_heap_reset(VM *vm) {
+    vm_heap_t *h = &vm->heap;
+    drop_blocks(h);
+    if (h->top) h->top = h->start;
+    h->resets++;
+}
+
+// vm_reset(): blocks and counters gone, the next ALLOC opens the heap after the loaded program
+void vm_heap_clear(VM *vm) {
+    vm_heap_t *h = &vm->heap;
+    drop_blocks(h);
+    h->start = h->top = h->peak = 0;
+    h->allocs = h->frees = h->failed = h->resets = 0;
+}
+
+void vm_heap_release(VM *vm) {
+    free(vm->heap.link);
+    vm->heap.link = NULL;
+    vm->heap.state = NULL;
+}
@@ -0,0 +1,197 @@
+#define _POSIX_C_SOURCE 200809L
+#include "vm.h"
+#include <stdlib.h>
+
+/*
+ * Event loop host: many VM instances on one thread. An instance runs in
+ * slices until it halts or suspends in an input opcode; suspended instances
+ * sleep in epoll until their input fd becomes readable.
+ */
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+typedef struct {
+    VM *vm;
+    int in_fd;
+    int out_fd;
+    int in_flags; // fcntl flags of in_fd before it was made non-blocking
+    uint8_t waiting; // suspended for input
+    uint8_t done;
+} host_instance_t;
+
+struct vm_host {
+    int epfd;
+    int count;
+    int capacity;
+    host_instance_t *instances;
+    int *ready; // ring of runnable instance indices
+    int ready_head;
+    int ready_count;
+};
+
+static int host_read(void *user, uint8_t *buf, int cap) {
+    host_instance_t *inst = user;
+    ssize_t n = read(inst->in_fd, buf, cap);
+    if (n > 0) return (int)n;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return VM_IO_AGAIN;
+    return 0;
+}
+
+static void host_write(void *user, const uint8_t *buf, int len) {
+    host_instance_t *inst = user;
+    while (len > 0) {
+        ssize_t n = write(inst->out_fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) { // out_fd shares the non-blocking in_fd
+                struct pollfd pfd = { inst->out_fd, POLLOUT, 0 };
+                poll(&pfd, 1, -1);
+                continue;
+            }
+            return; // reader is gone, output is dropped
+        }
+        buf += n;
+        len -= (int)n;
+    }
+}
+
+static void push_ready(vm_host_t *host, int index) {
+    host->ready[(host->ready_head + host->ready_count) % host->capacity] = index;
+    host->ready_count++;
+}
+
+static int pop_ready(vm_host_t *host) {
+    int index = host->ready[host->ready_head];
+    host->ready_head = (host->ready_head + 1) % host->capacity;
+    host->ready_count--;
+    return index;
+}
+
+vm_host_t *vm_host_create(int capacity) {
+    vm_host_t *host = calloc(1, sizeof(vm_host_t));
+    if (!host) return NULL;
+
+    host->epfd = epoll_create1(0);
+    host->capacity = capacity;
+    host->instances = calloc(capacity, sizeof(host_instance_t));
+    host->ready = calloc(capacity, sizeof(int));
+    if (!host->instances || !host->ready || host->epfd < 0) {
+        vm_host_destroy(host);
+        return NULL;
+    }
+    return host;
+}
+
+// the VM reads from in_fd and writes to out_fd; every instance needs its own in_fd
+int vm_host_add(vm_host_t *host, VM *vm, int in_fd, int out_fd) {
+    if (host->count >= host->capacity) return -1;
+
+    int flags = fcntl(in_fd, F_GETFL);
+    if (flags < 0 || fcntl(in_fd, F_SETFL, flags | O_NONBLOCK) < 0) return -1;
+
+    int index = host->count;
+    host_instance_t *inst = &host->instances[index];
+    inst->vm = vm;
+    inst->in_fd = in_fd;
+    inst->out_fd = out_fd;
+    inst->in_flags = flags;
+    inst->waiting = 0;
+    inst->done = 0;
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u32 = index;
+    // regular files can't be polled, but they never make the reader wait either
+    if (epoll_ctl(host->epfd, EPOLL_CTL_ADD, in_fd, &ev) < 0 && errno != EPERM) {
+        fcntl(in_fd, F_SETFL, flags);
+        return -1;
+    }
+
+    vm_set_io(vm, host_read, host_write, inst);
+    host->count++;
+    push_ready(host, index);
+    return 0;
+}
+
+// runs every instance until it halts
+int vm_host_run(vm_host_t *host, uint32_t slice) {
+    struct epoll_event events[64];
+    int live = 0;
+    for (int i = 0; i < host->count; i++) {
+        if (!host->instances[i].done) live++;
+    }
+
+    while (live > 0) {
+        int runnable = host->ready_count;
+        for (int n = 0; n < runnable; n++) {
+            int index = pop_ready(host);
+            host_instance_t *inst = &host->instances[index];
+
+            int status = vm_run(inst->vm, slice);
+            if (status == VM_STATUS_HALTED || status == VM_STATUS_ERROR) {
+                inst->done = 1;
+                live--;
+                epoll_ctl(host->epfd, EPOLL_CTL_DEL, inst->in_fd, NULL);
+            } else if (status == VM_STATUS_IO_WAIT) {
+                inst->waiting = 1;
+            } else {
+                push_ready(host, index);
+            }
+        }
+        if (live == 0) break;
+
+        // sleep only when nothing is runnable
+        int n = epoll_wait(host->epfd, events, 64, host->ready_count > 0 ? 0 : -1);
+        if (n < 0 && errno != EINTR) return -1;
+        for (int i = 0; i < n; i++) {
+            host_instance_t *inst = &host->instances[events[i].data.u32];
+            if (inst->waiting && !inst->done) {
+                inst->waiting = 0;
+                push_ready(host, events[i].data.u32);
+            }
+        }
+    }
+    return 0;
+}
+
+void vm_host_destroy(vm_host_t *host) {
+    if (!host) return;
+    for (int i = 0; i < host->count; i++) {
+        host_instance_t *inst = &host->instances[i];
+        fcntl(inst->in_fd, F_SETFL, inst->in_flags);
+        vm_set_io(inst->vm, NULL, NULL, NULL);
+    }
+    if (host->epfd >= 0) close(host->epfd);
+    free(host->ready);
+    free(host->instances);
+    free(host);
+}
+
+#else // no epoll: host mode is not available
+
+vm_host_t *vm_host_create(int capacity) {
+    (void)capacity;
+    return NULL;
+}
+
+int vm_host_add(vm_host_t *host, VM *vm, int in_fd, int out_fd) {
+    (void)host; (void)vm; (void)in_fd; (void)out_fd;
+    return -1;
+}
+
+int vm_host_run(vm_host_t *host, uint32_t slice) {
+    (void)host; (void)slice;
+    return -1;
+}
+
+void vm_host_destroy(vm_host_t *host) {
+    (void)host;
+}
+
+#endif
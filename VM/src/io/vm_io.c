@@ -0,0 +1,197 @@
+#define _POSIX_C_SOURCE 200809L
+#include "vm.h"
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+/*
+ * Guest input goes through vm->io.buffer, refilled by the read callback.
+ * A callback that has nothing yet returns VM_IO_AGAIN, the input opcode
+ * then suspends instead of blocking the host thread.
+ */
+
+int vm_input_ready(void) {
+#ifdef _WIN32
+    HANDLE h = GetStdHandle(STD_INPUT_HANDLE);
+    DWORD avail = 0;
+    if (GetFileType(h) == FILE_TYPE_PIPE) {
+        return PeekNamedPipe(h, NULL, 0, NULL, &avail, NULL) && avail > 0;
+    }
+    return WaitForSingleObject(h, 0) == WAIT_OBJECT_0;
+#else
+    struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+    return poll(&pfd, 1, 0) > 0;
+#endif
+}
+
+void vm_input_wait(void) {
+#ifdef _WIN32
+    HANDLE h = GetStdHandle(STD_INPUT_HANDLE);
+    if (GetFileType(h) == FILE_TYPE_PIPE) {
+        while (!vm_input_ready()) { Sleep(1); }
+        return;
+    }
+    WaitForSingleObject(h, INFINITE);
+#else
+    struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+    poll(&pfd, 1, -1);
+#endif
+}
+
+static int stdin_read(void *user, uint8_t *buf, int cap) {
+    (void)user;
+    if (!vm_input_ready()) return VM_IO_AGAIN;
+#ifdef _WIN32
+    int n = _read(0, buf, cap);
+#else
+    int n = (int)read(STDIN_FILENO, buf, cap);
+#endif
+    return n > 0 ? n : 0;
+}
+
+static void stdout_write(void *user, const uint8_t *buf, int len) {
+    (void)user;
+    fwrite(buf, 1, len, stdout);
+}
+
+void vm_io_init(VM *vm) {
+    vm->io.read = stdin_read;
+    vm->io.write = stdout_write;
+    vm->io.user = NULL;
+    vm->io.head = 0;
+    vm->io.tail = 0;
+    vm->io.eof = 0;
+    vm->io.wait = 0;
+}
+
+// NULL keeps the stdin/stdout default for that direction
+void vm_set_io(VM *vm, vm_read_fn read, vm_write_fn write, void *user) {
+    vm->io.read = read ? read : stdin_read;
+    vm->io.write = write ? write : stdout_write;
+    vm->io.user = user;
+}
+
+void vm_io_write(VM *vm, const void *buf, int len) {
+    vm->io.write(vm->io.user, buf, len);
+}
+
+// 1 = new bytes, 0 = no more will come (end of input or buffer full), VM_IO_AGAIN = nothing yet
+static int fill(vm_io_t *io) {
+    if (io->eof) return 0;
+    if (io->head > 0) {
+        memmove(io->buffer, io->buffer + io->head, io->tail - io->head);
+        io->tail -= io->head;
+        io->head = 0;
+    }
+    if (io->tail == INPUT_BUFFER_SIZE) return 0;
+
+    int n = io->read(io->user, io->buffer + io->tail, INPUT_BUFFER_SIZE - io->tail);
+    if (n == VM_IO_AGAIN) return VM_IO_AGAIN;
+    if (n <= 0) {
+        io->eof = 1;
+        return 0;
+    }
+    io->tail += n;
+    return 1;
+}
+
+static int is_space(uint8_t c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// READ: decimal integer after optional whitespace, like scanf("%d")
+int vm_io_read_int(VM *vm, uint32_t *value) {
+    vm_io_t *io = &vm->io;
+    for (;;) {
+        int i = io->head;
+        while (i < io->tail && is_space(io->buffer[i])) i++;
+        int start = i;
+        if (i < io->tail && (io->buffer[i] == '-' || io->buffer[i] == '+')) i++;
+        int digits = i;
+        while (i < io->tail && io->buffer[i] >= '0' && io->buffer[i] <= '9') i++;
+
+        int r = 1;
+        if (i == io->tail && (r = fill(io)) != 0) {
+            if (r == VM_IO_AGAIN) return 0;
+            continue; // the number may go on in the new bytes
+        }
+
+        uint32_t v = 0;
+        for (int k = digits; k < i; k++) { v = v * 10 + (io->buffer[k] - '0'); }
+        if (start < digits && io->buffer[start] == '-') v = 0u - v;
+        if (i == digits) { // not a number: drop the token so the program can't spin on it
+            while (i < io->tail && !is_space(io->buffer[i])) i++;
+            v = 0;
+        }
+        io->head = i;
+        *value = v;
+        return 1;
+    }
+}
+
+// READC: next character, a leading newline is skipped once; -1 at end of input
+int vm_io_read_char(VM *vm, int *ch) {
+    vm_io_t *io = &vm->io;
+    for (;;) {
+        int avail = io->tail - io->head;
+        if (avail >= 1 && io->buffer[io->head] != '\n') {
+            *ch = io->buffer[io->head++];
+            return 1;
+        }
+        if (avail >= 2) {
+            *ch = io->buffer[io->head + 1];
+            io->head += 2;
+            return 1;
+        }
+
+        int r = fill(io);
+        if (r == VM_IO_AGAIN) return 0;
+        if (r == 0) {
+            io->head = io->tail;
+            *ch = -1;
+            return 1;
+        }
+    }
+}
+
+// READS: one line of at most max_len - 1 characters, like fgets() with the newline removed
+int vm_io_read_line(VM *vm, char *out, int max_len) {
+    vm_io_t *io = &vm->io;
+    int limit = max_len - 1;
+    if (limit <= 0) {
+        out[0] = '\0';
+        return 1;
+    }
+
+    for (;;) {
+        int avail = io->tail - io->head;
+        int scan = avail < limit ? avail : limit;
+        const uint8_t *nl = memchr(io->buffer + io->head, '\n', scan);
+
+        int len = -1, consumed = 0;
+        if (nl) {
+            len = (int)(nl - (io->buffer + io->head));
+            consumed = len + 1;
+        } else if (avail >= limit) {
+            len = consumed = limit;
+        } else {
+            int r = fill(io);
+            if (r == VM_IO_AGAIN) return 0;
+            if (r == 0) len = consumed = avail;
+        }
+
+        if (len >= 0) {
+            memcpy(out, io->buffer + io->head, len);
+            out[len] = '\0';
+            io->head += consumed;
+            return 1;
+        }
+    }
+}
@@ -0,0 +1,163 @@
+#include "vm.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * VBIN container written by vasm. All integers are little-endian.
+ *
+ * header   "VBIN", u16 version, u16 section count, u16 entry, u16 flags, u32 checksum
+ * section  u8 type, u8 log2 alignment, u16 load address, u32 file offset, u32 size
+ *
+ * The checksum is FNV-1a over everything after the header. CODE and DATA
+ * are copied to their load address, BSS only reserves its range (memory
+ * starts zeroed), SYMBOLS and LINES are kept for tools. The ALLOC heap
+ * starts after the highest of the three.
+ */
+
+static uint16_t get16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t fnv32(const uint8_t *p, size_t len) {
+    uint32_t h = 0x811C9DC5;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 0x01000193;
+    }
+    return h;
+}
+
+int vm_is_vbin(const uint8_t *file, size_t size) {
+    return size >= VBIN_HEADER_SIZE && memcmp(file, VBIN_MAGIC, 4) == 0;
+}
+
+void vm_debug_info_release(VM *vm) {
+    free(vm->symbols); // names live in the same block
+    free(vm->lines);
+    vm->symbols = NULL;
+    vm->symbol_count = 0;
+    vm->lines = NULL;
+    vm->line_count = 0;
+}
+
+// symbol entries: u16 address, u8 kind, u8 name length, name
+static int load_symbols(VM *vm, const uint8_t *p, uint32_t size) {
+    uint32_t count = 0, names = 0;
+    for (uint32_t at = 0; at < size; count++) {
+        if (size - at < 4 || size - at - 4 < p[at + 3]) return -1;
+        names += p[at + 3] + 1;
+        at += 4 + p[at + 3];
+    }
+    if (count == 0) return 0;
+
+    vm_symbol_t *symbols = malloc(count * sizeof(vm_symbol_t) + names);
+    if (!symbols) return -1;
+    char *name = (char *)(symbols + count);
+    for (uint32_t i = 0, at = 0; i < count; i++) {
+        uint8_t len = p[at + 3];
+        symbols[i].address = get16(p + at);
+        symbols[i].kind = p[at + 2];
+        symbols[i].name = name;
+        memcpy(name, p + at + 4, len);
+        name[len] = '\0';
+        name += len + 1;
+        at += 4 + len;
+    }
+    vm->symbols = symbols;
+    vm->symbol_count = count;
+    return 0;
+}
+
+static int load_lines(VM *vm, const uint8_t *p, uint32_t size) {
+    uint32_t count = size / 4;
+    vm_line_t *lines = malloc(count * sizeof(vm_line_t) + 1);
+    if (!lines) return -1;
+    for (uint32_t i = 0; i < count; i++) {
+        lines[i].address = get16(p + i * 4);
+        lines[i].line = get16(p + i * 4 + 2);
+    }
+    vm->lines = lines;
+    vm->line_count = count;
+    return 0;
+}
+
+// checks the whole container before anything is loaded; -1 leaves the VM faulted with VM_ERR_FORMAT
+int vm_load_vbin(VM *vm, const uint8_t *file, size_t size) {
+    uint16_t count = get16(file + 6);
+    uint16_t entry = get16(file + 8);
+    size_t table_end = VBIN_HEADER_SIZE + (size_t)count * VBIN_SECTION_SIZE;
+
+    if (get16(file + 4) != VBIN_VERSION || table_end > size || entry >= vm->memory_size
+        || fnv32(file + VBIN_HEADER_SIZE, size - VBIN_HEADER_SIZE) != get32(file + 12)) {
+        vm_fault(vm, VM_ERR_FORMAT);
+        return -1;
+    }
+
+    uint32_t image_end = 0, heap_base = 0;
+    for (uint16_t i = 0; i < count; i++) {
+        const uint8_t *s = file + VBIN_HEADER_SIZE + i * VBIN_SECTION_SIZE;
+        uint8_t type = s[0], align = s[1];
+        uint32_t addr = get16(s + 2), offset = get32(s + 4), len = get32(s + 8);
+
+        if (type != VBIN_BSS && (offset > size || len > size - offset)) {
+            vm_fault(vm, VM_ERR_FORMAT);
+            return -1;
+        }
+        if (type == VBIN_CODE || type == VBIN_DATA || type == VBIN_BSS) {
+            if (align > 15 || addr % (1u << align) != 0 || addr > vm->memory_size || len > vm->memory_size - addr) {
+                vm_fault(vm, VM_ERR_FORMAT);
+                return -1;
+            }
+            if (type != VBIN_BSS && addr + len > image_end) image_end = addr + len;
+            if (addr + len > heap_base) heap_base = addr + len;
+        }
+    }
+
+    vm_unload(vm);
+    for (uint16_t i = 0; i < count; i++) {
+        const uint8_t *s = file + VBIN_HEADER_SIZE + i * VBIN_SECTION_SIZE;
+        uint32_t addr = get16(s + 2), offset = get32(s + 4), len = get32(s + 8);
+        int result = 0;
+
+        switch (s[0]) {
+            case VBIN_CODE:
+            case VBIN_DATA: memcpy(vm->memory + addr, file + offset, len); break;
+            case VBIN_SYMBOLS: result = vm->symbols ? 0 : load_symbols(vm, file + offset, len); break;
+            case VBIN_LINES: result = vm->lines ? 0 : load_lines(vm, file + offset, len); break;
+            default: break; // BSS is already zero, unknown sections are skipped
+        }
+        if (result != 0) {
+            vm_debug_info_release(vm);
+            vm_fault(vm, VM_ERR_FORMAT);
+            return -1;
+        }
+    }
+
+    vm->entry = entry;
+    vm->pc = entry;
+    vm->image_size = image_end;
+    vm->heap_base = heap_base;
+    return 0;
+}
+
+// nearest symbol at or below addr, NULL without symbols
+const vm_symbol_t *vm_symbol_at(const VM *vm, uint16_t addr) {
+    const vm_symbol_t *best = NULL;
+    for (uint32_t i = 0; i < vm->symbol_count; i++) {
+        const vm_symbol_t *s = &vm->symbols[i];
+        if (s->address <= addr && (!best || s->address > best->address)) best = s;
+    }
+    return best;
+}
+
+// source line of the instruction at addr, 0 if unknown
+int vm_line_at(const VM *vm, uint16_t addr) {
+    for (uint32_t i = 0; i < vm->line_count; i++) {
+        if (vm->lines[i].address == addr) return vm->lines[i].line;
+    }
+    return 0;
+}
@@ -0,0 +1,110 @@
+#define _DEFAULT_SOURCE
+#include "vm.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Guest memory is an anonymous mapping: the OS hands out zeroed pages on
+ * first touch, so a large address space costs nothing until it is used and
+ * clearing it gives the pages back instead of writing zeros.
+ * MEMORY_SLACK zero bytes after the end let operand fetches at the last
+ * addresses read zeros instead of running off the mapping.
+ */
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define VM_MMAP
+#endif
+
+#define HUGE_PAGE_SIZE (2u * 1024 * 1024)
+
+static uint32_t page_size(void) {
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwPageSize;
+#elif defined(VM_MMAP)
+    return (uint32_t)sysconf(_SC_PAGESIZE);
+#else
+    return 1;
+#endif
+}
+
+static uint32_t round_up(uint32_t n, uint32_t align) {
+    return (n + align - 1) / align * align;
+}
+
+static void *map_pages(uint32_t *len, int huge) { // len grows to the huge page size
+#if defined(_WIN32)
+    if (huge) {
+        uint32_t huge_len = round_up(*len, (uint32_t)GetLargePageMinimum());
+        void *p = VirtualAlloc(NULL, huge_len, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+        if (p) {
+            *len = huge_len;
+            return p;
+        }
+    }
+    return VirtualAlloc(NULL, *len, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#elif defined(VM_MMAP)
+    void *p;
+#ifdef MAP_HUGETLB
+    if (huge) {
+        uint32_t huge_len = round_up(*len, HUGE_PAGE_SIZE);
+        p = mmap(NULL, huge_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            *len = huge_len;
+            return p;
+        }
+    }
+#endif
+    p = mmap(NULL, *len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+#else
+    (void)huge;
+    return calloc(1, *len);
+#endif
+}
+
+int vm_mem_alloc(VM *vm, uint32_t size, uint8_t flags) {
+    if (size == 0 || size > MEMORY_MAX) return -1;
+
+    uint32_t len = round_up(size + MEMORY_SLACK, page_size());
+    // huge pages pay off when the image is dense and touched anyway
+    uint8_t *memory = map_pages(&len, flags & VM_MEM_HUGE);
+    if (!memory) return -1;
+
+    vm->memory = memory;
+    vm->memory_size = size;
+    vm->memory_map_size = len;
+    return 0;
+}
+
+// every byte reads as zero again, touched pages go back to the OS
+void vm_mem_clear(VM *vm) {
+#if defined(_WIN32)
+    VirtualFree(vm->memory, vm->memory_map_size, MEM_DECOMMIT);
+    VirtualAlloc(vm->memory, vm->memory_map_size, MEM_COMMIT, PAGE_READWRITE);
+#elif defined(__linux__) // private anonymous pages read as zero after MADV_DONTNEED
+    if (madvise(vm->memory, vm->memory_map_size, MADV_DONTNEED) != 0) {
+        memset(vm->memory, 0, vm->memory_map_size);
+    }
+#else
+    memset(vm->memory, 0, vm->memory_map_size);
+#endif
+}
+
+void vm_mem_free(VM *vm) {
+    if (!vm->memory) return;
+#if defined(_WIN32)
+    VirtualFree(vm->memory, 0, MEM_RELEASE);
+#elif defined(VM_MMAP)
+    munmap(vm->memory, vm->memory_map_size);
+#else
+    free(vm->memory);
+#endif
+    vm->memory = NULL;
+    vm->memory_size = 0;
+}
@@ -0,0 +1,130 @@
+#include "vm.h"
+#include <string.h>
+
+/* buffer [addr, addr + len) must lie inside vm->memory */
+static int range_ok(const VM *vm, uint32_t addr, uint32_t len) {
+    return addr <= vm->memory_size && len <= vm->memory_size - addr;
+}
+
+static int native_memcpy(VM *vm) {
+    uint32_t dst = vm->registers[0], src = vm->registers[1], len = vm->registers[2];
+    if (!range_ok(vm, dst, len) || !range_ok(vm, src, len)) return -1;
+    memmove(&vm->memory[dst], &vm->memory[src], len);
+    return 0;
+}
+
+static int native_memset(VM *vm) {
+    uint32_t dst = vm->registers[0], len = vm->registers[2];
+    if (!range_ok(vm, dst, len)) return -1;
+    memset(&vm->memory[dst], (uint8_t)vm->registers[1], len);
+    return 0;
+}
+
+static int native_strlen(VM *vm) {
+    uint32_t addr = vm->registers[0];
+    if (addr >= vm->memory_size) return -1;
+    const uint8_t *end = memchr(&vm->memory[addr], 0, vm->memory_size - addr);
+    vm->registers[0] = end ? (uint32_t)(end - &vm->memory[addr]) : vm->memory_size - addr;
+    return 0;
+}
+
+static int native_sort(VM *vm) { // counting sort, bytes only
+    uint32_t addr = vm->registers[0], len = vm->registers[1];
+    if (!range_ok(vm, addr, len)) return -1;
+    uint16_t count[256] = {0};
+    for (uint32_t i = 0; i < len; i++) { count[vm->memory[addr + i]]++; }
+    uint8_t *out = &vm->memory[addr];
+    for (int b = 0; b < 256; b++) {
+        memset(out, b, count[b]);
+        out += count[b];
+    }
+    return 0;
+}
+
+static int native_hash(VM *vm) {
+    uint32_t addr = vm->registers[0], len = vm->registers[1];
+    if (!range_ok(vm, addr, len)) return -1;
+    uint32_t h = 0x811C9DC5;
+    for (uint32_t i = 0; i < len; i++) {
+        h ^= vm->memory[addr + i];
+        h *= 0x01000193;
+    }
+    vm->registers[0] = h;
+    return 0;
+}
+
+static int native_crc32(VM *vm) {
+    // half-byte table, constant so several VMs can share it across threads
+    static const uint32_t table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+    };
+
+    uint32_t addr = vm->registers[0], len = vm->registers[1];
+    if (!range_ok(vm, addr, len)) return -1;
+    uint32_t crc = 0xFFFFFFFF;
+    for (uint32_t i = 0; i < len; i++) {
+        crc ^= vm->memory[addr + i];
+        crc = table[crc & 0x0F] ^ (crc >> 4);
+        crc = table[crc & 0x0F] ^ (crc >> 4);
+    }
+    vm->registers[0] = crc ^ 0xFFFFFFFF;
+    return 0;
+}
+
+static int native_itoa(VM *vm) {
+    int32_t value = (int32_t)vm->registers[0];
+    uint32_t dst = vm->registers[1];
+    char buffer[12];
+    int len = 0;
+
+    uint32_t mag = value < 0 ? 0u - (uint32_t)value : (uint32_t)value;
+    do {
+        buffer[len++] = '0' + mag % 10;
+        mag /= 10;
+    } while (mag);
+    if (value < 0) buffer[len++] = '-';
+
+    if (!range_ok(vm, dst, len + 1)) return -1;
+    for (int i = 0; i < len; i++) { vm->memory[dst + i] = buffer[len - 1 - i]; }
+    vm->memory[dst + len] = '\0';
+    vm->registers[0] = len;
+    return 0;
+}
+
+static int native_atoi(VM *vm) {
+    uint32_t addr = vm->registers[0];
+    if (addr >= vm->memory_size) return -1;
+
+    int negative = 0;
+    uint32_t value = 0;
+    if (vm->memory[addr] == '-' || vm->memory[addr] == '+') {
+        negative = vm->memory[addr] == '-';
+        addr++;
+    }
+    while (addr < vm->memory_size && vm->memory[addr] >= '0' && vm->memory[addr] <= '9') {
+        value = value * 10 + (vm->memory[addr] - '0');
+        addr++;
+    }
+    vm->registers[0] = negative ? 0u - value : value;
+    return 0;
+}
+
+void vm_natives_init(VM *vm) {
+    for (int i = 0; i < NATIVE_COUNT; i++) { vm->natives[i] = NULL; }
+
+    vm->natives[NATIVE_MEMCPY] = native_memcpy;
+    vm->natives[NATIVE_MEMSET] = native_memset;
+    vm->natives[NATIVE_STRLEN] = native_strlen;
+    vm->natives[NATIVE_SORT]   = native_sort;
+    vm->natives[NATIVE_HASH]   = native_hash;
+    vm->natives[NATIVE_CRC32]  = native_crc32;
+    vm->natives[NATIVE_ITOA]   = native_itoa;
+    vm->natives[NATIVE_ATOI]   = native_atoi;
+}
+
+int vm_register_native(VM *vm, uint8_t index, vm_native_fn fn) {
+    if (!vm || index >= NATIVE_COUNT) return -1;
+    vm->natives[index] = fn;
+    return 0;
+}
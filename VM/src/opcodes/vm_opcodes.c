@@ -1,16 +1,98 @@
-#include "F:\PY\VM\headers\vm.h"
+#include "vm.h"
 #include <stdio.h>
 #include <string.h>
 
+// 32-bit immediate of the wide forms, high byte first; the caller checked it is inside memory
+static inline uint32_t fetch32(VM *vm) {
+    const uint8_t *p = &vm->memory[vm->pc];
+    vm->pc += 4;
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+enum { MEM_INDEX, MEM_DISP, MEM_POST }; // [Ra+Rb], [Ra+disp], [Ra]+
+
+// address of a memory operand, UINT32_MAX for a bad register; [Ra]+ moves Ra on by width
+static inline uint32_t fetch_address(VM *vm, int mode, uint32_t width) {
+    uint8_t reg_addr = vm->memory[vm->pc++];
+    uint8_t operand = mode == MEM_POST ? 0 : vm->memory[vm->pc++];
+    if (reg_addr >= REG_COUNT || (mode == MEM_INDEX && operand >= REG_COUNT)) return UINT32_MAX;
+
+    uint32_t addr = vm->registers[reg_addr] + (mode == MEM_INDEX ? vm->registers[operand] : operand);
+    if (mode == MEM_POST) vm->registers[reg_addr] += width;
+    return addr;
+}
+
+// full-width opcode behind each packed ALU form, OP_ADD_PK first
+static const uint8_t packed_base[] = {
+    OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_AND, OP_OR, OP_XOR, OP_SHL, OP_SHR,
+    OP_ADDI, OP_XORI, OP_ORI, OP_SHLI, OP_SHRI
+};
+
+// signed a / b; -1 after faulting on b = 0. INT32_MIN / -1 does not fit (and traps on x86): it wraps to INT32_MIN
+static int divide(VM *vm, uint32_t a, uint32_t b, uint32_t *result) {
+    if (b == 0) {
+        vm_fault(vm, VM_ERR_DIV_ZERO);
+        return -1;
+    }
+    if ((int32_t)a == INT32_MIN && (int32_t)b == -1) *result = a;
+    else *result = (uint32_t)((int32_t)a / (int32_t)b);
+    return 0;
+}
+
+// Rd:Rs, Rt or Rd:Rs, imm8: the result and the flags of the full-width opcode
+static void packed_alu(VM *vm, uint8_t opcode) {
+    uint8_t base = packed_base[(opcode & ~OP_FLAGLESS) - OP_ADD_PK];
+    uint8_t regs = vm->memory[vm->pc++];
+    uint8_t operand = vm->memory[vm->pc++];
+    uint8_t reg_dest = regs >> 4, reg_src1 = regs & 0x0F;
+    int imm = base == OP_ADDI || base == OP_XORI || base == OP_ORI || base == OP_SHLI || base == OP_SHRI;
+    if (!imm && operand >= REG_COUNT) return;
+
+    uint32_t a = vm->registers[reg_src1];
+    uint32_t b = imm ? operand : vm->registers[operand];
+    uint32_t result;
+    uint8_t operation;
+    switch (base) {
+        case OP_ADD: case OP_ADDI: result = a + b; operation = 0; break;
+        case OP_SUB: result = a - b; operation = 1; break;
+        case OP_MUL: result = (uint32_t)(int32_t)((int64_t)(int32_t)a * (int64_t)(int32_t)b); operation = 2; break;
+        case OP_DIV:
+            if (divide(vm, a, b, &result) != 0) return;
+            operation = 3;
+            break;
+        case OP_AND: result = a & b; operation = 4; break;
+        case OP_OR: case OP_ORI: result = a | b; operation = 5; break;
+        case OP_XOR: case OP_XORI: result = a ^ b; operation = 6; break;
+        case OP_SHL: case OP_SHLI: b &= 0x1F; result = a << b; operation = 7; break;
+        default: b &= 0x1F; result = a >> b; operation = 8; break; // OP_SHR, OP_SHRI
+    }
+    vm->registers[reg_dest] = result;
+    if (opcode & OP_FLAGLESS) return;
+    if (base == OP_MUL) set_flags_after_operation(vm, (int32_t)result, vm->registers[reg_src1], vm->registers[operand], 2); // as OP_MUL: read after the write
+    else set_flags_after_operation(vm, (int32_t)result, a, b, operation);
+}
+
+// target of a short jump: a signed byte from the end of the instruction
+static inline uint32_t short_target(VM *vm) {
+    int8_t rel = (int8_t)vm->memory[vm->pc++];
+    return (uint32_t)((int32_t)vm->pc + rel);
+}
+
 void vm_step(VM *vm) {
-    if (!vm || vm->pc >= MEMORY_SIZE) {
-        printf("PC out of bounds or VM is NULL.\n");
-        vm->running = 0;
+    if (vm->pc >= vm->memory_size) {
+        vm_fault(vm, VM_ERR_PC);
         return;
     }
 
+    if (vm->thread_count > 1 && ++vm->slice >= THREAD_QUANTUM) {
+        vm_thread_switch(vm);
+        if (!vm->running) return;
+    }
+
+    if (vm->profile) vm->profile[vm->pc]++;
+
     uint8_t opcode = vm->memory[vm->pc++];
-    uint8_t pc_before = vm->pc - 1;
+    uint16_t pc_before = vm->pc - 1;
     //printf("DEBUG: PC=%02X opcode=%02X\n", vm->pc-1, opcode);
 
     switch (opcode) {
@@ -24,7 +106,18 @@ void vm_step(VM *vm) {
             break;
         }
 
+        case OP_BRK: { // patched in by vm_break_set(), the run loop stops without checking anything per step
+            vm->pc = pc_before;
+            vm->break_hit = 1;
+            vm->running = 0;
+            break;
+        }
+
         case OP_HALT: {
+            if (vm->current_thread != 0) { // spawned threads only end themselves
+                vm_thread_exit(vm);
+                break;
+            }
             vm->running = 0;
             //printf("[%02X] HALT\n", pc_before);
             break;
@@ -33,7 +126,9 @@ void vm_step(VM *vm) {
         case OP_PRINT: {
             uint8_t reg = vm->memory[vm->pc++];
             if (reg < REG_COUNT) {
-                printf("%d", vm->registers[reg]);
+                char text[12];
+                int len = snprintf(text, sizeof(text), "%d", (int32_t)vm->registers[reg]);
+                vm_io_write(vm, text, len);
             }
             break;
         }
@@ -41,7 +136,8 @@ void vm_step(VM *vm) {
         case OP_PRINTC: {
             uint8_t reg = vm->memory[vm->pc++];
             if (reg < REG_COUNT) {
-                putchar((char)vm->registers[reg]);
+                char ch = (char)vm->registers[reg];
+                vm_io_write(vm, &ch, 1);
             }
             break;
         }
@@ -50,83 +146,87 @@ void vm_step(VM *vm) {
             uint8_t reg_addr = vm->memory[vm->pc++];
             if (reg_addr < REG_COUNT) {
                 uint16_t addr = vm->registers[reg_addr];
-                if (addr < MEMORY_SIZE) {
-                    for (uint16_t i = 0; addr + i < MEMORY_SIZE; i++) {
-                        char ch = vm->memory[addr + i];
-                        if (ch == 0) break;
-                        putchar(ch);
-                    }
+                if (addr < vm->memory_size) {
+                    const uint8_t *end = memchr(&vm->memory[addr], 0, vm->memory_size - addr);
+                    int len = end ? (int)(end - &vm->memory[addr]) : (int)(vm->memory_size - addr);
+                    vm_io_write(vm, &vm->memory[addr], len);
                 }
             }
             break;
         }
 
-        case OP_AND: {
+        case OP_AND:
+        case OP_AND_NF: {
             uint8_t reg_dest = vm->memory[vm->pc++];
             uint8_t reg_src1 = vm->memory[vm->pc++];
             uint8_t reg_src2 = vm->memory[vm->pc++];
             if (reg_dest < REG_COUNT && reg_src1 < REG_COUNT && reg_src2 < REG_COUNT) {
                 uint32_t result = vm->registers[reg_src1] & vm->registers[reg_src2];
                 vm->registers[reg_dest] = result;
-                set_flags_after_operation(vm, (int32_t)result, vm->registers[reg_src1], vm->registers[reg_src2], 4);
+                if (opcode == OP_AND) set_flags_after_operation(vm, (int32_t)result, vm->registers[reg_src1], vm->registers[reg_src2], 4);
                 //printf("[%02X] AND R%d,R%d,R%d\n", pc_before, reg_dest, reg_src1, reg_src2);
             }
             break;
         }
 
-        case OP_XOR: {
+        case OP_XOR:
+        case OP_XOR_NF: {
             uint8_t reg_dest = vm->memory[vm->pc++];
             uint8_t reg_src1 = vm->memory[vm->pc++];
             uint8_t reg_src2 = vm->memory[vm->pc++];
             if (reg_dest < REG_COUNT && reg_src1 < REG_COUNT && reg_src2 < REG_COUNT) {
                 uint32_t result = vm->registers[reg_src1] ^ vm->registers[reg_src2];
                 vm->registers[reg_dest] = result;
-                set_flags_after_operation(vm, (int32_t)result, vm->registers[reg_src1], vm->registers[reg_src2], 6);
+                if (opcode == OP_XOR) set_flags_after_operation(vm, (int32_t)result, vm->registers[reg_src1], vm->registers[reg_src2], 6);
                 //printf("[%02X] XOR R%d,R%d,R%d\n", pc_before, reg_dest, reg_src1, reg_src2);
             }
             break;
         }
 
-        case OP_XORI: {
+        case OP_XORI:
+        case OP_XORI_NF: {
             uint8_t reg_dest = vm->memory[vm->pc++];
             uint8_t reg_src1 = vm->memory[vm->pc++];
             uint8_t imm = vm->memory[vm->pc++];
             if (reg_dest < REG_COUNT && reg_src1 < REG_COUNT) {
                 uint32_t result = vm->registers[reg_src1] ^ imm;
                 vm->registers[reg_dest] = result;
-                set_flags_after_operation(vm, (int32_t)result, vm->registers[reg_src1], (uint32_t)imm, 6);
+                if (opcode == OP_XORI) set_flags_after_operation(vm, (int32_t)result, vm->registers[reg_src1], (uint32_t)imm, 6);
                 //printf("[%02X] XORI R%d,R%d,#%d\n", pc_before, reg_dest, reg_src1, imm);
             }
             break;
         }
 
-        case OP_OR: {
+        case OP_OR:
+        case OP_OR_NF: {
             uint8_t reg_dest = vm->memory[vm->pc++];
             uint8_t reg_src1 = vm->memory[vm->pc++];
             uint8_t reg_src2 = vm->memory[vm->pc++];
             if (reg_dest < REG_COUNT && reg_src1 < REG_COUNT && reg_src2 < REG_COUNT) {
                 uint32_t result = vm->registers[reg_src1] | vm->registers[reg_src2];
                 vm->registers[reg_dest] = result;
-                set_flags_after_operation(vm, (int32_t)result, vm->registers[reg_src1], vm->registers[reg_src2], 5);
+                if (opcode == OP_OR) set_flags_after_operation(vm, (int32_t)result, vm->registers[reg_src1], vm->registers[reg_src2], 5);
                 //printf("[%02X] OR R%d,R%d,R%d\n", pc_before, reg_dest, reg_src1, reg_src2);
             }
             break;
         }
 
-        case OP_ORI: {
+        case OP_ORI:
+        case OP_ORI_NF: {
             uint8_t reg_dest = vm->memory[vm->pc++];
             uint8_t reg_src1 = vm->memory[vm->pc++];
             uint8_t imm = vm->memory[vm->pc++];
             if (reg_dest < REG_COUNT && reg_src1 < REG_COUNT) {
                 uint32_t result = vm->registers[reg_src1] | imm;
                 vm->registers[reg_dest] = result;
-                set_flags_after_operation(vm, (int32_t)result, vm->registers[reg_src1], (uint32_t)imm, 5);
+                if (opcode == OP_ORI) set_flags_after_operation(vm, (int32_t)result, vm->registers[reg_src1], (uint32_t)imm, 5);
                 //printf("[%02X] OR R%d,R%d,R%d\n", pc_before, reg_dest, reg_src1, reg_src2);
             }
             break;
         }
 
-        case OP_SHL: {
+        case OP_SHL:
+        case OP_SHL_NF: {
             uint8_t reg_dest = vm->memory[vm->pc++];
             uint8_t reg_src1 = vm->memory[vm->pc++];
             uint8_t reg_src2 = vm->memory[vm->pc++];
@@ -135,13 +235,14 @@ void vm_step(VM *vm) {
                 uint32_t value = vm->registers[reg_src1];
                 uint32_t result = value << shift_amount;
                 vm->registers[reg_dest] = result;
-                set_flags_after_operation(vm, (int32_t)result, value, shift_amount, 7);
+                if (opcode == OP_SHL) set_flags_after_operation(vm, (int32_t)result, value, shift_amount, 7);
                 //printf("[%02X] SHL R%d,R%d,R%d\n", pc_before, reg_dest, reg_src1, reg_src2);
             }
             break;
         }
 
-        case OP_SHLI: {
+        case OP_SHLI:
+        case OP_SHLI_NF: {
             uint8_t reg_dest = vm->memory[vm->pc++];
             uint8_t reg_src1 = vm->memory[vm->pc++];
             uint8_t imm = vm->memory[vm->pc++];
@@ -150,13 +251,14 @@ void vm_step(VM *vm) {
                 uint32_t value = vm->registers[reg_src1];
                 uint32_t result = value << shift_amount;
                 vm->registers[reg_dest] = result;
-                set_flags_after_operation(vm, (int32_t)result, value, (uint32_t)shift_amount, 7);
+                if (opcode == OP_SHLI) set_flags_after_operation(vm, (int32_t)result, value, (uint32_t)shift_amount, 7);
                 //printf("[%02X] SHLI R%d,R%d,#%d\n", pc_before, reg_dest, reg_src1, shift_amount);
             }
             break;
         }
 
-        case OP_SHR: {
+        case OP_SHR:
+        case OP_SHR_NF: {
             uint8_t reg_dest = vm->memory[vm->pc++];
             uint8_t reg_src1 = vm->memory[vm->pc++];
             uint8_t reg_src2 = vm->memory[vm->pc++];
@@ -165,13 +267,14 @@ void vm_step(VM *vm) {
                 uint32_t value = vm->registers[reg_src1];
                 uint32_t result = value >> shift_amount;
                 vm->registers[reg_dest] = result;
-                set_flags_after_operation(vm, (int32_t)result, value, shift_amount, 8);
+                if (opcode == OP_SHR) set_flags_after_operation(vm, (int32_t)result, value, shift_amount, 8);
                 //printf("[%02X] SHR R%d,R%d,R%d\n", pc_before, reg_dest, reg_src1, reg_src2);
             }
             break;
         }
 
-        case OP_SHRI: {
+        case OP_SHRI:
+        case OP_SHRI_NF: {
             uint8_t reg_dest = vm->memory[vm->pc++];
             uint8_t reg_src1 = vm->memory[vm->pc++];
             uint8_t imm = vm->memory[vm->pc++];
@@ -180,13 +283,14 @@ void vm_step(VM *vm) {
                 uint32_t value = vm->registers[reg_src1];
                 uint32_t result = value >> shift_amount;
                 vm->registers[reg_dest] = result;
-                set_flags_after_operation(vm, (int32_t)result, value, (uint32_t)shift_amount, 8);
+                if (opcode == OP_SHRI) set_flags_after_operation(vm, (int32_t)result, value, (uint32_t)shift_amount, 8);
                 //printf("[%02X] SHRI R%d,R%d,#%d\n", pc_before, reg_dest, reg_src1, shift_amount);
             }
             break;
         }
 
-        case OP_ADD: {
+        case OP_ADD:
+        case OP_ADD_NF: {
             uint8_t reg_dest = vm->memory[vm->pc++];
             uint8_t reg_src1 = vm->memory[vm->pc++];
             uint8_t reg_src2 = vm->memory[vm->pc++];
@@ -195,13 +299,14 @@ void vm_step(VM *vm) {
                 uint32_t b = vm->registers[reg_src2];
                 int32_t result = (int32_t)a + (int32_t)b;
                 vm->registers[reg_dest] = (uint32_t)result;
-                set_flags_after_operation(vm, result, a, b, 0);
+                if (opcode == OP_ADD) set_flags_after_operation(vm, result, a, b, 0);
                 //printf("[%02X] ADD R%d,R%d,R%d\n", pc_before, reg_dest, reg_src1, reg_src2);
             }
             break;
         }
 
-        case OP_ADDI: {
+        case OP_ADDI:
+        case OP_ADDI_NF: {
             uint8_t reg_dest = vm->memory[vm->pc++];
             uint8_t reg_src1 = vm->memory[vm->pc++];
             uint8_t imm = vm->memory[vm->pc++];
@@ -210,13 +315,14 @@ void vm_step(VM *vm) {
                 uint32_t b = imm;
                 int32_t result = (int32_t)a + (int32_t)b;
                 vm->registers[reg_dest] = (uint32_t)result;
-                set_flags_after_operation(vm, result, a, b, 0);
+                if (opcode == OP_ADDI) set_flags_after_operation(vm, result, a, b, 0);
                 //printf("[%02X] ADDI R%d,R%d,#%d\n", pc_before, reg_dest, reg_src1, imm);
             }
             break;
         }
 
-        case OP_SUB: {
+        case OP_SUB:
+        case OP_SUB_NF: {
             uint8_t reg_dest = vm->memory[vm->pc++];
             uint8_t reg_src1 = vm->memory[vm->pc++];
             uint8_t reg_src2 = vm->memory[vm->pc++];
@@ -225,13 +331,14 @@ void vm_step(VM *vm) {
                 uint32_t b = vm->registers[reg_src2];
                 int32_t result = (int32_t)a - (int32_t)b;
                 vm->registers[reg_dest] = (uint32_t)result;
-                set_flags_after_operation(vm, result, a, b, 1);
+                if (opcode == OP_SUB) set_flags_after_operation(vm, result, a, b, 1);
                 //printf("[%02X] SUB R%d,R%d,R%d\n", pc_before, reg_dest, reg_src1, reg_src2);
             }
             break;
         }
 
-        case OP_MUL: {
+        case OP_MUL:
+        case OP_MUL_NF: {
             uint8_t reg_dest = vm->memory[vm->pc++];
             uint8_t reg_src1 = vm->memory[vm->pc++];
             uint8_t reg_src2 = vm->memory[vm->pc++];
@@ -240,36 +347,34 @@ void vm_step(VM *vm) {
                                    (int64_t)(int32_t)vm->registers[reg_src2];
                 int32_t result32 = (int32_t)result64;
                 vm->registers[reg_dest] = (uint32_t)result32;
-                set_flags_after_operation(vm, result32, vm->registers[reg_src1], vm->registers[reg_src2], 2);
+                if (opcode == OP_MUL) set_flags_after_operation(vm, result32, vm->registers[reg_src1], vm->registers[reg_src2], 2);
                 //printf("[%02X] MUL R%d,R%d,R%d\n", pc_before, reg_dest, reg_src1, reg_src2);
             }
             break;
         }
 
-        case OP_DIV: {
+        case OP_DIV:
+        case OP_DIV_NF: {
             uint8_t reg_dest = vm->memory[vm->pc++];
             uint8_t reg_src1 = vm->memory[vm->pc++];
             uint8_t reg_src2 = vm->memory[vm->pc++];
-            if (vm->registers[reg_src2] == 0) {
-                //printf("[%02X] DIV ERR\n", pc_before);
-                vm->running = 0;
-                return;
-            }
             if (reg_dest < REG_COUNT && reg_src1 < REG_COUNT && reg_src2 < REG_COUNT) {
-                int32_t result = (int32_t)vm->registers[reg_src1] / (int32_t)vm->registers[reg_src2];
-                vm->registers[reg_dest] = (uint32_t)result;
-                set_flags_after_operation(vm, result, vm->registers[reg_src1], vm->registers[reg_src2], 3);
+                uint32_t result;
+                if (divide(vm, vm->registers[reg_src1], vm->registers[reg_src2], &result) != 0) return;
+                vm->registers[reg_dest] = result;
+                if (opcode == OP_DIV) set_flags_after_operation(vm, (int32_t)result, vm->registers[reg_src1], vm->registers[reg_src2], 3);
                 //printf("[%02X] DIV R%d,R%d,R%d\n", pc_before, reg_dest, reg_src1, reg_src2);
             }
             break;
         }
 
-        case OP_MOV: {
+        case OP_MOV:
+        case OP_MOV_NF: {
             uint8_t reg_dest = vm->memory[vm->pc++];
             uint8_t reg_src = vm->memory[vm->pc++];
             if (reg_dest < REG_COUNT && reg_src < REG_COUNT) {
                 vm->registers[reg_dest] = vm->registers[reg_src];
-                set_flags_after_operation(vm, (int32_t)vm->registers[reg_dest], vm->registers[reg_dest], 0, 9);
+                if (opcode == OP_MOV) set_flags_after_operation(vm, (int32_t)vm->registers[reg_dest], vm->registers[reg_dest], 0, 9);
                 //printf("[%02X] MOV R%d,R%d\n", pc_before, reg_dest, reg_src);
             }
             break;
@@ -288,6 +393,89 @@ void vm_step(VM *vm) {
             break;
         }
 
+        case OP_ADDIW:
+        case OP_ADDIW_NF: {
+            uint8_t reg_dest = vm->memory[vm->pc++];
+            uint8_t reg_src1 = vm->memory[vm->pc++];
+            if (vm->pc + 3u >= vm->memory_size) {
+                vm_fault(vm, VM_ERR_PC);
+                return;
+            }
+            uint32_t imm = fetch32(vm);
+            if (reg_dest < REG_COUNT && reg_src1 < REG_COUNT) {
+                uint32_t a = vm->registers[reg_src1];
+                uint32_t result = a + imm;
+                vm->registers[reg_dest] = result;
+                if (opcode == OP_ADDIW) set_flags_after_operation(vm, (int32_t)result, a, imm, 0);
+            }
+            break;
+        }
+
+        case OP_XORIW:
+        case OP_XORIW_NF: {
+            uint8_t reg_dest = vm->memory[vm->pc++];
+            uint8_t reg_src1 = vm->memory[vm->pc++];
+            if (vm->pc + 3u >= vm->memory_size) {
+                vm_fault(vm, VM_ERR_PC);
+                return;
+            }
+            uint32_t imm = fetch32(vm);
+            if (reg_dest < REG_COUNT && reg_src1 < REG_COUNT) {
+                uint32_t a = vm->registers[reg_src1];
+                uint32_t result = a ^ imm;
+                vm->registers[reg_dest] = result;
+                if (opcode == OP_XORIW) set_flags_after_operation(vm, (int32_t)result, a, imm, 6);
+            }
+            break;
+        }
+
+        case OP_ORIW:
+        case OP_ORIW_NF: {
+            uint8_t reg_dest = vm->memory[vm->pc++];
+            uint8_t reg_src1 = vm->memory[vm->pc++];
+            if (vm->pc + 3u >= vm->memory_size) {
+                vm_fault(vm, VM_ERR_PC);
+                return;
+            }
+            uint32_t imm = fetch32(vm);
+            if (reg_dest < REG_COUNT && reg_src1 < REG_COUNT) {
+                uint32_t a = vm->registers[reg_src1];
+                uint32_t result = a | imm;
+                vm->registers[reg_dest] = result;
+                if (opcode == OP_ORIW) set_flags_after_operation(vm, (int32_t)result, a, imm, 5);
+            }
+            break;
+        }
+
+        case OP_CMPIW: {
+            uint8_t reg1 = vm->memory[vm->pc++];
+            if (vm->pc + 3u >= vm->memory_size) {
+                vm_fault(vm, VM_ERR_PC);
+                return;
+            }
+            uint32_t imm = fetch32(vm);
+            if (reg1 < REG_COUNT) {
+                uint32_t a = vm->registers[reg1];
+                set_flags_after_operation(vm, (int32_t)(a - imm), a, imm, 1);
+            }
+            break;
+        }
+
+        case OP_LOADW:
+        case OP_LOADW_NF: {
+            uint8_t reg = vm->memory[vm->pc++];
+            if (vm->pc + 3u >= vm->memory_size) {
+                vm_fault(vm, VM_ERR_PC);
+                return;
+            }
+            uint32_t value = fetch32(vm);
+            if (reg < REG_COUNT) {
+                vm->registers[reg] = value;
+                if (opcode == OP_LOADW) set_flags_after_operation(vm, (int32_t)value, value, 0, 10);
+            }
+            break;
+        }
+
         case OP_CMPI: {
             uint8_t reg1 = vm->memory[vm->pc++];
             uint8_t imm = vm->memory[vm->pc++];
@@ -301,42 +489,80 @@ void vm_step(VM *vm) {
             break;
         }
 
-        case OP_LOAD: {
+        case OP_LOAD:
+        case OP_LOAD_NF: {
             uint8_t reg = vm->memory[vm->pc++];
-            if (vm->pc + 1 >= MEMORY_SIZE) {
+            if (vm->pc + 1u >= vm->memory_size) {
                 //printf("[%02X] LOAD ERR\n", pc_before);
-                vm->running = 0;
+                vm_fault(vm, VM_ERR_PC);
                 return;
             }
             int32_t value = (vm->memory[vm->pc] << 8) | vm->memory[vm->pc + 1];
             vm->pc += 2;
             if (reg < REG_COUNT) {
                 vm->registers[reg] = value;
-                set_flags_after_operation(vm, value, (uint32_t)value, 0, 10);
+                if (opcode == OP_LOAD) set_flags_after_operation(vm, value, (uint32_t)value, 0, 10);
                 //printf("[%02X] LOAD R%d\n", pc_before, reg);
             }
             break;
         }
 
-        case OP_LDB: {
+        case OP_LDB:
+        case OP_LDB_NF: {
             uint8_t reg_dest = vm->memory[vm->pc++];
             uint8_t reg_addr = vm->memory[vm->pc++];
             
             if (reg_dest < REG_COUNT && reg_addr < REG_COUNT) {
                 uint16_t addr = vm->registers[reg_addr];
-                if (addr < MEMORY_SIZE) {
+                if (addr < vm->memory_size) {
                     vm->registers[reg_dest] = vm->memory[addr];
-                    set_flags_after_operation(vm, (int32_t)vm->registers[reg_dest], vm->registers[reg_dest], 0, 11);
+                    if (opcode == OP_LDB) set_flags_after_operation(vm, (int32_t)vm->registers[reg_dest], vm->registers[reg_dest], 0, 11);
                     //printf("[0x%02X] LDB  R%d, [R%d]  ; R%d = memory[0x%04X] = 0x%02X\n", pc_before, reg_dest, reg_addr, reg_dest, addr, vm->registers[reg_dest]);
                 }
             }
             break;
         }
 
+        // LDB/LDW Rd, [Ra+Rb] | [Ra+disp] | [Ra]+ ; Rd is left alone outside memory
+        case OP_LDBX: case OP_LDBD: case OP_LDBP: case OP_LDWX: case OP_LDWD: case OP_LDWP:
+        case OP_LDBX_NF: case OP_LDBD_NF: case OP_LDBP_NF: case OP_LDWX_NF: case OP_LDWD_NF: case OP_LDWP_NF: {
+            uint8_t base = opcode & ~OP_FLAGLESS;
+            uint32_t width = base >= OP_LDWX ? 4 : 1;
+            uint8_t reg_dest = vm->memory[vm->pc++];
+            uint32_t addr = fetch_address(vm, (base - OP_LDBX) % 3, width);
+
+            if (reg_dest < REG_COUNT && addr < vm->memory_size && vm->memory_size - addr >= width) {
+                uint32_t value = 0;
+                for (uint32_t i = 0; i < width; i++) value = value << 8 | vm->memory[addr + i]; // big-endian
+                vm->registers[reg_dest] = value;
+                if (opcode == base) set_flags_after_operation(vm, (int32_t)value, value, 0, width == 4 ? 10 : 11);
+            }
+            break;
+        }
+
+        // STB/STORE Rs, [Ra+Rb] | [Ra+disp] | [Ra]+ ; nothing is written outside memory
+        case OP_STBX: case OP_STBD: case OP_STBP: case OP_STORED: case OP_STOREP: {
+            uint32_t width = opcode >= OP_STORED ? 4 : 1;
+            int mode = opcode == OP_STORED ? MEM_DISP : opcode == OP_STOREP ? MEM_POST : opcode - OP_STBX;
+            uint8_t reg = vm->memory[vm->pc++];
+            uint32_t value = reg < REG_COUNT ? vm->registers[reg] : 0; // before [Ra]+ moves Ra
+            uint32_t addr = fetch_address(vm, mode, width);
+
+            if (reg < REG_COUNT && addr < vm->memory_size && vm->memory_size - addr >= width) {
+                for (uint32_t i = 0; i < width; i++) vm->memory[addr + i] = (uint8_t)(value >> (8 * (width - 1 - i)));
+            }
+            break;
+        }
+
         case OP_STORE: {
             uint8_t reg = vm->memory[vm->pc++];
-            uint8_t addr = vm->memory[vm->pc++];
-            if (reg < REG_COUNT && addr < MEMORY_SIZE) {
+            uint8_t reg_addr = vm->memory[vm->pc++];
+            uint8_t reg_off = vm->memory[vm->pc++];
+            uint32_t addr = UINT32_MAX;
+            if (reg_addr < REG_COUNT && reg_off < REG_COUNT) {
+                addr = vm->registers[reg_addr] + vm->registers[reg_off]; // memory[Ra + Rb]
+            }
+            if (reg < REG_COUNT && addr < vm->memory_size && vm->memory_size - addr >= 4) {
                 union {
                     uint32_t u32;
                     uint8_t bytes[4];
@@ -345,7 +571,7 @@ void vm_step(VM *vm) {
                 for (int i = 0; i < 4; i++) {
                     vm->memory[addr + i] = data.bytes[3 - i];
                 }
-                //printf("[%02X] STORE R%d,[%02X]\n", pc_before, reg, addr);
+                //printf("[%02X] STORE R%d,[%04X]\n", pc_before, reg, addr);
             }
             break;
         }
@@ -353,7 +579,7 @@ void vm_step(VM *vm) {
         case OP_STOREI: {
             uint8_t reg = vm->memory[vm->pc++];
             uint8_t imm = vm->memory[vm->pc++];
-            if (reg < REG_COUNT && imm + 3 < MEMORY_SIZE) {
+            if (reg < REG_COUNT && imm + 3u < vm->memory_size) {
                 union {
                     uint32_t u32;
                     uint8_t bytes[4];
@@ -371,9 +597,13 @@ void vm_step(VM *vm) {
             uint8_t reg = vm->memory[vm->pc++];
             if (reg < REG_COUNT) {
                 uint32_t value;
-                scanf("%d", &value);
+                if (!vm_io_read_int(vm, &value)) { // no input yet: retry the opcode later
+                    vm->pc = pc_before;
+                    vm_thread_block_io(vm);
+                    break;
+                }
                 vm->registers[reg] = value;
-                printf("\n");
+                vm_io_write(vm, "\n", 1);
             }
             break;
         }
@@ -381,12 +611,14 @@ void vm_step(VM *vm) {
         case OP_READC: {
             uint8_t reg = vm->memory[vm->pc++];
             if (reg < REG_COUNT) {
-                int ch = getchar();
-                if (ch == '\n') {
-                    ch = getchar();
+                int ch;
+                if (!vm_io_read_char(vm, &ch)) {
+                    vm->pc = pc_before;
+                    vm_thread_block_io(vm);
+                    break;
                 }
                 vm->registers[reg] = ch;
-                printf("\n");
+                vm_io_write(vm, "\n", 1);
             }
             break;
         }
@@ -394,26 +626,24 @@ void vm_step(VM *vm) {
         case OP_READS: {
             uint8_t addr = vm->memory[vm->pc++];
             uint8_t max_len = vm->memory[vm->pc++];
-            if (addr < MEMORY_SIZE && addr + max_len < MEMORY_SIZE) {
+            if (addr < vm->memory_size && addr + max_len < vm->memory_size) {
                 char buffer[256];
-                fgets(buffer, max_len, stdin);
-                buffer[strcspn(buffer, "\n")] = 0;
-                for (size_t i = 0; i < strlen(buffer) && i < max_len; i++) {
-                    if (addr + i < MEMORY_SIZE) {
-                        vm->memory[addr + i] = buffer[i];
-                    }
-                }
-                if (addr + strlen(buffer) < MEMORY_SIZE) {
-                    vm->memory[addr + strlen(buffer)] = '\0';
+                if (!vm_io_read_line(vm, buffer, max_len)) {
+                    vm->pc = pc_before;
+                    vm_thread_block_io(vm);
+                    break;
                 }
-                printf("\n");
+                size_t len = strlen(buffer); // at most max_len - 1
+                memcpy(&vm->memory[addr], buffer, len + 1);
+                vm_io_write(vm, "\n", 1);
             }
             break;
         }
 
         case OP_CALL: {
-            uint8_t addr = vm->memory[vm->pc++];
-            if (addr < MEMORY_SIZE && vm->sp < STACK_SIZE - 1) {
+            uint16_t addr = (vm->memory[vm->pc] << 8) | vm->memory[vm->pc + 1];
+            vm->pc += 2;
+            if (addr < vm->memory_size && vm->sp < STACK_SIZE - 1) {
                 vm->stack[++vm->sp] = vm->pc;
                 vm->pc = addr;
                 //printf("[%02X] CALL %02X\n", pc_before, addr);
@@ -421,13 +651,62 @@ void vm_step(VM *vm) {
             break;
         }
 
+        case OP_CALLR: { // CALL Rn
+            uint8_t reg = vm->memory[vm->pc++];
+            if (reg >= REG_COUNT) break;
+            if (vm->registers[reg] >= vm->memory_size) {
+                vm_fault(vm, VM_ERR_PC);
+            } else if (vm->sp < STACK_SIZE - 1) {
+                vm->stack[++vm->sp] = vm->pc;
+                vm->pc = (uint16_t)vm->registers[reg];
+            }
+            break;
+        }
+
+        case OP_NCALL: {
+            uint8_t index = vm->memory[vm->pc++];
+            if (index < NATIVE_COUNT && vm->natives[index]) {
+                if (vm->natives[index](vm) != 0) {
+                    vm_fault(vm, VM_ERR_NATIVE);
+                }
+            } else {
+                vm_fault(vm, VM_ERR_NATIVE);
+            }
+            break;
+        }
+
+        case OP_SPAWN: {
+            uint8_t reg = vm->memory[vm->pc++];
+            uint16_t addr = (vm->memory[vm->pc] << 8) | vm->memory[vm->pc + 1];
+            vm->pc += 2;
+            if (reg < REG_COUNT && addr < vm->memory_size) {
+                vm->registers[reg] = (uint32_t)vm_thread_spawn(vm, addr);
+            }
+            break;
+        }
+
+        case OP_YIELD: {
+            if (vm->thread_count > 1) {
+                vm_thread_switch(vm);
+            }
+            break;
+        }
+
+        case OP_JOIN: {
+            uint8_t reg = vm->memory[vm->pc++];
+            if (reg < REG_COUNT) {
+                vm_thread_join(vm, vm->registers[reg]);
+            }
+            break;
+        }
+
         case OP_RET: {
             if (vm->sp >= 0) {
                 vm->pc = vm->stack[vm->sp--];
                 //printf("[%02X] RET\n", pc_before);
             } else {
                 //printf("[%02X] RET ERR\n", pc_before);
-                vm->running = 0;
+                vm_fault(vm, VM_ERR_STACK);
             }
             break;
         }
@@ -439,27 +718,29 @@ void vm_step(VM *vm) {
                 //printf("[%02X] PUSH R%d\n", pc_before, reg);
             } else if (vm->sp >= STACK_SIZE - 1) {
                 //printf("[%02X] PUSH ERR\n", pc_before);
-                vm->running = 0;
+                vm_fault(vm, VM_ERR_STACK);
             }
             break;
         }
 
-        case OP_POP: {
+        case OP_POP:
+        case OP_POP_NF: {
             uint8_t reg = vm->memory[vm->pc++];
             if (reg < REG_COUNT && vm->sp >= 0) {
                 vm->registers[reg] = vm->stack[vm->sp--];
-                set_flags_after_operation(vm, (int32_t)vm->registers[reg], vm->registers[reg], 0, 12);
+                if (opcode == OP_POP) set_flags_after_operation(vm, (int32_t)vm->registers[reg], vm->registers[reg], 0, 12);
                 //printf("[%02X] POP R%d\n", pc_before, reg);
             } else if (vm->sp < 0) {
                 //printf("[%02X] POP ERR\n", pc_before);
-                vm->running = 0;
+                vm_fault(vm, VM_ERR_STACK);
             }
             break;
         }
 
         case OP_JNZ: {
-            uint8_t addr = vm->memory[vm->pc++];
-            if (!vm->flags.zero_flag && addr < MEMORY_SIZE) {
+            uint16_t addr = (vm->memory[vm->pc] << 8) | vm->memory[vm->pc + 1];
+            vm->pc += 2;
+            if (!vm->flags.zero_flag && addr < vm->memory_size) {
                 //printf("[%02X] JNZ %02X\n", pc_before, addr);
                 vm->pc = addr;
             } else {
@@ -469,8 +750,9 @@ void vm_step(VM *vm) {
         }
 
         case OP_JE: {
-            uint8_t addr = vm->memory[vm->pc++];
-            if (vm->flags.zero_flag && addr < MEMORY_SIZE) {
+            uint16_t addr = (vm->memory[vm->pc] << 8) | vm->memory[vm->pc + 1];
+            vm->pc += 2;
+            if (vm->flags.zero_flag && addr < vm->memory_size) {
                 //printf("[%02X] JE %02X\n", pc_before, addr);
                 vm->pc = addr;
             } else {
@@ -480,9 +762,10 @@ void vm_step(VM *vm) {
         }
 
         case OP_JNE: {
-            uint8_t addr = vm->memory[vm->pc++];
+            uint16_t addr = (vm->memory[vm->pc] << 8) | vm->memory[vm->pc + 1];
+            vm->pc += 2;
             //printf("[0x%02X] JNE  #0x%02X", pc_before, addr);
-            if (!vm->flags.zero_flag && addr < MEMORY_SIZE) {
+            if (!vm->flags.zero_flag && addr < vm->memory_size) {
                 //printf("  ; TAKEN -> PC=0x%02X\n", addr);
                 vm->pc = addr;
             } else {
@@ -492,8 +775,9 @@ void vm_step(VM *vm) {
         }
 
         case OP_JG: {
-            uint8_t addr = vm->memory[vm->pc++];
-            if (!vm->flags.zero_flag && (vm->flags.sign_flag == vm->flags.overflow_flag) && addr < MEMORY_SIZE) {
+            uint16_t addr = (vm->memory[vm->pc] << 8) | vm->memory[vm->pc + 1];
+            vm->pc += 2;
+            if (!vm->flags.zero_flag && (vm->flags.sign_flag == vm->flags.overflow_flag) && addr < vm->memory_size) {
                 //printf("[%02X] JG %02X\n", pc_before, addr);
                 vm->pc = addr;
             } else {
@@ -503,9 +787,10 @@ void vm_step(VM *vm) {
         }
 
         case OP_JGE: {  // Jump if Greater or Equal (SF == OF)
-            uint8_t addr = vm->memory[vm->pc++];
+            uint16_t addr = (vm->memory[vm->pc] << 8) | vm->memory[vm->pc + 1];
+            vm->pc += 2;
             //printf("[0x%02X] JGE  #0x%02X", pc_before, addr);
-            if (vm->flags.sign_flag == vm->flags.overflow_flag && addr < MEMORY_SIZE) {
+            if (vm->flags.sign_flag == vm->flags.overflow_flag && addr < vm->memory_size) {
                 //printf("  ; TAKEN -> PC=0x%02X\n", addr);
                 vm->pc = addr;
             } else {
@@ -515,8 +800,9 @@ void vm_step(VM *vm) {
         }
 
         case OP_JL: {
-            uint8_t addr = vm->memory[vm->pc++];
-            if (vm->flags.sign_flag != vm->flags.overflow_flag && addr < MEMORY_SIZE) {
+            uint16_t addr = (vm->memory[vm->pc] << 8) | vm->memory[vm->pc + 1];
+            vm->pc += 2;
+            if (vm->flags.sign_flag != vm->flags.overflow_flag && addr < vm->memory_size) {
                 //printf("[%02X] JL %02X\n", pc_before, addr);
                 vm->pc = addr;
             } else {
@@ -526,7 +812,8 @@ void vm_step(VM *vm) {
         }
 
         case OP_JLE: {
-            uint8_t addr = vm->memory[vm->pc++];
+            uint16_t addr = (vm->memory[vm->pc] << 8) | vm->memory[vm->pc + 1];
+            vm->pc += 2;
             //printf("[0x%02X] JLE  #0x%02X", pc_before, addr);
             if (vm->flags.zero_flag || (vm->flags.sign_flag != vm->flags.overflow_flag)) {
                 //printf("  ; TAKEN -> PC=0x%02X\n", addr); 
@@ -537,16 +824,199 @@ void vm_step(VM *vm) {
             break;
         }
 
+        case OP_DJNZ: { // flags are left alone
+            uint8_t reg = vm->memory[vm->pc++];
+            uint16_t addr = (vm->memory[vm->pc] << 8) | vm->memory[vm->pc + 1];
+            vm->pc += 2;
+            if (reg < REG_COUNT && --vm->registers[reg] != 0 && addr < vm->memory_size) vm->pc = addr;
+            break;
+        }
+
+        // Bcc Rs, Rt, addr / BccI Rs, imm, addr: CMP or CMPI and the jump in one, flags are left alone
+        case OP_BEQ: case OP_BNE: case OP_BLT: case OP_BLE: case OP_BGT: case OP_BGE:
+        case OP_BEQI: case OP_BNEI: case OP_BLTI: case OP_BLEI: case OP_BGTI: case OP_BGEI: {
+            uint8_t reg1 = vm->memory[vm->pc++];
+            uint8_t operand = vm->memory[vm->pc++];
+            uint16_t addr = (vm->memory[vm->pc] << 8) | vm->memory[vm->pc + 1];
+            vm->pc += 2;
+            int imm = opcode >= OP_BEQI;
+            if (reg1 >= REG_COUNT || (!imm && operand >= REG_COUNT)) break;
+
+            int32_t a = (int32_t)vm->registers[reg1];
+            int32_t b = imm ? operand : (int32_t)vm->registers[operand];
+            int taken;
+            switch ((opcode - OP_BEQ) % 6) {
+                case 0:  taken = a == b; break;
+                case 1:  taken = a != b; break;
+                case 2:  taken = a < b; break;
+                case 3:  taken = a <= b; break;
+                case 4:  taken = a > b; break;
+                default: taken = a >= b; break;
+            }
+            if (taken && addr < vm->memory_size) vm->pc = addr;
+            break;
+        }
+
         case OP_JMP: {
-            uint8_t addr = vm->memory[vm->pc++]; // Непосредственный адрес (1 байт)
+            uint16_t addr = (vm->memory[vm->pc] << 8) | vm->memory[vm->pc + 1]; // absolute address, hi lo
             vm->pc = addr;
             //printf("JMP to address %d\n", addr);
             break;
         }
 
+        case OP_JMPR: { // JMP Rn
+            uint8_t reg = vm->memory[vm->pc++];
+            if (reg >= REG_COUNT) break;
+            if (vm->registers[reg] < vm->memory_size) vm->pc = (uint16_t)vm->registers[reg];
+            else vm_fault(vm, VM_ERR_PC);
+            break;
+        }
+
+        // SWITCH Rn, table: jumps to entry Rn of the table, an index past its count falls through
+        case OP_SWITCH: {
+            uint8_t reg = vm->memory[vm->pc++];
+            uint32_t table = (vm->memory[vm->pc] << 8) | vm->memory[vm->pc + 1];
+            vm->pc += 2;
+            if (reg >= REG_COUNT || table + 2 > vm->memory_size) break;
+
+            uint32_t index = vm->registers[reg];
+            uint32_t count = (vm->memory[table] << 8) | vm->memory[table + 1];
+            uint32_t at = table + 2 + 2 * index;
+            if (index >= count || at + 2 > vm->memory_size) break;
+            uint16_t addr = (vm->memory[at] << 8) | vm->memory[at + 1];
+            if (addr < vm->memory_size) vm->pc = addr;
+            else vm_fault(vm, VM_ERR_PC);
+            break;
+        }
+
+        // dense forms (vasm -z), the same as their full-width opcodes
+        case OP_ADD_PK: case OP_SUB_PK: case OP_MUL_PK: case OP_DIV_PK: case OP_AND_PK: case OP_OR_PK: case OP_XOR_PK:
+        case OP_SHL_PK: case OP_SHR_PK: case OP_ADDI_PK: case OP_XORI_PK: case OP_ORI_PK: case OP_SHLI_PK: case OP_SHRI_PK:
+        case OP_ADD_PK_NF: case OP_SUB_PK_NF: case OP_MUL_PK_NF: case OP_DIV_PK_NF: case OP_AND_PK_NF: case OP_OR_PK_NF:
+        case OP_XOR_PK_NF: case OP_SHL_PK_NF: case OP_SHR_PK_NF: case OP_ADDI_PK_NF: case OP_XORI_PK_NF: case OP_ORI_PK_NF:
+        case OP_SHLI_PK_NF: case OP_SHRI_PK_NF: {
+            packed_alu(vm, opcode);
+            break;
+        }
+
+        case OP_MOV_PK:
+        case OP_MOV_PK_NF: {
+            uint8_t regs = vm->memory[vm->pc++];
+            uint32_t value = vm->registers[regs & 0x0F];
+            vm->registers[regs >> 4] = value;
+            if (opcode == OP_MOV_PK) set_flags_after_operation(vm, (int32_t)value, value, 0, 9);
+            break;
+        }
+
+        case OP_LDB_PK:
+        case OP_LDB_PK_NF: {
+            uint8_t regs = vm->memory[vm->pc++];
+            uint16_t addr = vm->registers[regs & 0x0F];
+            if (addr < vm->memory_size) {
+                vm->registers[regs >> 4] = vm->memory[addr];
+                if (opcode == OP_LDB_PK) set_flags_after_operation(vm, vm->memory[addr], vm->memory[addr], 0, 11);
+            }
+            break;
+        }
+
+        case OP_CMP_PK: {
+            uint8_t regs = vm->memory[vm->pc++];
+            uint32_t a = vm->registers[regs >> 4];
+            uint32_t b = vm->registers[regs & 0x0F];
+            set_flags_after_operation(vm, (int32_t)a - (int32_t)b, a, b, 1);
+            break;
+        }
+
+        case OP_LOADB:
+        case OP_LOADB_NF: {
+            uint8_t reg = vm->memory[vm->pc++];
+            uint8_t value = vm->memory[vm->pc++];
+            if (reg < REG_COUNT) {
+                vm->registers[reg] = value;
+                if (opcode == OP_LOADB) set_flags_after_operation(vm, value, value, 0, 10);
+            }
+            break;
+        }
+
+        case OP_ALLOC: { // flags stay, Rd = 0 tells a failed ALLOC
+            uint8_t reg_dest = vm->memory[vm->pc++];
+            uint8_t reg_size = vm->memory[vm->pc++];
+            if (reg_dest < REG_COUNT && reg_size < REG_COUNT) {
+                vm->registers[reg_dest] = vm_heap_alloc(vm, vm->registers[reg_size]);
+            }
+            break;
+        }
+
+        case OP_FREE: {
+            uint8_t reg = vm->memory[vm->pc++];
+            if (reg < REG_COUNT && vm_heap_free(vm, vm->registers[reg]) != 0) {
+                vm_fault(vm, VM_ERR_HEAP);
+            }
+            break;
+        }
+
+        case OP_RESET: {
+            vm_heap_reset(vm);
+            break;
+        }
+
+        case OP_JMP_S: {
+            uint32_t addr = short_target(vm);
+            if (addr < vm->memory_size) vm->pc = (uint16_t)addr;
+            else vm_fault(vm, VM_ERR_PC);
+            break;
+        }
+
+        case OP_JE_S: case OP_JNE_S: case OP_JG_S: case OP_JGE_S: case OP_JL_S: case OP_JLE_S: {
+            uint32_t addr = short_target(vm);
+            int taken;
+            switch (opcode) {
+                case OP_JE_S:  taken = vm->flags.zero_flag; break;
+                case OP_JNE_S: taken = !vm->flags.zero_flag; break;
+                case OP_JG_S:  taken = !vm->flags.zero_flag && vm->flags.sign_flag == vm->flags.overflow_flag; break;
+                case OP_JGE_S: taken = vm->flags.sign_flag == vm->flags.overflow_flag; break;
+                case OP_JL_S:  taken = vm->flags.sign_flag != vm->flags.overflow_flag; break;
+                default:       taken = vm->flags.zero_flag || vm->flags.sign_flag != vm->flags.overflow_flag; break;
+            }
+            if (taken && addr < vm->memory_size) vm->pc = (uint16_t)addr;
+            break;
+        }
+
+        case OP_DJNZ_S: {
+            uint8_t reg = vm->memory[vm->pc++];
+            uint32_t addr = short_target(vm);
+            if (reg < REG_COUNT && --vm->registers[reg] != 0 && addr < vm->memory_size) vm->pc = (uint16_t)addr;
+            break;
+        }
+
+        // Bcc Rs:Rt, rel8 / BccI Rs, imm, rel8
+        case OP_BEQ_S: case OP_BNE_S: case OP_BLT_S: case OP_BLE_S: case OP_BGT_S: case OP_BGE_S:
+        case OP_BEQI_S: case OP_BNEI_S: case OP_BLTI_S: case OP_BLEI_S: case OP_BGTI_S: case OP_BGEI_S: {
+            int imm = opcode >= OP_BEQI_S;
+            uint8_t first = vm->memory[vm->pc++];
+            uint8_t reg1 = imm ? first : first >> 4;
+            uint8_t operand = imm ? vm->memory[vm->pc++] : first & 0x0F;
+            uint32_t addr = short_target(vm);
+            if (reg1 >= REG_COUNT) break;
+
+            int32_t a = (int32_t)vm->registers[reg1];
+            int32_t b = imm ? operand : (int32_t)vm->registers[operand];
+            int taken;
+            switch ((opcode - OP_BEQ_S) % 6) {
+                case 0:  taken = a == b; break;
+                case 1:  taken = a != b; break;
+                case 2:  taken = a < b; break;
+                case 3:  taken = a <= b; break;
+                case 4:  taken = a > b; break;
+                default: taken = a >= b; break;
+            }
+            if (taken && addr < vm->memory_size) vm->pc = (uint16_t)addr;
+            break;
+        }
+
         default: {
-            printf("[%02X] UNKNOWN\n", pc_before);
-            vm->running = 0;
+            //printf("[%02X] UNKNOWN\n", pc_before);
+            vm_fault(vm, VM_ERR_OPCODE);
             break;
         }
     }
@@ -0,0 +1,41 @@
+#include "vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Execution profile for vasm -P: a counter per address, bumped by vm_step()
+ * for every instruction it executes while vm->profile is set. The file is
+ * text, one executed instruction per line:
+ *
+ *   address opcode line count      (hex, hex, decimal, decimal)
+ *
+ * with the source line from the VBIN line table (0 without one), so vasm
+ * can check that an entry still belongs to the instruction it assembles.
+ */
+
+// starts counting from zero; -1 if the counters can't be allocated
+int vm_profile_start(VM *vm) {
+    if (!vm->profile) vm->profile = calloc(vm->memory_size, sizeof(uint32_t));
+    else memset(vm->profile, 0, vm->memory_size * sizeof(uint32_t));
+    return vm->profile ? 0 : -1;
+}
+
+void vm_profile_release(VM *vm) {
+    free(vm->profile);
+    vm->profile = NULL;
+}
+
+// -1 if the file can't be written
+int vm_profile_write(const VM *vm, const char *path) {
+    FILE *file = fopen(path, "w");
+    if (!file) return -1;
+
+    fprintf(file, "# vm profile: address opcode line count\n");
+    for (uint32_t addr = 0; vm->profile && addr < vm->memory_size; addr++) {
+        if (vm->profile[addr] == 0) continue;
+        fprintf(file, "%04X %02X %d %u\n", addr, vm_break_peek(vm, (uint16_t)addr),
+                vm_line_at(vm, (uint16_t)addr), vm->profile[addr]);
+    }
+    return fclose(file) == 0 ? 0 : -1;
+}
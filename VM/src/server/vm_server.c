@@ -0,0 +1,299 @@
+#define _POSIX_C_SOURCE 200809L
+#include "vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Server mode: a pool of workers, each with a VM created at startup, runs
+ * requests arriving over a Unix domain socket. Programs are cached by their
+ * FNV-1a hash, after the first run a client can send the hash alone.
+ *
+ * Request:  server_request_t, then code_len bytes of code and input_len bytes of input.
+ * Response: frames of { uint8 type, uint32 len, payload }
+ *           'O' program output
+ *           'M' hash is not cached, send the code
+ *           'S' end of run: int32 status, int32 error, uint32 steps, uint64 hash
+ * Integers are in host byte order, the socket is local.
+ */
+
+#if defined(__unix__) || defined(__APPLE__)
+
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+typedef struct {
+    uint8_t kind; // 'B' code follows, 'H' run a cached program
+    uint8_t reserved[3];
+    uint32_t budget; // steps
+    uint32_t code_len; // 0 for 'H'
+    uint32_t input_len;
+    uint64_t hash; // program to run for 'H'
+} server_request_t;
+
+typedef struct {
+    uint64_t hash;
+    uint32_t len;
+    uint8_t *code; // NULL = free slot
+} cache_entry_t;
+
+typedef struct {
+    cache_entry_t cache[SERVER_CACHE_SIZE]; // direct mapped by hash
+    pthread_rwlock_t cache_lock;
+
+    int queue[SERVER_QUEUE]; // accepted connections waiting for a worker
+    int queue_head;
+    int queue_count;
+    pthread_mutex_t queue_lock;
+    pthread_cond_t queue_ready;
+    pthread_cond_t queue_free;
+} server_t;
+
+typedef struct {
+    server_t *server;
+    VM *vm;
+    int fd; // connection being served
+    uint8_t code[MEMORY_MAX];
+    uint8_t input[SERVER_MAX_INPUT];
+    uint32_t input_len;
+    uint32_t input_pos;
+    uint8_t out[SERVER_OUT_BUFFER]; // output collected until the end of a slice
+    int out_len;
+    int failed; // client went away
+} worker_t;
+
+static uint64_t hash_code(const uint8_t *code, uint32_t len) { // FNV-1a, 64 bit
+    uint64_t h = 0xCBF29CE484222325ull;
+    for (uint32_t i = 0; i < len; i++) {
+        h ^= code[i];
+        h *= 0x100000001B3ull;
+    }
+    return h;
+}
+
+static int read_full(int fd, void *buf, size_t len) {
+    uint8_t *p = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int write_full(int fd, const void *buf, size_t len) {
+    const uint8_t *p = buf;
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void send_frame(worker_t *w, uint8_t type, const void *payload, uint32_t len) {
+    uint8_t header[5];
+    header[0] = type;
+    memcpy(header + 1, &len, sizeof(len));
+    if (w->failed) return;
+    if (write_full(w->fd, header, sizeof(header)) != 0 || write_full(w->fd, payload, len) != 0) {
+        w->failed = 1;
+    }
+}
+
+static void flush_output(worker_t *w) {
+    if (w->out_len > 0) send_frame(w, 'O', w->out, w->out_len);
+    w->out_len = 0;
+}
+
+static int server_read(void *user, uint8_t *buf, int cap) {
+    worker_t *w = user;
+    uint32_t n = w->input_len - w->input_pos;
+    if (n > (uint32_t)cap) n = cap;
+    memcpy(buf, w->input + w->input_pos, n);
+    w->input_pos += n;
+    return (int)n; // all input came with the request, 0 is its end
+}
+
+static void server_write(void *user, const uint8_t *buf, int len) {
+    worker_t *w = user;
+    while (len > 0) {
+        if (w->out_len == SERVER_OUT_BUFFER) flush_output(w);
+        int n = SERVER_OUT_BUFFER - w->out_len;
+        if (n > len) n = len;
+        memcpy(w->out + w->out_len, buf, n);
+        w->out_len += n;
+        buf += n;
+        len -= n;
+    }
+}
+
+// copies the program into the cache unless it is there already
+static void cache_put(server_t *s, uint64_t hash, const uint8_t *code, uint32_t len) {
+    cache_entry_t *e = &s->cache[hash % SERVER_CACHE_SIZE];
+    pthread_rwlock_wrlock(&s->cache_lock);
+    if (!e->code || e->hash != hash) {
+        uint8_t *copy = malloc(len ? len : 1);
+        if (copy) {
+            memcpy(copy, code, len);
+            free(e->code);
+            e->code = copy;
+            e->hash = hash;
+            e->len = len;
+        }
+    }
+    pthread_rwlock_unlock(&s->cache_lock);
+}
+
+// loads a cached program into the worker's VM, -1 if the hash is unknown
+static int cache_load(server_t *s, VM *vm, uint64_t hash) {
+    cache_entry_t *e = &s->cache[hash % SERVER_CACHE_SIZE];
+    int result = -1;
+    pthread_rwlock_rdlock(&s->cache_lock);
+    if (e->code && e->hash == hash) {
+        vm_load_prog(vm, e->code, e->len);
+        result = 0;
+    }
+    pthread_rwlock_unlock(&s->cache_lock);
+    return result;
+}
+
+// one request; -1 drops the connection
+static int serve_request(worker_t *w, const server_request_t *req) {
+    if (req->code_len > MEMORY_MAX || req->input_len > SERVER_MAX_INPUT) return -1;
+    if (req->kind != 'B' && (req->kind != 'H' || req->code_len != 0)) return -1; // 'H' code would be read as input
+
+    uint64_t hash = req->hash;
+    if (req->kind == 'B') {
+        if (read_full(w->fd, w->code, req->code_len) != 0) return -1;
+        hash = hash_code(w->code, req->code_len);
+    }
+    if (read_full(w->fd, w->input, req->input_len) != 0) return -1;
+
+    if (req->kind == 'B') {
+        if (vm_load_prog(w->vm, w->code, req->code_len) == 0) {
+            cache_put(w->server, hash, w->code, req->code_len);
+        }
+    } else if (cache_load(w->server, w->vm, hash) != 0) {
+        send_frame(w, 'M', NULL, 0);
+        return w->failed ? -1 : 0;
+    }
+
+    w->input_len = req->input_len;
+    w->input_pos = 0;
+    w->out_len = 0;
+    vm_set_io(w->vm, server_read, server_write, w);
+
+    // slices keep the output streaming while a long program runs
+    int status = vm_get_error(w->vm) != VM_ERR_NONE ? VM_STATUS_ERROR : VM_STATUS_BUDGET;
+    uint32_t left = req->budget;
+    while (status == VM_STATUS_BUDGET && left > 0 && !w->failed) {
+        uint32_t slice = left < HOST_SLICE ? left : HOST_SLICE;
+        status = vm_run(w->vm, slice);
+        flush_output(w);
+        left -= slice;
+    }
+
+    uint8_t result[20];
+    int32_t status32 = status, error32 = vm_get_error(w->vm);
+    uint32_t steps = vm_get_steps(w->vm);
+    memcpy(result, &status32, 4);
+    memcpy(result + 4, &error32, 4);
+    memcpy(result + 8, &steps, 4);
+    memcpy(result + 12, &hash, 8);
+    send_frame(w, 'S', result, sizeof(result));
+    return w->failed ? -1 : 0;
+}
+
+static void *worker_main(void *arg) {
+    worker_t *w = arg;
+    server_t *s = w->server;
+    for (;;) {
+        pthread_mutex_lock(&s->queue_lock);
+        while (s->queue_count == 0) pthread_cond_wait(&s->queue_ready, &s->queue_lock);
+        w->fd = s->queue[s->queue_head];
+        s->queue_head = (s->queue_head + 1) % SERVER_QUEUE;
+        s->queue_count--;
+        pthread_cond_signal(&s->queue_free);
+        pthread_mutex_unlock(&s->queue_lock);
+
+        // a connection may send any number of requests
+        server_request_t req;
+        w->failed = 0;
+        while (read_full(w->fd, &req, sizeof(req)) == 0) {
+            if (serve_request(w, &req) != 0) break;
+        }
+        close(w->fd);
+    }
+    return NULL;
+}
+
+// listens on path and serves requests with the given number of workers, returns only on error
+int vm_server_run(const char *path, int workers) {
+    struct sockaddr_un addr;
+    if (workers <= 0 || strlen(path) >= sizeof(addr.sun_path)) return -1;
+
+    server_t *s = calloc(1, sizeof(server_t));
+    if (!s) return -1;
+    pthread_rwlock_init(&s->cache_lock, NULL);
+    pthread_mutex_init(&s->queue_lock, NULL);
+    pthread_cond_init(&s->queue_ready, NULL);
+    pthread_cond_init(&s->queue_free, NULL);
+
+    // the pool is warm before the first request: VMs mapped, buffers allocated
+    for (int i = 0; i < workers; i++) {
+        worker_t *w = calloc(1, sizeof(worker_t));
+        if (!w || !(w->vm = vm_create())) return -1;
+        w->server = s;
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, worker_main, w) != 0) return -1;
+        pthread_detach(thread);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, SERVER_QUEUE) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    for (;;) {
+        int client = accept(fd, NULL, NULL);
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            close(fd);
+            return -1;
+        }
+
+        pthread_mutex_lock(&s->queue_lock);
+        while (s->queue_count == SERVER_QUEUE) pthread_cond_wait(&s->queue_free, &s->queue_lock);
+        s->queue[(s->queue_head + s->queue_count) % SERVER_QUEUE] = client;
+        s->queue_count++;
+        pthread_cond_signal(&s->queue_ready);
+        pthread_mutex_unlock(&s->queue_lock);
+    }
+}
+
+#else // no Unix domain sockets: server mode is not available
+
+int vm_server_run(const char *path, int workers) {
+    (void)path; (void)workers;
+    return -1;
+}
+
+#endif
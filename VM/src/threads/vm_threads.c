@@ -0,0 +1,114 @@
+#include "vm.h"
+#include <string.h>
+
+/*
+ * Green threads. All threads share vm->memory, each one has its own
+ * pc, registers, stack and flags. The running thread works directly on the
+ * VM fields, a switch saves them into its vm_thread_t and loads the next one.
+ */
+
+static void save_context(VM *vm, vm_thread_t *t) {
+    t->pc = vm->pc;
+    t->sp = vm->sp;
+    t->flags = vm->flags;
+    memcpy(t->registers, vm->registers, sizeof(t->registers));
+    memcpy(t->stack, vm->stack, (vm->sp + 1) * sizeof(int32_t));
+}
+
+static void load_context(VM *vm, uint8_t id) {
+    vm_thread_t *t = &vm->threads[id];
+    vm->pc = t->pc;
+    vm->sp = t->sp;
+    vm->flags = t->flags;
+    memcpy(vm->registers, t->registers, sizeof(vm->registers));
+    memcpy(vm->stack, t->stack, (t->sp + 1) * sizeof(int32_t));
+    vm->current_thread = id;
+}
+
+void vm_threads_init(VM *vm) {
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        vm->threads[i].state = THREAD_FREE;
+        vm->threads[i].gen = 0;
+    }
+    vm->threads[0].state = THREAD_READY;
+    vm->current_thread = 0;
+    vm->thread_count = 1;
+    vm->slice = 0;
+}
+
+// new thread starts at addr with a copy of the caller's registers, returns its id or -1.
+// The id is gen << 8 | slot, so a JOIN on a thread whose slot was reused does not wait for the new one
+int vm_thread_spawn(VM *vm, uint16_t addr) {
+    for (int id = 1; id < THREAD_COUNT; id++) {
+        vm_thread_t *t = &vm->threads[id];
+        if (t->state != THREAD_FREE) continue;
+
+        t->state = THREAD_READY;
+        t->gen++;
+        t->pc = addr;
+        t->sp = -1;
+        memset(&t->flags, 0, sizeof(t->flags));
+        memcpy(t->registers, vm->registers, sizeof(t->registers));
+        vm->thread_count++;
+        return t->gen << 8 | id;
+    }
+    return -1;
+}
+
+// round-robin to the next runnable thread, the current one included
+void vm_thread_switch(VM *vm) {
+    vm->slice = 0;
+    vm_thread_t *cur = &vm->threads[vm->current_thread];
+    if (cur->state != THREAD_FREE) save_context(vm, cur);
+
+    for (int n = 1; n <= THREAD_COUNT; n++) {
+        uint8_t id = (vm->current_thread + n) % THREAD_COUNT;
+        vm_thread_t *t = &vm->threads[id];
+
+        // a parked thread retries its input opcode and parks again if there is still nothing
+        if (t->state == THREAD_READY || t->state == THREAD_BLOCKED_IO) {
+            t->state = THREAD_READY;
+            load_context(vm, id);
+            return;
+        }
+    }
+
+    vm_fault(vm, VM_ERR_DEADLOCK); // every thread waits in JOIN
+}
+
+// an id whose slot is free or spawned again since is a thread that has already finished
+void vm_thread_join(VM *vm, uint32_t tid) {
+    uint32_t id = tid & 0xFF;
+    if (tid >> 16 || id >= THREAD_COUNT || id == vm->current_thread || vm->threads[id].state == THREAD_FREE ||
+        vm->threads[id].gen != tid >> 8) {
+        return;
+    }
+    vm_thread_t *cur = &vm->threads[vm->current_thread];
+    cur->state = THREAD_JOINING;
+    cur->join_id = id;
+    vm_thread_switch(vm);
+}
+
+void vm_thread_exit(VM *vm) {
+    uint8_t id = vm->current_thread;
+    vm->threads[id].state = THREAD_FREE;
+    vm->thread_count--;
+
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        vm_thread_t *t = &vm->threads[i];
+        if (t->state == THREAD_JOINING && t->join_id == id) t->state = THREAD_READY;
+    }
+    vm_thread_switch(vm);
+}
+
+// an input opcode found no data and rewound pc: park the thread, or suspend the VM if nothing else can run
+void vm_thread_block_io(VM *vm) {
+    for (int id = 0; id < THREAD_COUNT; id++) {
+        if (id != vm->current_thread && vm->threads[id].state == THREAD_READY) {
+            vm->threads[vm->current_thread].state = THREAD_BLOCKED_IO;
+            vm_thread_switch(vm);
+            return;
+        }
+    }
+    vm->io.wait = 1;
+}